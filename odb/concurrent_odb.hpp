@@ -0,0 +1,157 @@
+#ifndef CONCURRENT_ODB_HPP_INCLUDED
+#define CONCURRENT_ODB_HPP_INCLUDED
+
+#include "odb.hpp"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+namespace pensar_digital
+{
+  namespace odb
+  {
+    /// ODB read by any number of threads without locks while one thread at a time writes.
+    ///
+    /// Two copies of the index are kept. Readers only read the published one, which nothing modifies while they do.
+    /// A writer waits for the readers still on the other copy to leave (the grace period), brings it up to date with
+    /// the previous write, applies its own change and publishes it with an atomic store. The previous copy gets the
+    /// change from the next write, so a writer seldom waits: its grace period ran while nobody wrote. A read
+    /// increments and decrements a counter on a cache line of its own and never waits for a writer. Memory is twice
+    /// an ODB; each copy compacts its removed entries as ODB::remove does.
+    ///
+    /// \code {.cpp}
+    ///  ConcurrentODB<Person> db;
+    ///  db.add ("Maria da Silva", &maria);                 // Any thread, serialized.
+    ///  db.contains ("silva", result);                     // Any thread, lock free.
+    ///  db.read ([&] (const ConcurrentODB<Person>::Index& index)
+    ///  {
+    ///    for (Person* p : index.query (ConcurrentODB<Person>::Query ("silva") && !ConcurrentODB<Person>::Query ("maria")))
+    ///      show (p);
+    ///  });
+    /// \endcode
+    template <class T, class Key = std::string, class Normalizer = case_insensitive_no_accents_normalizer<Key>>
+    class ConcurrentODB
+    {
+      public:
+        typedef ODB<T, Key, Normalizer> Index;
+        typedef typename Index::Query Query;
+        typedef typename Index::ResultSet ResultSet;
+
+        static const size_t READER_SLOTS = 64; // Counters per copy, readers spread over them by thread.
+
+        explicit ConcurrentODB (size_t gram_size = Index::DEFAULT_GRAM_SIZE): copies{Index (gram_size), Index (gram_size)} {};
+
+        ConcurrentODB (const ConcurrentODB&) = delete;
+        ConcurrentODB& operator= (const ConcurrentODB&) = delete;
+
+        /// Calls f with the published index. f must not keep it, nor Results of it, after it returns.
+        template <class F>
+        auto read (F f) const
+        {
+          Guard guard (*this);
+          return f (static_cast<const Index&> (copies[guard.copy]));
+        }
+
+        bool contains (const Key& key, ResultSet& result_set, bool clear_result_set = true) const
+        {
+          return read ([&] (const Index& index) {return index.contains (key, result_set, clear_result_set);});
+        }
+
+        void add (const Key& key, T* obj) { write (Change {true, key, obj}); }
+
+        bool remove (const Key& key, T* obj) { return write (Change {false, key, obj}); }
+
+        /// Writes published so far.
+        size_t version () const { return versions.load (std::memory_order_acquire); }
+
+      private:
+        struct alignas(64) Counter
+        {
+          std::atomic<size_t> readers {0};
+        };
+
+        struct Change
+        {
+          bool add;
+          Key key;
+          T* obj;
+
+          bool apply (Index& index) const
+          {
+            if (!add)
+              return index.remove (key, obj);
+            index.add (key, obj);
+            return true;
+          }
+        };
+
+        Index copies[2];
+        mutable Counter counters[2][READER_SLOTS];
+        std::atomic<size_t> published {0}; // The copy readers use.
+        std::atomic<size_t> versions {0};
+        std::mutex writer;
+        std::vector<Change> pending; // Published, but not applied to the other copy yet. Guarded by writer.
+
+        static size_t slot ()
+        {
+          static std::atomic<size_t> next {0};
+          thread_local const size_t s = next.fetch_add (1, std::memory_order_relaxed) % READER_SLOTS;
+          return s;
+        }
+
+        // Marks a reader on the published copy. The copy is checked again after the increment: a writer that
+        // switched copies in between may not have seen it, so the reader retries on the new copy.
+        class Guard
+        {
+          public:
+            size_t copy;
+
+            explicit Guard (const ConcurrentODB& db)
+            {
+              const size_t s = slot ();
+              for (;;)
+              {
+                copy = db.published.load (std::memory_order_seq_cst);
+                counter = &db.counters[copy][s].readers;
+                counter->fetch_add (1, std::memory_order_seq_cst);
+                if (db.published.load (std::memory_order_seq_cst) == copy)
+                  return;
+                counter->fetch_sub (1, std::memory_order_release);
+              }
+            }
+
+            ~Guard () { counter->fetch_sub (1, std::memory_order_release); }
+
+          private:
+            std::atomic<size_t>* counter;
+        };
+
+        // Waits until no reader is on copy.
+        void wait_for_readers (size_t copy) const
+        {
+          for (const Counter& c : counters[copy])
+            while (c.readers.load (std::memory_order_seq_cst) != 0)
+              std::this_thread::yield ();
+        }
+
+        bool write (const Change& change)
+        {
+          std::lock_guard<std::mutex> lock (writer);
+          const size_t next = published.load (std::memory_order_relaxed) ^ 1;
+          wait_for_readers (next);
+          for (const Change& c : pending)
+            c.apply (copies[next]);
+          pending.clear ();
+          const bool result = change.apply (copies[next]);
+          published.store (next, std::memory_order_seq_cst);
+          pending.push_back (change);
+          versions.fetch_add (1, std::memory_order_release);
+          return result;
+        }
+    };
+  }
+}
+
+#endif // CONCURRENT_ODB_HPP_INCLUDED
@@ -5,112 +5,558 @@
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <memory>
 #include <functional>
 #include <algorithm>
 #include <utility>
 #include <iterator>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <limits>
 
 namespace pensar_digital
 {
   namespace odb
   {
-    template <class T = std::string>
-    struct case_insensitive_hash : public std::unary_function<T, size_t>
+    /// Normalization policies. A policy maps a key to the form keys are indexed and compared in, character by
+    /// character (one character is never normalized into several).
+    template <class Key = std::string>
+    struct identity_normalizer
     {
-      size_t operator()(T val) const
-      {
-        std::hash<T> shash;
-        return shash(cpplib::lower(val));
-      }
+      Key operator() (const Key& key) const {return key;}
     };
 
-    template <class T = std::string>
-    struct case_insensitive_equal_to: public std::equal_to<T>
+    template <class Key = std::string>
+    struct case_insensitive_normalizer
     {
-      bool operator() (const T& x, const T& y) const {return cpplib::lower(x) == cpplib::lower(y);}
+      Key operator() (const Key& key) const {return cpplib::lower (key);}
     };
 
-    template <class T = std::string>
-    struct no_accents_hash : public std::unary_function<T, size_t>
+    template <class Key = std::string>
+    struct no_accents_normalizer
     {
-      size_t operator()(T val) const
-      {
-        std::hash<T> shash;
-        return shash(cpplib::no_accents(val));
-      }
+      Key operator() (const Key& key) const {return cpplib::no_accents (key);}
     };
 
-    template <class T = std::string>
-    struct no_accents_equal_to: public std::equal_to<T>
+    template <class Key = std::string>
+    struct case_insensitive_no_accents_normalizer
     {
-      bool operator() (const T& x, const T& y) const {return cpplib::no_accents(x) == cpplib::no_accents(y);}
+      Key operator() (const Key& key) const {return cpplib::lower (cpplib::no_accents (key));}
     };
 
-    template <class T = std::string>
-    struct case_insensitive_no_accents_hash : public std::unary_function<T, size_t>
+    /// Hash and equality of keys under a normalization policy, for unordered containers. They normalize on every
+    /// call; ODB normalizes each key once instead.
+    template <class T, class Normalizer>
+    struct normalized_hash
     {
-      size_t operator()(T val) const
+      size_t operator()(const T& val) const
       {
         std::hash<T> shash;
-        return shash(cpplib::lower (cpplib::no_accents(val)));
+        return shash(Normalizer () (val));
       }
     };
 
-    template <class T = std::string>
-    struct case_insensitive_no_accents_equal_to: public std::equal_to<T>
+    template <class T, class Normalizer>
+    struct normalized_equal_to: public std::equal_to<T>
     {
-      bool operator() (const T& x, const T& y) const {return (cpplib::lower (cpplib::no_accents(x)) == cpplib::lower (cpplib::no_accents(y)));}
+      bool operator() (const T& x, const T& y) const {return Normalizer () (x) == Normalizer () (y);}
     };
 
-    template <class T, class Key = std::string, class Hash = case_insensitive_no_accents_hash<Key>, class Pred = case_insensitive_no_accents_equal_to<Key>, class Alloc = std::allocator<std::pair<const Key, T>>>
-    class ODB
+    template <class T = std::string> using case_insensitive_hash = normalized_hash<T, case_insensitive_normalizer<T>>;
+    template <class T = std::string> using case_insensitive_equal_to = normalized_equal_to<T, case_insensitive_normalizer<T>>;
+    template <class T = std::string> using no_accents_hash = normalized_hash<T, no_accents_normalizer<T>>;
+    template <class T = std::string> using no_accents_equal_to = normalized_equal_to<T, no_accents_normalizer<T>>;
+    template <class T = std::string> using case_insensitive_no_accents_hash = normalized_hash<T, case_insensitive_no_accents_normalizer<T>>;
+    template <class T = std::string> using case_insensitive_no_accents_equal_to = normalized_equal_to<T, case_insensitive_no_accents_normalizer<T>>;
+
+    typedef uint32_t ObjectId; // Position of a key in an index, in add order.
+
+    /// Boolean query: a term matches the keys holding it as a substring, && || and ! combine queries.
+    template <class Key = std::string>
+    class BasicQuery
     {
+      public:
+        enum Kind {TERM, AND, OR, NOT};
+
+        BasicQuery (const Key& aterm): kind(TERM), term(aterm) {};
+        BasicQuery (const typename Key::value_type* aterm): kind(TERM), term(aterm) {};
+
+        friend BasicQuery operator&& (const BasicQuery& a, const BasicQuery& b) {return combine (AND, a, b);}
+        friend BasicQuery operator|| (const BasicQuery& a, const BasicQuery& b) {return combine (OR, a, b);}
+        friend BasicQuery operator! (const BasicQuery& a)
+        {
+          BasicQuery q (NOT);
+          q.operands.push_back (a);
+          return q;
+        }
+
+        Kind get_kind () const {return kind;}
+        const Key& get_term () const {return term;}
+        const std::vector<BasicQuery>& get_operands () const {return operands;}
+
       private:
-        typedef std::unordered_multimap<const Key, T*, Hash, Pred, Alloc> OMap;
-        OMap omap;
+        Kind kind;
+        Key term;
+        std::vector<BasicQuery> operands;
 
-      public:
-        ODB (): omap(OMap())  {};
+        explicit BasicQuery (Kind akind): kind(akind) {};
+
+        // Flattens a && b && c into one AND of three operands.
+        static BasicQuery combine (Kind k, const BasicQuery& a, const BasicQuery& b)
+        {
+          BasicQuery q (k);
+          for (const BasicQuery* operand : {&a, &b})
+            if (operand->kind == k)
+              q.operands.insert (q.operands.end (), operand->operands.begin (), operand->operands.end ());
+            else
+              q.operands.push_back (*operand);
+          return q;
+        }
+    };
+
+    /// Query evaluation, shared by every index. An index provides:
+    ///   ObjectId size () const;                                      Number of keys.
+    ///   size_t get_gram_size () const;
+    ///   const ObjectId* find_postings (View gram, size_t& count) const; Sorted ids holding gram, nullptr if none.
+    ///   View key (ObjectId id) const;                                Normalized key (anything a View converts from).
+    ///
+    /// Each node of a query is a cursor over ascending ids that can seek to the first match at or after an id: a
+    /// posting list gallops to it, AND leapfrogs its operands until they agree, OR takes the smallest of its operands.
+    namespace cursor
+    {
+      constexpr ObjectId END = std::numeric_limits<ObjectId>::max (); // Past the last id.
+
+      // Cursor over the ascending ids matching a query node. Targets of successive seeks never decrease.
+      class Node
+      {
+        public:
+          virtual ~Node () {};
+
+          // First match >= target, or END.
+          ObjectId seek (ObjectId target)
+          {
+            if (!positioned || current < target)
+            {
+              current = find (target);
+              positioned = true;
+            }
+            return current;
+          }
+
+        protected:
+          virtual ObjectId find (ObjectId target) = 0;
+
+        private:
+          ObjectId current = 0;
+          bool positioned = false;
+      };
+      typedef std::unique_ptr<Node> NodePtr;
+
+      class Empty: public Node
+      {
+        protected:
+          ObjectId find (ObjectId) {return END;}
+      };
+
+      // Every id below size.
+      class All: public Node
+      {
+        public:
+          explicit All (ObjectId asize): size(asize) {};
+        protected:
+          ObjectId find (ObjectId target) {return target < size ? target : END;}
+        private:
+          ObjectId size;
+      };
+
+      class Postings: public Node
+      {
+        public:
+          Postings (const ObjectId* alist, size_t acount): list(alist), count(acount), pos(0) {};
+        protected:
+          // Gallops: probes pos + 1, + 2, + 4... then binary searches the last step, so skipping n ids costs
+          // O(log n) and a dense walk costs O(1) per id.
+          ObjectId find (ObjectId target)
+          {
+            if (pos < count && list[pos] < target)
+            {
+              size_t lo = pos, step = 1, hi = pos + 1;
+              while (hi < count && list[hi] < target)
+              {
+                lo = hi;
+                step *= 2;
+                hi = lo + step;
+              }
+              pos = std::lower_bound (list + lo + 1, list + std::min (hi, count), target) - list;
+            }
+            return pos < count ? list[pos] : END;
+          }
+        private:
+          const ObjectId* list;
+          size_t count;
+          size_t pos;
+      };
+
+      // Matches of every positive operand that no negative operand matches.
+      class And: public Node
+      {
+        public:
+          And (std::vector<NodePtr>&& apositive, std::vector<NodePtr>&& anegative): positive(std::move (apositive)), negative(std::move (anegative)) {};
+        protected:
+          ObjectId find (ObjectId target)
+          {
+            ObjectId candidate = target;
+            size_t agreed = 0;
+            for (size_t i = 0; ; i = (i + 1) % positive.size ())
+            {
+              const ObjectId id = positive[i]->seek (candidate);
+              if (id == END)
+                return END;
+              if (id != candidate)
+              {
+                candidate = id;
+                agreed = 1;
+              }
+              else if (++agreed >= positive.size ())
+              {
+                if (!excluded (candidate))
+                  return candidate;
+                if (candidate == END - 1)
+                  return END;
+                ++candidate;
+                agreed = 0;
+              }
+            }
+          }
+        private:
+          std::vector<NodePtr> positive;
+          std::vector<NodePtr> negative;
+
+          bool excluded (ObjectId id)
+          {
+            for (NodePtr& n : negative)
+              if (n->seek (id) == id)
+                return true;
+            return false;
+          }
+      };
+
+      class Or: public Node
+      {
+        public:
+          explicit Or (std::vector<NodePtr>&& aoperands): operands(std::move (aoperands)) {};
+        protected:
+          ObjectId find (ObjectId target)
+          {
+            ObjectId first = END;
+            for (NodePtr& n : operands)
+              first = std::min (first, n->seek (target));
+            return first;
+          }
+        private:
+          std::vector<NodePtr> operands;
+      };
+
+      // Keys holding term: candidates from the gram lists, checked against the key.
+      template <class Index, class Key>
+      class Term: public Node
+      {
+        public:
+          typedef std::basic_string_view<typename Key::value_type> View;
+
+          Term (const Index& aindex, const Key& aterm, NodePtr&& agrams): index(aindex), term(aterm), grams(std::move (agrams)) {};
+        protected:
+          ObjectId find (ObjectId target)
+          {
+            for (ObjectId id = grams->seek (target); id != END; id = grams->seek (id + 1))
+              if (View (index.key (id)).find (term) != View::npos)
+                return id;
+            return END;
+          }
+        private:
+          const Index& index;
+          Key term; // Normalized.
+          NodePtr grams;
+      };
+
+      template <class Index, class Key>
+      NodePtr compile_term (const Index& index, const Key& term)
+      {
+        typedef std::basic_string_view<typename Key::value_type> View;
+        typedef std::pair<const ObjectId*, size_t> List;
+        if (term.empty ())
+          return NodePtr (new Empty ());
+        const size_t n = std::min (index.get_gram_size (), term.size ());
+        std::vector<List> lists;
+        for (size_t i = 0; i + n <= term.size (); ++i)
+        {
+            size_t count = 0;
+            const ObjectId* p = index.find_postings (View (term).substr (i, n), count);
+            if (!p)
+              return NodePtr (new Empty ());
+            lists.push_back (List (p, count));
+        }
+        // Shortest list first, it leads the leapfrog.
+        std::sort (lists.begin (), lists.end (), [] (const List& a, const List& b)
+        {
+            return (a.second != b.second) ? a.second < b.second : std::less<const ObjectId*> () (a.first, b.first);
+        });
+        lists.erase (std::unique (lists.begin (), lists.end ()), lists.end ());
+        std::vector<NodePtr> grams;
+        for (const List& l : lists)
+          grams.push_back (NodePtr (new Postings (l.first, l.second)));
+        NodePtr all_grams = (grams.size () == 1) ? std::move (grams[0]) : NodePtr (new And (std::move (grams), std::vector<NodePtr> ()));
+        return NodePtr (new Term<Index, Key> (index, term, std::move (all_grams)));
+      }
 
+      /// Cursor over the ids of index matching q, terms normalized by normalize.
+      template <class Index, class Key, class Normalizer>
+      NodePtr compile (const Index& index, const BasicQuery<Key>& q, const Normalizer& normalize)
+      {
+        typedef BasicQuery<Key> Query;
+        switch (q.get_kind ())
+        {
+          case Query::TERM:
+            return compile_term (index, normalize (q.get_term ()));
+          case Query::OR:
+          {
+            std::vector<NodePtr> operands;
+            for (const Query& operand : q.get_operands ())
+              operands.push_back (compile (index, operand, normalize));
+            return NodePtr (new Or (std::move (operands)));
+          }
+          case Query::AND:
+          case Query::NOT:
+          {
+            // NOT q is every id but the matches of q: an AND of all ids with q negative.
+            std::vector<NodePtr> positive, negative;
+            if (q.get_kind () == Query::NOT)
+              negative.push_back (compile (index, q.get_operands ()[0], normalize));
+            else
+              for (const Query& operand : q.get_operands ())
+                if (operand.get_kind () == Query::NOT)
+                  negative.push_back (compile (index, operand.get_operands ()[0], normalize));
+                else
+                  positive.push_back (compile (index, operand, normalize));
+            if (positive.empty ())
+              positive.push_back (NodePtr (new All (index.size ())));
+            return NodePtr (new And (std::move (positive), std::move (negative)));
+          }
+        }
+        return NodePtr (new Empty ());
+      }
+    }
+
+    /// Substring index: contains (s) finds the objects whose key has a substring equal to s once both are normalized
+    /// by Normalizer.
+    ///
+    /// Keys are normalized once, by add, and stored that way; a query is normalized once by contains. Every gram
+    /// (substring) of 1 to gram_size characters of a normalized key maps, by hash, to the sorted list of the keys
+    /// holding it. A query intersects the lists of its grams, longest possible ones, then searches each candidate
+    /// key, so hash collisions never show in the result. Memory grows linearly with the key length, about gram_size
+    /// ids per character.
+    ///
+    /// query (q) evaluates a boolean Query of such substrings with the cursors above. Matches stream through Results
+    /// in add order, nothing is collected, so reading only the first matches costs only what finding them does.
+    ///
+    /// \code {.cpp}
+    ///  typedef ODB<Person> DB;
+    ///  for (Person* p : db.query (DB::Query ("silva") && "paulo" && !DB::Query ("maria")))
+    ///    show (p);
+    /// \endcode
+    template <class T, class Key = std::string, class Normalizer = case_insensitive_no_accents_normalizer<Key>, class Alloc = std::allocator<std::pair<const Key, T>>>
+    class ODB
+    {
+      public:
+        typedef odb::ObjectId ObjectId;
+        typedef BasicQuery<Key> Query;
         typedef std::unordered_set<T*> ResultSet;
+        typedef std::basic_string_view<typename Key::value_type> View;
 
-        void add (const Key& key, T* obj)
+        static const size_t DEFAULT_GRAM_SIZE = 3;
+        static constexpr ObjectId END = cursor::END;
+
+        /// Matches of a query, in add order. Reads the index as it goes: an add or a remove invalidates it.
+        class Results
         {
-            Key k = key;
-            typename Key::const_iterator i0 = key.begin ();
-            while (i0 != key.end ())
+          public:
+            class iterator
             {
-                typename Key::const_iterator i = i0;
-                typename Key::const_iterator j = key.end ();
-                while (i != j)
+              public:
+                typedef std::input_iterator_tag iterator_category;
+                typedef T* value_type;
+                typedef std::ptrdiff_t difference_type;
+                typedef T* const* pointer;
+                typedef T* reference;
+
+                iterator (): results(nullptr), current(END) {};
+                T* operator* () const {return results->db->entries[current].obj;}
+                ObjectId id () const {return current;}
+                iterator& operator++ ()
                 {
-                    std::pair<const Key, T*> p(k, obj);
-                    //std::cout << p.first << " " << *p.second << std::endl;
-                    omap.insert (p);
-                    k.clear();
-                    std::back_insert_iterator< Key > it (k);
-                    std::copy (i, j--, it);
+                  current = (current == END - 1) ? END : results->next (current + 1);
+                  return *this;
                 }
-                ++i0;
+                void operator++ (int) {++*this;}
+                bool operator== (const iterator& other) const {return current == other.current;}
+                bool operator!= (const iterator& other) const {return current != other.current;}
+
+              private:
+                friend class Results;
+                Results* results;
+                ObjectId current;
+
+                iterator (Results* aresults, ObjectId acurrent): results(aresults), current(acurrent) {};
+            };
+
+            iterator begin () {return iterator (this, next (0));}
+            iterator end () {return iterator (this, END);}
+
+          private:
+            friend class ODB;
+            const ODB* db;
+            cursor::NodePtr root;
+
+            Results (const ODB* adb, cursor::NodePtr&& aroot): db(adb), root(std::move (aroot)) {};
+
+            // Skips removed entries.
+            ObjectId next (ObjectId target)
+            {
+              ObjectId id = root->seek (target);
+              while (id != END && !db->entries[id].obj)
+                id = (id == END - 1) ? END : root->seek (id + 1);
+              return id;
             }
-            //std::cout << "--------------------------------" << std::endl;
+        };
+
+      private:
+        typedef typename std::allocator_traits<Alloc>::template rebind_alloc<ObjectId> IdAlloc;
+        typedef std::vector<ObjectId, IdAlloc> Postings;
+
+        struct Entry
+        {
+          Key key; // Normalized.
+          T* obj;
+        };
+
+        std::vector<Entry> entries;
+        std::unordered_map<size_t, Postings> postings; // By gram hash.
+        size_t removed = 0; // Entries with a null obj.
+        size_t gram_size;
+        Normalizer normalize;
+        std::hash<View> hash;
+
+      public:
+        explicit ODB (size_t agram_size = DEFAULT_GRAM_SIZE): gram_size(std::max<size_t> (agram_size, 1)) {};
+
+        void add (const Key& key, T* obj)
+        {
+            const ObjectId id = static_cast<ObjectId> (entries.size ());
+            entries.push_back (Entry {normalize (key), obj});
+            const View normalized = entries.back ().key;
+            for (size_t n = 1; n <= gram_size; ++n)
+              for (size_t i = 0; i + n <= normalized.size (); ++i)
+              {
+                  Postings& p = postings[hash (normalized.substr (i, n))];
+                  if (p.empty () || p.back () != id) // Ids grow, so the lists stay sorted.
+                    p.push_back (id);
+              }
         }
 
-        bool contains (const Key& key, ResultSet& result_set, bool clear_result_set = true)
+        /// Streams the objects whose key matches q.
+        Results query (const Query& q) const {return Results (this, cursor::compile (*this, q, normalize));}
+
+        bool contains (const Key& key, ResultSet& result_set, bool clear_result_set = true) const
         {
             if (clear_result_set)
               result_set.clear ();
-            auto range = omap.equal_range (key);
-            bool found = (range.first != range.second);
-            while (range.first != range.second)
+            bool found = false;
+            for (T* obj : query (key))
             {
-                T* obj = range.first->second;
-                result_set.insert (obj);
-                ++ range.first;
+              result_set.insert (obj);
+              found = true;
             }
             return found;
         }
+
+        /// Removes obj under key, if it was added with it. Its ids stay in the posting lists, queries skip them,
+        /// until removed entries are more than half of them: then the index is compacted, which renumbers the ids.
+        bool remove (const Key& key, T* obj)
+        {
+            const Key normalized = normalize (key);
+            bool found = false;
+            cursor::NodePtr ids = cursor::compile_term (*this, normalized);
+            for (ObjectId id = ids->seek (0); id != END; id = ids->seek (id + 1))
+              if (entries[id].obj == obj && entries[id].key == normalized)
+              {
+                entries[id].obj = nullptr;
+                ++removed;
+                found = true;
+              }
+            if (2 * removed > entries.size ())
+              compact ();
+            return found;
+        }
+
+        /// Drops the removed entries and their ids from the posting lists. The other entries keep their order but
+        /// are renumbered. O(posting_count ()); remove calls it often enough to keep the cost per remove constant.
+        void compact ()
+        {
+            std::vector<ObjectId> renumbered (entries.size (), END);
+            ObjectId live = 0;
+            for (size_t id = 0; id < entries.size (); ++id)
+              if (entries[id].obj)
+              {
+                if (live != id)
+                  entries[live] = std::move (entries[id]);
+                renumbered[id] = live++;
+              }
+            entries.erase (entries.begin () + live, entries.end ());
+            for (auto it = postings.begin (); it != postings.end (); )
+            {
+              Postings& p = it->second;
+              size_t kept = 0;
+              for (ObjectId id : p)
+                if (renumbered[id] != END)
+                  p[kept++] = renumbered[id];
+              p.resize (kept);
+              it = p.empty () ? postings.erase (it) : std::next (it);
+            }
+            removed = 0;
+        }
+
+        /// Number of keys added, removed ones not compacted yet included.
+        ObjectId size () const { return static_cast<ObjectId> (entries.size ()); }
+
+        /// Removed entries still in the index.
+        size_t removed_count () const { return removed; }
+
+        size_t get_gram_size () const { return gram_size; }
+
+        /// Normalized key and object of id, nullptr if removed.
+        const Key& key (ObjectId id) const { return entries[id].key; }
+        T* object (ObjectId id) const { return entries[id].obj; }
+
+        /// Sorted ids of the keys holding gram, nullptr if none.
+        const ObjectId* find_postings (View gram, size_t& count) const
+        {
+          auto it = postings.find (hash (gram));
+          if (it == postings.end ())
+            return nullptr;
+          count = it->second.size ();
+          return it->second.data ();
+        }
+
+        /// Number of ids in all posting lists, the bulk of the index memory.
+        size_t posting_count () const
+        {
+            size_t count = 0;
+            for (const auto& p : postings)
+              count += p.second.size ();
+            return count;
+        }
     };
   }
 }
@@ -0,0 +1,620 @@
+#ifndef ODB_SNAPSHOT_HPP_INCLUDED
+#define ODB_SNAPSHOT_HPP_INCLUDED
+
+#include "odb.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(_WIN32) || defined(_WIN64)
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace pensar_digital
+{
+  namespace odb
+  {
+    typedef uint64_t RecordId; // The caller's id of an object, kept in the object-id table of a snapshot.
+
+    struct SnapshotHeader
+    {
+      uint64_t magic;
+      uint32_t version;
+      uint32_t char_size;
+      uint64_t gram_size;
+      uint64_t entry_count;
+      uint64_t gram_count;
+      uint64_t posting_count;
+      uint64_t key_char_count;
+    };
+
+    struct SnapshotGram
+    {
+      uint64_t hash;
+      uint64_t first; // Index of its first id in postings.
+      uint64_t count;
+    };
+
+    /// Immutable index on disk, queried in place through a read only mapping: opening one costs a mmap, not a load.
+    /// It answers queries like the ODB it was written from and maps ids to the RecordId given for each key.
+    ///
+    /// Layout, integers in native byte order, every section 8-byte aligned:
+    ///   SnapshotHeader
+    ///   grams        gram_count SnapshotGram, sorted by hash (FNV-1a of the gram bytes)
+    ///   postings     posting_count ObjectId, the sorted ids of each gram one after the other
+    ///   key_offsets  entry_count + 1 uint64_t, where each key starts in key_chars
+    ///   record_ids   entry_count RecordId
+    ///   key_chars    key_char_count characters, the normalized keys
+    template <class Key = std::string>
+    class Snapshot
+    {
+      public:
+        typedef typename Key::value_type Char;
+        typedef std::basic_string_view<Char> View;
+        typedef std::vector<std::pair<Key, RecordId>> Entries; // Normalized keys.
+
+        static constexpr uint64_t MAGIC = 0x50414E5342444F50ull; // "PODBSNAP"
+        static constexpr uint32_t VERSION = 1;
+
+        explicit Snapshot (const std::filesystem::path& apath): path(apath)
+        {
+          map ();
+          if (length >= sizeof (SnapshotHeader))
+            std::memcpy (&header, base, sizeof (SnapshotHeader));
+          if (header.magic != MAGIC || header.version != VERSION || header.char_size != sizeof (Char))
+          {
+            unmap ();
+            throw std::runtime_error ("ODB snapshot: not a snapshot of this key type: " + path.string ());
+          }
+          size_t offset = sizeof (SnapshotHeader);
+          grams = section<SnapshotGram> (offset, header.gram_count);
+          postings = section<ObjectId> (offset, header.posting_count);
+          key_offsets = section<uint64_t> (offset, header.entry_count + 1);
+          record_ids = section<RecordId> (offset, header.entry_count);
+          key_chars = section<Char> (offset, header.key_char_count);
+          if (offset > length || key_offsets[header.entry_count] > header.key_char_count)
+          {
+            unmap ();
+            throw std::runtime_error ("ODB snapshot: truncated file: " + path.string ());
+          }
+          if (!valid ())
+          {
+            unmap ();
+            throw std::runtime_error ("ODB snapshot: corrupt file: " + path.string ());
+          }
+        }
+
+        Snapshot (const Snapshot&) = delete;
+        Snapshot& operator= (const Snapshot&) = delete;
+
+        ~Snapshot () { unmap (); }
+
+        /// Writes a snapshot of entries to path. It goes to a temporary file, synced, then renamed to path, so path
+        /// either does not exist or holds the whole snapshot.
+        static void write (const std::filesystem::path& path, size_t gram_size, const Entries& entries)
+        {
+          gram_size = std::max<size_t> (gram_size, 1);
+          std::unordered_map<uint64_t, std::vector<ObjectId>> lists;
+          uint64_t key_char_count = 0;
+          for (size_t id = 0; id < entries.size (); ++id)
+          {
+            const View key = entries[id].first;
+            key_char_count += key.size ();
+            for (size_t n = 1; n <= gram_size; ++n)
+              for (size_t i = 0; i + n <= key.size (); ++i)
+              {
+                std::vector<ObjectId>& p = lists[hash (key.substr (i, n))];
+                if (p.empty () || p.back () != id)
+                  p.push_back (static_cast<ObjectId> (id));
+              }
+          }
+          std::vector<uint64_t> hashes;
+          hashes.reserve (lists.size ());
+          for (const auto& l : lists)
+            hashes.push_back (l.first);
+          std::sort (hashes.begin (), hashes.end ());
+
+          SnapshotHeader h = {MAGIC, VERSION, sizeof (Char), gram_size, entries.size (), hashes.size (), 0, key_char_count};
+          std::vector<SnapshotGram> table;
+          table.reserve (hashes.size ());
+          for (uint64_t g : hashes)
+          {
+            table.push_back (SnapshotGram {g, h.posting_count, lists[g].size ()});
+            h.posting_count += lists[g].size ();
+          }
+
+          const std::filesystem::path tmp = path.string () + ".tmp";
+          {
+            std::ofstream out (tmp, std::ios::binary | std::ios::trunc);
+            out.write (reinterpret_cast<const char*> (&h), sizeof (h));
+            put (out, table.data (), table.size ());
+            for (uint64_t g : hashes)
+              out.write (reinterpret_cast<const char*> (lists[g].data ()), lists[g].size () * sizeof (ObjectId));
+            pad (out, h.posting_count * sizeof (ObjectId));
+            std::vector<uint64_t> offsets (1, 0);
+            for (const auto& e : entries)
+              offsets.push_back (offsets.back () + e.first.size ());
+            put (out, offsets.data (), offsets.size ());
+            for (const auto& e : entries)
+              out.write (reinterpret_cast<const char*> (&e.second), sizeof (RecordId));
+            for (const auto& e : entries)
+              out.write (reinterpret_cast<const char*> (e.first.data ()), e.first.size () * sizeof (Char));
+            pad (out, key_char_count * sizeof (Char));
+            out.close ();
+            if (!out)
+              throw std::runtime_error ("ODB snapshot: cannot write " + tmp.string ());
+          }
+          sync (tmp, false);
+          std::filesystem::rename (tmp, path);
+          sync (path.parent_path (), true);
+        }
+
+        /// Number of keys.
+        ObjectId size () const { return static_cast<ObjectId> (header.entry_count); }
+
+        size_t get_gram_size () const { return static_cast<size_t> (header.gram_size); }
+
+        /// Normalized key of id.
+        View key (ObjectId id) const { return View (key_chars + key_offsets[id], key_offsets[id + 1] - key_offsets[id]); }
+
+        RecordId record_id (ObjectId id) const { return record_ids[id]; }
+
+        /// Sorted ids of the keys holding gram, nullptr if none.
+        const ObjectId* find_postings (View gram, size_t& count) const
+        {
+          const uint64_t h = hash (gram);
+          const SnapshotGram* end = grams + header.gram_count;
+          const SnapshotGram* g = std::lower_bound (grams, end, h, [] (const SnapshotGram& a, uint64_t b) {return a.hash < b;});
+          if (g == end || g->hash != h)
+            return nullptr;
+          count = static_cast<size_t> (g->count);
+          return postings + g->first;
+        }
+
+        size_t posting_count () const { return static_cast<size_t> (header.posting_count); }
+
+        const std::filesystem::path& get_path () const { return path; }
+
+        /// Copies of the entries, in id order.
+        Entries entries () const
+        {
+          Entries result;
+          result.reserve (size ());
+          for (ObjectId id = 0; id < size (); ++id)
+            result.push_back (std::make_pair (Key (key (id)), record_id (id)));
+          return result;
+        }
+
+      private:
+        std::filesystem::path path;
+        const char* base = nullptr;
+        size_t length = 0;
+        SnapshotHeader header = {};
+        const SnapshotGram* grams = nullptr;
+        const ObjectId* postings = nullptr;
+        const uint64_t* key_offsets = nullptr;
+        const RecordId* record_ids = nullptr;
+        const Char* key_chars = nullptr;
+        #if defined(_WIN32) || defined(_WIN64)
+          HANDLE file = INVALID_HANDLE_VALUE;
+          HANDLE mapping = NULL;
+        #endif
+
+        // FNV-1a, stable across processes and compilers, unlike std::hash.
+        static uint64_t hash (View gram)
+        {
+          const unsigned char* p = reinterpret_cast<const unsigned char*> (gram.data ());
+          uint64_t h = 14695981039346656037ull;
+          for (size_t i = 0; i < gram.size () * sizeof (Char); ++i)
+            h = (h ^ p[i]) * 1099511628211ull;
+          return h;
+        }
+
+        static void pad (std::ofstream& out, uint64_t written)
+        {
+          static const char zeros[8] = {};
+          out.write (zeros, (8 - written % 8) % 8);
+        }
+
+        template <class U>
+        static void put (std::ofstream& out, const U* data, size_t count)
+        {
+          out.write (reinterpret_cast<const char*> (data), count * sizeof (U));
+          pad (out, count * sizeof (U));
+        }
+
+        // Next section of count U at offset, which moves past it, padding included.
+        template <class U>
+        const U* section (size_t& offset, uint64_t count) const
+        {
+          const U* p = reinterpret_cast<const U*> (base + offset);
+          const uint64_t bytes = count * sizeof (U);
+          offset = (count > length || bytes > length) ? length + 1 : offset + static_cast<size_t> ((bytes + 7) / 8 * 8);
+          return p;
+        }
+
+        // Checks once, in O(size), what queries rely on without checking: the gram table is sorted and points inside
+        // postings, each posting list is sorted and holds valid ids, and keys lie inside key_chars.
+        bool valid () const
+        {
+          if (header.entry_count > std::numeric_limits<ObjectId>::max ())
+            return false;
+          for (uint64_t g = 0; g < header.gram_count; ++g)
+          {
+            if ((g > 0 && grams[g - 1].hash >= grams[g].hash) || grams[g].count == 0 ||
+                grams[g].first > header.posting_count || grams[g].count > header.posting_count - grams[g].first)
+              return false;
+            const ObjectId* p = postings + grams[g].first;
+            for (uint64_t i = 0; i < grams[g].count; ++i)
+              if (p[i] >= header.entry_count || (i > 0 && p[i - 1] >= p[i]))
+                return false;
+          }
+          for (uint64_t id = 0; id < header.entry_count; ++id)
+            if (key_offsets[id] > key_offsets[id + 1])
+              return false;
+          return true;
+        }
+
+        // Waits until the file, or the directory entries, reach the disk.
+        static void sync (const std::filesystem::path& p, bool directory)
+        {
+          #if defined(_WIN32) || defined(_WIN64)
+            if (directory)
+              return; // MoveFileEx is enough on NTFS.
+            HANDLE h = CreateFileW (p.wstring ().c_str (), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (h != INVALID_HANDLE_VALUE)
+            {
+              FlushFileBuffers (h);
+              CloseHandle (h);
+            }
+          #else
+            const int fd = ::open ((directory && p.empty ()) ? "." : p.string ().c_str (), directory ? O_RDONLY : O_WRONLY);
+            if (fd != -1)
+            {
+              ::fsync (fd);
+              ::close (fd);
+            }
+          #endif
+        }
+
+        void map ()
+        {
+          #if defined(_WIN32) || defined(_WIN64)
+            // FILE_SHARE_DELETE lets a newer generation remove this file while it is still mapped.
+            file = CreateFileW (path.wstring ().c_str (), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            LARGE_INTEGER file_size = {};
+            if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx (file, &file_size) || file_size.QuadPart == 0)
+            {
+              unmap ();
+              throw std::runtime_error ("ODB snapshot: cannot open " + path.string ());
+            }
+            length = static_cast<size_t> (file_size.QuadPart);
+            mapping = CreateFileMappingW (file, NULL, PAGE_READONLY, 0, 0, NULL);
+            base = mapping ? static_cast<const char*> (MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+            if (!base)
+            {
+              unmap ();
+              throw std::runtime_error ("ODB snapshot: cannot map " + path.string ());
+            }
+          #else
+            const int fd = ::open (path.string ().c_str (), O_RDONLY);
+            struct stat st = {};
+            if (fd == -1 || ::fstat (fd, &st) != 0 || st.st_size == 0)
+            {
+              if (fd != -1)
+                ::close (fd);
+              throw std::runtime_error ("ODB snapshot: cannot open " + path.string ());
+            }
+            length = static_cast<size_t> (st.st_size);
+            void* p = ::mmap (nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            ::close (fd);
+            if (p == MAP_FAILED)
+              throw std::runtime_error ("ODB snapshot: cannot map " + path.string ());
+            base = static_cast<const char*> (p);
+          #endif
+        }
+
+        void unmap ()
+        {
+          #if defined(_WIN32) || defined(_WIN64)
+            if (base)
+              UnmapViewOfFile (base);
+            if (mapping)
+              CloseHandle (mapping);
+            if (file != INVALID_HANDLE_VALUE)
+              CloseHandle (file);
+            mapping = NULL;
+            file = INVALID_HANDLE_VALUE;
+          #else
+            if (base)
+              ::munmap (const_cast<char*> (base), length);
+          #endif
+          base = nullptr;
+        }
+    };
+
+    /// ODB that starts instantly: a Snapshot on disk holds the keys, an in-memory delta the keys added since. merge
+    /// writes both into a new snapshot, in the background with merge_async, and swaps it in; adds and queries go on
+    /// meanwhile.
+    ///
+    /// Snapshots are generations: path.1, path.2... The newest one that opens is used, older ones are removed after a
+    /// swap. Keys of the delta live only in memory until merged. The Normalizer must be idempotent, a swap adds the
+    /// keys the merge did not take again, normalized. As ODB, not thread safe: one thread adds, queries and merges;
+    /// the merge thread only reads copies and the immutable snapshot.
+    ///
+    /// \code {.cpp}
+    ///  PersistentODB<> db ("names.odb");
+    ///  db.add ("Maria da Silva", 42);
+    ///  db.merge_async ();
+    ///  for (RecordId id : db.query (PersistentODB<>::Query ("silva") && !PersistentODB<>::Query ("maria")))
+    ///    show (id);
+    /// \endcode
+    template <class Key = std::string, class Normalizer = case_insensitive_no_accents_normalizer<Key>>
+    class PersistentODB
+    {
+      public:
+        typedef BasicQuery<Key> Query;
+        typedef odb::Snapshot<Key> Snapshot;
+        typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+
+        static const size_t DEFAULT_GRAM_SIZE = 3;
+
+      private:
+        struct Delta
+        {
+          ODB<const RecordId, Key, Normalizer> index;
+          std::deque<RecordId> record_ids; // Stable, index points to them.
+
+          explicit Delta (size_t gram_size): index(gram_size) {};
+        };
+        typedef std::shared_ptr<Delta> DeltaPtr;
+
+      public:
+        /// Matches of a query: snapshot ones then delta ones, each in add order. Keeps the snapshot it reads mapped,
+        /// but reads the delta as it goes: an add invalidates it.
+        class Results
+        {
+          public:
+            class iterator
+            {
+              public:
+                typedef std::input_iterator_tag iterator_category;
+                typedef RecordId value_type;
+                typedef std::ptrdiff_t difference_type;
+                typedef const RecordId* pointer;
+                typedef RecordId reference;
+
+                iterator (): results(nullptr), current(cursor::END) {};
+                RecordId operator* () const {return results->record_id (current);}
+                ObjectId id () const {return current;}
+                iterator& operator++ ()
+                {
+                  current = (current == cursor::END - 1) ? cursor::END : results->next (current + 1);
+                  return *this;
+                }
+                void operator++ (int) {++*this;}
+                bool operator== (const iterator& other) const {return current == other.current;}
+                bool operator!= (const iterator& other) const {return current != other.current;}
+
+              private:
+                friend class Results;
+                Results* results;
+                ObjectId current;
+
+                iterator (Results* aresults, ObjectId acurrent): results(aresults), current(acurrent) {};
+            };
+
+            iterator begin () {return iterator (this, next (0));}
+            iterator end () {return iterator (this, cursor::END);}
+
+          private:
+            friend class PersistentODB;
+            SnapshotPtr snapshot;
+            DeltaPtr delta;
+            cursor::NodePtr snapshot_root;
+            cursor::NodePtr delta_root;
+
+            Results (const SnapshotPtr& asnapshot, const DeltaPtr& adelta, const Query& q, const Normalizer& normalize)
+              : snapshot(asnapshot), delta(adelta), snapshot_root(cursor::compile (*snapshot, q, normalize)),
+                delta_root(cursor::compile (delta->index, q, normalize)) {};
+
+            // Ids below the snapshot size are its own, the delta ones follow.
+            ObjectId next (ObjectId target)
+            {
+              const ObjectId base = snapshot->size ();
+              if (target < base)
+              {
+                const ObjectId id = snapshot_root->seek (target);
+                if (id != cursor::END)
+                  return id;
+                target = base;
+              }
+              const ObjectId id = delta_root->seek (target - base);
+              return (id == cursor::END) ? cursor::END : base + id;
+            }
+
+            RecordId record_id (ObjectId id) const
+            {
+              const ObjectId base = snapshot->size ();
+              return (id < base) ? snapshot->record_id (id) : delta->record_ids[id - base];
+            }
+        };
+
+        /// Opens the newest snapshot generation of path, or writes an empty one if there is none.
+        explicit PersistentODB (const std::filesystem::path& apath, size_t agram_size = DEFAULT_GRAM_SIZE)
+          : path(apath), gram_size(std::max<size_t> (agram_size, 1))
+        {
+          std::vector<uint64_t> found = generations ();
+          for (auto g = found.rbegin (); g != found.rend () && !snapshot; ++g)
+            try
+            {
+              snapshot = std::make_shared<const Snapshot> (generation_path (*g));
+              generation = *g;
+            }
+            catch (const std::runtime_error&)
+            {
+              // Not a valid snapshot, an older generation may be.
+            }
+          if (!snapshot)
+          {
+            generation = found.empty () ? 1 : found.back () + 1;
+            Snapshot::write (generation_path (generation), gram_size, typename Snapshot::Entries ());
+            snapshot = std::make_shared<const Snapshot> (generation_path (generation));
+          }
+          delta = std::make_shared<Delta> (gram_size);
+          remove_older_generations ();
+        }
+
+        PersistentODB (const PersistentODB&) = delete;
+        PersistentODB& operator= (const PersistentODB&) = delete;
+
+        ~PersistentODB ()
+        {
+          if (merging.valid ())
+            merging.wait ();
+        }
+
+        void add (const Key& key, RecordId id)
+        {
+          install ();
+          delta->record_ids.push_back (id);
+          delta->index.add (key, &delta->record_ids.back ());
+        }
+
+        /// Streams the RecordIds whose key matches q.
+        Results query (const Query& q)
+        {
+          install ();
+          return Results (snapshot, delta, q, normalize);
+        }
+
+        /// Starts writing the snapshot and the delta so far into a new generation, unless a merge is running. add and
+        /// query swap it in once written.
+        void merge_async ()
+        {
+          install ();
+          if (merging.valid () || delta->index.size () == 0)
+            return;
+          // The merge thread gets a copy of the delta, which keeps changing.
+          typename Snapshot::Entries added;
+          added.reserve (delta->index.size ());
+          for (ObjectId id = 0; id < delta->index.size (); ++id)
+            added.push_back (std::make_pair (delta->index.key (id), delta->record_ids[id]));
+          merged_count = added.size ();
+          const std::filesystem::path next = generation_path (generation + 1);
+          merging = std::async (std::launch::async, [base = snapshot, added = std::move (added), next, gram_size = gram_size] ()
+          {
+            typename Snapshot::Entries entries = base->entries ();
+            entries.insert (entries.end (), added.begin (), added.end ());
+            Snapshot::write (next, gram_size, entries);
+            return std::make_shared<const Snapshot> (next);
+          });
+        }
+
+        /// Merges the delta into a new snapshot and waits for it.
+        void merge ()
+        {
+          merge_async ();
+          wait_merge ();
+        }
+
+        /// Waits for a running merge and swaps its snapshot in. Rethrows its error, if any.
+        void wait_merge ()
+        {
+          if (merging.valid ())
+            merging.wait ();
+          install ();
+        }
+
+        bool is_merging () const { return merging.valid (); }
+
+        /// Number of keys, snapshot and delta.
+        size_t size () const { return snapshot->size () + delta->index.size (); }
+
+        size_t delta_size () const { return delta->index.size (); }
+
+        const Snapshot& get_snapshot () const { return *snapshot; }
+
+        uint64_t get_generation () const { return generation; }
+
+        std::filesystem::path generation_path (uint64_t g) const { return path.string () + "." + std::to_string (g); }
+
+      private:
+        std::filesystem::path path;
+        size_t gram_size;
+        Normalizer normalize;
+        SnapshotPtr snapshot;
+        DeltaPtr delta;
+        uint64_t generation = 0;
+        std::future<SnapshotPtr> merging;
+        size_t merged_count = 0; // Delta keys the running merge took.
+
+        // Swaps in the snapshot of a finished merge, with a new delta of the keys added since it started.
+        void install ()
+        {
+          if (!merging.valid () || merging.wait_for (std::chrono::seconds (0)) != std::future_status::ready)
+            return;
+          SnapshotPtr merged = merging.get ();
+          DeltaPtr rest = std::make_shared<Delta> (gram_size);
+          for (ObjectId id = static_cast<ObjectId> (merged_count); id < delta->index.size (); ++id)
+          {
+            rest->record_ids.push_back (delta->record_ids[id]);
+            rest->index.add (delta->index.key (id), &rest->record_ids.back ());
+          }
+          snapshot = merged;
+          delta = rest;
+          ++generation;
+          remove_older_generations ();
+        }
+
+        // Generations of path on disk, ascending.
+        std::vector<uint64_t> generations () const
+        {
+          std::vector<uint64_t> result;
+          const std::filesystem::path dir = path.parent_path ().empty () ? std::filesystem::path (".") : path.parent_path ();
+          const std::string prefix = path.filename ().string () + ".";
+          std::error_code ec;
+          for (const auto& f : std::filesystem::directory_iterator (dir, ec))
+          {
+            const std::string name = f.path ().filename ().string ();
+            if (name.size () > prefix.size () && name.compare (0, prefix.size (), prefix) == 0 &&
+                name.find_first_not_of ("0123456789", prefix.size ()) == std::string::npos)
+              result.push_back (std::stoull (name.substr (prefix.size ())));
+          }
+          std::sort (result.begin (), result.end ());
+          return result;
+        }
+
+        // Best effort: a generation still mapped elsewhere may not go away yet.
+        void remove_older_generations () const
+        {
+          for (uint64_t g : generations ())
+            if (g < generation)
+            {
+              std::error_code ec;
+              std::filesystem::remove (generation_path (g), ec);
+            }
+        }
+    };
+  }
+}
+
+#endif // ODB_SNAPSHOT_HPP_INCLUDED
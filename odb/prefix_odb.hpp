@@ -0,0 +1,191 @@
+#ifndef PREFIX_ODB_HPP_INCLUDED
+#define PREFIX_ODB_HPP_INCLUDED
+
+#include "odb.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+
+namespace pensar_digital
+{
+  namespace odb
+  {
+    /// Prefix index for type-ahead: complete (p, k) returns the k best scored objects whose normalized key starts with
+    /// p. Unlike ODB it holds no infix positions.
+    ///
+    /// Keys are normalized once and stored in a compressed trie: each edge holds the characters its node adds, and
+    /// a node has one child per distinct next character. Every node keeps the ids of the max_k best keys below it,
+    /// ordered by the score given to add (higher first, earlier added on ties), updated as keys are added. A keystroke
+    /// therefore costs a walk down the prefix plus copying k ids: O(prefix length + k). k above max_k walks the whole
+    /// subtree instead.
+    ///
+    /// \code {.cpp}
+    ///  PrefixODB<City> cities;
+    ///  cities.add ("São Paulo", &sao_paulo, sao_paulo.population ());
+    ///  std::vector<City*> completions;
+    ///  cities.complete ("sao p", 5, completions);
+    /// \endcode
+    template <class T, class Key = std::string, class Normalizer = case_insensitive_no_accents_normalizer<Key>, class Score = double>
+    class PrefixODB
+    {
+      public:
+        typedef odb::ObjectId ObjectId;
+        typedef std::basic_string_view<typename Key::value_type> View;
+
+        static const size_t DEFAULT_MAX_K = 10;
+
+        explicit PrefixODB (size_t amax_k = DEFAULT_MAX_K): max_k(std::max<size_t> (amax_k, 1)), root(new Node ()), nodes(1) {};
+
+        void add (const Key& key, T* obj, Score score)
+        {
+            const ObjectId id = static_cast<ObjectId> (entries.size ());
+            entries.push_back (Entry {normalize (key), obj, score});
+            const View k = entries.back ().key;
+            Node* node = root.get ();
+            offer (*node, id);
+            for (size_t pos = 0; pos < k.size (); )
+            {
+                auto it = child (*node, k[pos]);
+                if (it == node->children.end () || (*it)->label[0] != k[pos])
+                {
+                  std::unique_ptr<Node> leaf (new Node ());
+                  leaf->label = Key (k.substr (pos));
+                  offer (*leaf, id);
+                  Node* added = leaf.get ();
+                  node->children.insert (it, std::move (leaf));
+                  node = added;
+                  ++nodes;
+                  break;
+                }
+                const size_t common = common_length ((*it)->label, k.substr (pos));
+                if (common < (*it)->label.size ())
+                {
+                  // Splits the edge where the key leaves it; the upper part has the same keys below it.
+                  std::unique_ptr<Node> upper (new Node ());
+                  upper->label = (*it)->label.substr (0, common);
+                  upper->top = (*it)->top;
+                  (*it)->label.erase (0, common);
+                  upper->children.push_back (std::move (*it));
+                  *it = std::move (upper);
+                  ++nodes;
+                }
+                node = it->get ();
+                offer (*node, id);
+                pos += common;
+            }
+            node->ends.push_back (id);
+        }
+
+        /// The min (k, matches) best scored objects whose key starts with prefix, best first. Returns their number.
+        size_t complete (const Key& prefix, size_t k, std::vector<T*>& result) const
+        {
+            result.clear ();
+            const Node* node = find (normalize (prefix));
+            if (!node)
+              return 0;
+            if (k <= max_k)
+            {
+              for (size_t i = 0; i < std::min (k, node->top.size ()); ++i)
+                result.push_back (entries[node->top[i]].obj);
+              return result.size ();
+            }
+            std::vector<ObjectId> ids;
+            collect (*node, ids);
+            k = std::min (k, ids.size ());
+            std::partial_sort (ids.begin (), ids.begin () + k, ids.end (), [this] (ObjectId a, ObjectId b) {return better (a, b);});
+            for (size_t i = 0; i < k; ++i)
+              result.push_back (entries[ids[i]].obj);
+            return result.size ();
+        }
+
+        /// Number of keys added.
+        size_t size () const { return entries.size (); }
+
+        size_t node_count () const { return nodes; }
+
+        size_t get_max_k () const { return max_k; }
+
+      private:
+        struct Entry
+        {
+          Key key; // Normalized.
+          T* obj;
+          Score score;
+        };
+
+        struct Node
+        {
+          Key label; // Characters this node adds to its parent's, empty for the root only.
+          std::vector<std::unique_ptr<Node>> children; // By first label character.
+          std::vector<ObjectId> top; // Best max_k ids below, best first.
+          std::vector<ObjectId> ends; // Ids of the keys ending here.
+        };
+
+        std::vector<Entry> entries;
+        size_t max_k;
+        std::unique_ptr<Node> root;
+        size_t nodes;
+        Normalizer normalize;
+
+        bool better (ObjectId a, ObjectId b) const
+        {
+          return (entries[a].score != entries[b].score) ? entries[b].score < entries[a].score : a < b;
+        }
+
+        void offer (Node& node, ObjectId id) const
+        {
+          if (node.top.size () == max_k && !better (id, node.top.back ()))
+            return;
+          node.top.insert (std::upper_bound (node.top.begin (), node.top.end (), id, [this] (ObjectId a, ObjectId b) {return better (a, b);}), id);
+          if (node.top.size () > max_k)
+            node.top.pop_back ();
+        }
+
+        // First child whose label does not start before c.
+        template <class N>
+        static auto child (N& node, typename Key::value_type c)
+        {
+          return std::lower_bound (node.children.begin (), node.children.end (), c, [] (const std::unique_ptr<Node>& n, typename Key::value_type ch) {return n->label[0] < ch;});
+        }
+
+        static size_t common_length (View a, View b)
+        {
+          const size_t n = std::min (a.size (), b.size ());
+          return std::mismatch (a.begin (), a.begin () + n, b.begin ()).first - a.begin ();
+        }
+
+        // Node whose keys are the ones starting with prefix, nullptr if none.
+        const Node* find (View prefix) const
+        {
+          const Node* node = root.get ();
+          for (size_t pos = 0; pos < prefix.size (); )
+          {
+              auto it = child (*node, prefix[pos]);
+              if (it == node->children.end () || (*it)->label[0] != prefix[pos])
+                return nullptr;
+              const size_t common = common_length ((*it)->label, prefix.substr (pos));
+              if (pos + common == prefix.size ())
+                return it->get (); // The prefix ends on this edge.
+              if (common < (*it)->label.size ())
+                return nullptr;
+              node = it->get ();
+              pos += common;
+          }
+          return node;
+        }
+
+        // Every id below node.
+        void collect (const Node& node, std::vector<ObjectId>& ids) const
+        {
+          ids.insert (ids.end (), node.ends.begin (), node.ends.end ());
+          for (const std::unique_ptr<Node>& c : node.children)
+            collect (*c, ids);
+        }
+    };
+  }
+}
+
+#endif // PREFIX_ODB_HPP_INCLUDED
@@ -0,0 +1,209 @@
+// author : Mauricio Gomes
+// license: MIT (https://opensource.org/licenses/MIT)
+
+#ifndef BATCH_CODEC_HPP
+#define BATCH_CODEC_HPP
+
+#include "constant.hpp"
+#include "concept.hpp"
+#include "memory_buffer.hpp"
+#include "object.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <concepts>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace pensar_digital
+{
+    namespace cpplib
+    {
+        /// \brief Serializes many objects of the same class with a single header.
+        ///
+        /// Format: Header, then either the T::Data structs back to back (Layout::ROWS) or one column per selected
+        /// field (Layout::COLUMNS), each column padded to COLUMN_ALIGNMENT bytes. Only the data declared by T itself
+        /// (T::Data) is encoded, the same bytes View<T> exposes.
+        template <HasStdLayoutTriviallyCopyableData T>
+        class BatchCodec
+        {
+            public:
+                using DataType = typename T::DataType;
+
+                enum class Layout : uint32_t { ROWS = 0, COLUMNS = 1 };
+
+                struct Header
+                {
+                    Fingerprint mfingerprint;  //!< Class fingerprint of T.
+                    uint64_t    mcount;        //!< Number of objects.
+                    Layout      mlayout;       //!< ROWS or COLUMNS.
+                    uint32_t    mfield_count;  //!< Number of columns. 0 for ROWS.
+                    Fingerprint mfields;       //!< Hash of the column sizes. 0 for ROWS.
+                };
+                static_assert(StdLayoutTriviallyCopyable<Header>, "Header must be a trivially copyable type");
+
+                inline static constexpr size_t HEADER_SIZE      = sizeof(Header);
+                inline static constexpr size_t COLUMN_ALIGNMENT = 8;
+
+                /// \brief Bytes written by write for count objects.
+                static constexpr size_t size (const size_t count) noexcept { return HEADER_SIZE + count * T::DATA_SIZE; }
+
+                /// \brief Bytes written by write_columns<Fields...> for count objects.
+                template <auto... Fields>
+                static constexpr size_t columns_size (const size_t count) noexcept
+                {
+                    return HEADER_SIZE + (padded(count * field_size<Fields>()) + ... + 0);
+                }
+
+                /// \brief Writes objects (T, T* or smart pointers to T) as rows.
+                template <class Container>
+                    requires (!std::convertible_to<const Container&, std::span<const DataType>>)
+                static void write (MemoryBuffer& mb, const Container& objects)
+                {
+                    mb.reserve(mb.woffset() + size(std::size(objects)));
+                    write_header(mb, std::size(objects), Layout::ROWS, 0, 0);
+                    for (const auto& o : objects)
+                        mb.write((BytePtr)ref(o).data(), T::DATA_SIZE);
+                }
+
+                /// \brief Writes rows already stored contiguously, such as the ones read returns, with a single copy.
+                static void write (MemoryBuffer& mb, std::span<const DataType> rows)
+                {
+                    static_assert(sizeof(DataType) == T::DATA_SIZE, "rows must be the T::Data structs back to back");
+                    mb.reserve(mb.woffset() + size(rows.size()));
+                    write_header(mb, rows.size(), Layout::ROWS, 0, 0);
+                    mb.write((BytePtr)rows.data(), rows.size() * T::DATA_SIZE);
+                }
+
+                /// \brief Writes objects as one column per field. Fields are pointers to DataType members.
+                template <auto... Fields, class Container>
+                static void write_columns (MemoryBuffer& mb, const Container& objects)
+                {
+                    const size_t count = std::size(objects);
+                    mb.reserve(mb.woffset() + columns_size<Fields...>(count));
+                    write_header(mb, count, Layout::COLUMNS, sizeof...(Fields), fields_fingerprint<Fields...>());
+                    (write_column<Fields>(mb, objects), ...);
+                }
+
+                /// \brief Reads and checks the header at the read offset.
+                static Header read_header (MemoryBuffer& mb)
+                {
+                    Header header;
+                    if (mb.ravailable() < HEADER_SIZE)
+                        log_throw(W("BatchCodec: not enough data for a header."));
+                    mb.read_known_size((BytePtr)&header, HEADER_SIZE);
+                    if (header.mfingerprint != T::INFO.mfingerprint)
+                        log_throw(W("BatchCodec: class fingerprint mismatch."));
+                    return header;
+                }
+
+                /// \brief Appends the rows to out with a single copy. Returns the number of objects read.
+                static size_t read (MemoryBuffer& mb, std::vector<DataType>& out)
+                {
+                    const Header header = read_header(mb);
+                    if (header.mlayout != Layout::ROWS)
+                        log_throw(W("BatchCodec: expected rows."));
+                    if (header.mcount > mb.ravailable() / T::DATA_SIZE)
+                        log_throw(W("BatchCodec: not enough data."));
+                    const size_t first = out.size();
+                    out.resize(first + header.mcount);
+                    mb.read_known_size((BytePtr)(out.data() + first), header.mcount * T::DATA_SIZE);
+                    return header.mcount;
+                }
+
+                /// \brief Appends the rows to out as T objects. T must be default constructible.
+                static size_t read (MemoryBuffer& mb, std::vector<T>& out)
+                {
+                    const Header header = read_header(mb);
+                    if (header.mlayout != Layout::ROWS)
+                        log_throw(W("BatchCodec: expected rows."));
+                    if (header.mcount > mb.ravailable() / T::DATA_SIZE)
+                        log_throw(W("BatchCodec: not enough data."));
+                    const size_t first = out.size();
+                    out.resize(first + header.mcount);
+                    const std::byte* p = mb.data() + mb.roffset();
+                    for (size_t i = 0; i < header.mcount; ++i)
+                        std::memcpy(out[first + i].data_bytes(), p + i * T::DATA_SIZE, T::DATA_SIZE);
+                    mb.add_to_read_offset(header.mcount * T::DATA_SIZE);
+                    return header.mcount;
+                }
+
+                /// \brief Appends objects written by write_columns with the same Fields to out. Other members keep their default value.
+                template <auto... Fields>
+                static size_t read_columns (MemoryBuffer& mb, std::vector<DataType>& out)
+                {
+                    const Header header = read_header(mb);
+                    if (header.mlayout != Layout::COLUMNS || header.mfield_count != sizeof...(Fields) || header.mfields != fields_fingerprint<Fields...>())
+                        log_throw(W("BatchCodec: column layout mismatch."));
+                    if (header.mcount > mb.ravailable() || mb.ravailable() < columns_size<Fields...>(header.mcount) - HEADER_SIZE)
+                        log_throw(W("BatchCodec: not enough data for the columns."));
+                    const size_t first = out.size();
+                    out.resize(first + header.mcount);
+                    (read_column<Fields>(mb, out.data() + first, header.mcount), ...);
+                    return header.mcount;
+                }
+
+            private:
+                static constexpr size_t padded (const size_t size) noexcept { return (size + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT; }
+
+                template <auto Field>
+                static constexpr size_t field_size () noexcept { return sizeof(std::declval<DataType&>().*Field); }
+
+                template <auto... Fields>
+                static constexpr Fingerprint fields_fingerprint () noexcept
+                {
+                    Fingerprint h = 14695981039346656037ull;
+                    ((h = (h ^ field_size<Fields>()) * 1099511628211ull), ...);
+                    return h;
+                }
+
+                template <class U>
+                static const T& ref (const U& o) noexcept
+                {
+                    if constexpr (std::derived_from<U, T>)
+                        return o;
+                    else
+                        return *o;
+                }
+
+                static const DataType& data_of (const T& o) noexcept { return *static_cast<const DataType*>(o.data()); }
+
+                static void write_header (MemoryBuffer& mb, const size_t count, const Layout layout, const uint32_t field_count, const Fingerprint fields)
+                {
+                    const Header header = { T::INFO.mfingerprint, count, layout, field_count, fields };
+                    mb.write((BytePtr)&header, HEADER_SIZE);
+                }
+
+                template <auto Field, class Container>
+                static void write_column (MemoryBuffer& mb, const Container& objects)
+                {
+                    constexpr size_t FIELD_SIZE = field_size<Field>();
+                    for (const auto& o : objects)
+                        mb.write((BytePtr)&(data_of(ref(o)).*Field), FIELD_SIZE);
+                    static const std::byte zeros[COLUMN_ALIGNMENT] = {};
+                    const size_t padding = padded(std::size(objects) * FIELD_SIZE) - std::size(objects) * FIELD_SIZE;
+                    if (padding > 0)
+                        mb.write((BytePtr)zeros, padding);
+                }
+
+                template <auto Field>
+                static void read_column (MemoryBuffer& mb, DataType* out, const size_t count)
+                {
+                    constexpr size_t FIELD_SIZE = field_size<Field>();
+                    const size_t column_size = padded(count * FIELD_SIZE);
+                    if (mb.ravailable() < column_size)
+                        log_throw(W("BatchCodec: not enough data for a column."));
+                    const std::byte* p = mb.data() + mb.roffset();
+                    for (size_t i = 0; i < count; ++i)
+                        std::memcpy(&(out[i].*Field), p + i * FIELD_SIZE, FIELD_SIZE);
+                    mb.add_to_read_offset(column_size);
+                }
+        };
+    } // namespace cpplib
+} // namespace pensar_digital
+#endif // BATCH_CODEC_HPP
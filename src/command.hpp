@@ -82,12 +82,13 @@ namespace pensar_digital
             virtual const BytePtr data_bytes() const noexcept { return (BytePtr)data(); }
 
             virtual size_t data_size() const noexcept { return sizeof(mdata); }
-			virtual size_t size() const noexcept { return data_size() + sizeof(ClassInfo) + Object::SIZE; }
+			virtual size_t size() const noexcept { return data_size() + ClassInfo::SIZE + Object::SIZE; }
             
             using G = Generator<Command, Id>; //!< Generator alias.
 
             inline static constexpr size_t DATA_SIZE = sizeof(mdata);
-            inline static constexpr size_t      SIZE = Object::SIZE + DATA_SIZE + sizeof(ClassInfo) + G::SIZE;
+            inline static constexpr size_t      SIZE = Object::SIZE + DATA_SIZE + ClassInfo::SIZE + G::SIZE;
+            inline static constexpr size_t DATA_OFFSET = Object::SIZE + ClassInfo::SIZE; //!< Offset of Data in the record written by write_to.
 
             protected:
             
@@ -151,13 +152,20 @@ namespace pensar_digital
                 Object::assign(mb);
                 return assign_without_object(mb);
             }
+
+            inline virtual const Object& write_to(MemoryBuffer& mb) const noexcept
+            {
+                Object::write_to (mb);
+                INFO.write (mb);
+                mb.write ((BytePtr(&mdata)), DATA_SIZE);
+                mgenerator.write_to (mb);
+                return *this;
+            }
+
             inline virtual MemoryBuffer::Ptr bytes() const noexcept
             {
-				MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(SIZE);  
-                mb->append (*Object::bytes());
-				mb->append (INFO.bytes());
-                mb->write((BytePtr(&mdata)), DATA_SIZE);
-				mb->append (*(mgenerator.bytes()));
+				MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(SIZE, IndexMode::NO_INDEX);
+                write_to (*mb);
                 return mb;
 			}
 
@@ -318,7 +326,7 @@ namespace pensar_digital
                 virtual size_t data_size() const noexcept { return sizeof(mdata); }
                 virtual size_t size() const noexcept 
                 {
-                    size_t size = sizeof(mdata.mindex) + sizeof(ClassInfo);
+                    size_t size = sizeof(mdata.mindex) + ClassInfo::SIZE;
                     for (Int i = 0; i < mdata.mindex; ++i)
                     {
                         size += mdata.mcommands[i]->size();
@@ -358,26 +366,35 @@ namespace pensar_digital
 					Command::assign(mb);
                     return assign_without_parent (mb);
                 }
-                inline virtual MemoryBuffer::Ptr bytes() const noexcept
+                /// \brief Writes the composite and all its commands (recursively) into mb in a single pass.
+                inline virtual const Object& write_to(MemoryBuffer& mb) const noexcept
                 {
-                    MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(size ());  
-				    mb->append(Command::bytes());
-                    mb->append(INFO.bytes());
-					mb->append((BytePtr)(&mdata.mindex), sizeof(mdata.mindex));
+                    Command::write_to(mb);
+                    INFO.write(mb);
+					mb.write((BytePtr)(&mdata.mindex), sizeof(mdata.mindex));
                     for (Int i = 0; i < mdata.mindex; ++i)
                     {
-                        mb->append(mdata.mcommands[i]->bytes());
+                        mdata.mcommands[i]->write_to(mb);
                     };
+                    return *this;
+                }
+
+                inline virtual MemoryBuffer::Ptr bytes() const noexcept
+                {
+                    // Initial capacity for a flat composite. Nested composites make the buffer grow geometrically.
+                    const size_t initial_size = Command::SIZE + ClassInfo::SIZE + sizeof(mdata.mindex) + mdata.mindex * Command::SIZE;
+                    MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(initial_size, IndexMode::NO_INDEX);
+                    write_to(*mb);
 				    return mb;
                 }
 
                 // Implements initialize method from Initializable concept.
+                // A pooled composite is recycled without being destroyed, so the previous owner's commands are freed here.
                 virtual bool initialize (const Id id) noexcept
                 {
-
-                    this->set_id (id == NULL_ID ? this->mgenerator.get_id() : id);
-
-                    return true;
+                    mdata.free_commands();
+                    mdata = NULL_DATA;
+                    return Command::initialize (id, Command::NULL_DATA);
                 }
 
                 inline static typename FactoryType::P get (const Id aid = NULL_ID) noexcept
@@ -91,6 +91,7 @@ namespace pensar_digital
         inline static const bool DO_NOT_FILL_NULL_BEFORE_COPY = false;  ///< Do not fill dest memory with null characters before copying the data.
 		inline static const C* CPPLIB_NAMESPACE = W("pensar_digital::cpplib");  ///< Namespace for the library.
 		using VersionInt = int16_t;  ///< Type for version integers.
+		using Fingerprint = uint64_t; ///< Type for 64-bit class fingerprints.
     }   // namespace cpplib  
 }       // namespace pensar_digital  
   
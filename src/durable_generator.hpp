@@ -0,0 +1,257 @@
+// author : Mauricio Gomes
+// license: MIT (https://opensource.org/licenses/MIT)
+
+#ifndef DURABLE_GENERATOR_HPP
+#define DURABLE_GENERATOR_HPP
+
+#include "generator.hpp"
+#include "constant.hpp"
+#include "string_def.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace pensar_digital
+{
+    namespace cpplib
+    {
+        /// \brief Generator whose ids survive a crash: no id is ever handed out twice, even if the process dies.
+        ///
+        /// Before handing out an id above the last checkpoint, get_id reserves the next range ids (this one included)
+        /// by writing a new high-water mark to the checkpoint file and waiting for it to reach the disk. Allocation
+        /// therefore costs one fsync per range ids. On restart the generator resumes above the last checkpoint; the
+        /// ids reserved but not handed out before the crash are skipped.
+        ///
+        /// The file holds two SLOT_SIZE slots, each a Checkpoint with a sequence number and a checksum. A checkpoint
+        /// overwrites the older slot, so a write torn by a crash leaves the other one intact. It never completed,
+        /// hence no id above the intact slot was handed out. The step must be positive.
+        ///
+        /// \code {.cpp}
+        ///  DurableGenerator<Person> generator ("person.ids", 4096);
+        ///  Id id = generator.get_id ();
+        /// \endcode
+        template <typename Type = Id, typename T = Id>
+        class DurableGenerator : public Generator<Type, T>
+        {
+            public:
+                using G = Generator<Type, T>;
+
+                /// \brief On disk record of a slot.
+                struct Checkpoint
+                {
+                    uint64_t mmagic;
+                    uint64_t msequence;      //!< Incremented by every write, the valid slot with the highest one wins.
+                    int64_t  minitial_value;
+                    int64_t  mstep;
+                    int64_t  mlimit;         //!< Every id handed out is at most mlimit.
+                    uint64_t mchecksum;      //!< FNV-1a of the fields above.
+                };
+
+                inline static constexpr uint64_t MAGIC         = 0x4B50434E45474450ull; // "PDGENCPK"
+                inline static constexpr size_t   SLOT_SIZE     = 512; //!< One sector, so a slot write never touches the other slot.
+                inline static constexpr T        DEFAULT_RANGE = 1024;
+
+                /// \brief Opens the checkpoint file at path, or creates it if it does not exist.
+                /// \param [in] path Checkpoint file.
+                /// \param [in] range Ids reserved by each checkpoint.
+                /// \param [in] initial_value Initial value of a new file. An existing file keeps its own.
+                /// \param [in] step Step of a new file. An existing file keeps its own.
+                DurableGenerator (const std::filesystem::path& path, const T range = DEFAULT_RANGE, const T initial_value = 0, const T step = 1)
+                    : G(null_value<T>(), initial_value, step), mpath(path), mrange(range < 1 ? 1 : range)
+                {
+                    // An empty file was created by a run that crashed before its first checkpoint, and load finds no
+                    // checkpoint in one whose first write was torn. No id was handed out from either, they are new.
+                    const bool exists = std::filesystem::exists(path) && std::filesystem::file_size(path) > 0 && load ();
+                    open_file (!exists);
+                    if (!exists)
+                        write_checkpoint (initial_value);
+                }
+
+                DurableGenerator (const DurableGenerator&) = delete;
+                DurableGenerator& operator= (const DurableGenerator&) = delete;
+
+                virtual ~DurableGenerator ()
+                {
+                    #if defined(_WIN32) || defined(_WIN64)
+                        if (mfile != INVALID_HANDLE_VALUE)
+                            CloseHandle(mfile);
+                    #else
+                        if (mfd != -1)
+                            ::close(mfd);
+                    #endif
+                }
+
+                /// \brief Increments value and return the new value, once it is covered by a checkpoint on disk. Thread safe.
+                inline virtual T get_id ()
+                {
+                    const T id = G::get_id ();
+                    if (id > mlimit.load(std::memory_order_acquire))
+                        reserve (id);
+                    return id;
+                }
+
+                /// \brief Sets value and checkpoints it. Next call to get_id will get value + step.
+                inline virtual void set_value (T val)
+                {
+                    std::lock_guard<std::mutex> lock(mmutex);
+                    G::set_value (val);
+                    write_checkpoint (val);
+                    mlimit.store(val, std::memory_order_release);
+                }
+
+                /// \brief Highest id covered by the last checkpoint.
+                inline T limit () const noexcept { return mlimit.load(std::memory_order_acquire); }
+
+                /// \brief Ids reserved by each checkpoint.
+                inline T range () const noexcept { return mrange; }
+
+                /// \brief Checkpoints written since the generator was opened, one fsync each.
+                inline size_t checkpoints () const noexcept { return mcheckpoints.load(std::memory_order_relaxed); }
+
+                inline const std::filesystem::path& path () const noexcept { return mpath; }
+
+            private:
+                std::filesystem::path mpath;
+                T mrange;
+                std::atomic<T> mlimit = 0;
+                std::atomic<size_t> mcheckpoints = 0;
+                uint64_t msequence = 0; //!< Sequence of the last checkpoint. Guarded by mmutex.
+                std::mutex mmutex;      //!< Serializes checkpoints.
+                #if defined(_WIN32) || defined(_WIN64)
+                    HANDLE mfile = INVALID_HANDLE_VALUE;
+                #else
+                    int mfd = -1;
+                #endif
+
+                static uint64_t checksum (const Checkpoint& c) noexcept
+                {
+                    const std::byte* p = (const std::byte*)&c;
+                    uint64_t h = 14695981039346656037ull;
+                    for (size_t i = 0; i < offsetof(Checkpoint, mchecksum); ++i)
+                        h = (h ^ (uint64_t)p[i]) * 1099511628211ull;
+                    return h;
+                }
+
+                /// \brief Checkpoints a range above id, unless another thread already did.
+                void reserve (const T id)
+                {
+                    std::lock_guard<std::mutex> lock(mmutex);
+                    if (id <= mlimit.load(std::memory_order_relaxed))
+                        return;
+                    // Other threads may hold blocks up to current(), cover them too.
+                    const T limit = std::max(id, this->current ()) + (mrange - 1) * this->step ();
+                    write_checkpoint (limit);
+                    mlimit.store(limit, std::memory_order_release);
+                }
+
+                /// \brief Resumes from the valid slot with the highest sequence. Returns false if there is none and slot 0
+                /// was never written: the only write was then sequence 1, to slot 1, torn by a crash.
+                bool load ()
+                {
+                    std::ifstream in(mpath, std::ios::binary);
+                    if (!in)
+                        log_throw(W("DurableGenerator: cannot read the checkpoint file."));
+                    Checkpoint best = {};
+                    bool blank = true; // Slot 0 holds only zeros, or is missing.
+                    for (size_t slot = 0; slot < 2; ++slot)
+                    {
+                        std::array<std::byte, SLOT_SIZE> bytes = {};
+                        in.clear();
+                        in.seekg(slot * SLOT_SIZE);
+                        in.read((char*)bytes.data(), SLOT_SIZE);
+                        const size_t read = (size_t)in.gcount();
+                        if (slot == 0)
+                            blank = std::all_of(bytes.begin(), bytes.begin() + read, [](const std::byte b) { return b == std::byte{0}; });
+                        if (read < sizeof(Checkpoint))
+                            continue;
+                        Checkpoint c;
+                        std::memcpy(&c, bytes.data(), sizeof(c));
+                        if (c.mmagic == MAGIC && c.mchecksum == checksum(c) && c.msequence > best.msequence)
+                            best = c;
+                    }
+                    if (best.msequence == 0)
+                    {
+                        if (blank)
+                            return false;
+                        log_throw(W("DurableGenerator: no valid checkpoint."));
+                    }
+                    G::initialize (null_value<T>(), (T)best.minitial_value, (T)best.mstep);
+                    G::set_value ((T)best.mlimit);
+                    mlimit = (T)best.mlimit;
+                    msequence = best.msequence;
+                    return true;
+                }
+
+                void open_file (const bool create)
+                {
+                    #if defined(_WIN32) || defined(_WIN64)
+                        mfile = CreateFileW(mpath.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                                            create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+                        if (mfile == INVALID_HANDLE_VALUE)
+                            log_throw(W("DurableGenerator: cannot open the checkpoint file."));
+                    #else
+                        mfd = ::open(mpath.string().c_str(), create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, S_IRUSR | S_IWUSR);
+                        if (mfd == -1)
+                            log_throw(W("DurableGenerator: cannot open the checkpoint file."));
+                        if (create)
+                        {
+                            // Makes the new directory entry durable, later checkpoints only sync the file.
+                            std::filesystem::path dir = mpath.parent_path();
+                            const int dfd = ::open(dir.empty() ? "." : dir.string().c_str(), O_RDONLY);
+                            if (dfd != -1)
+                            {
+                                ::fsync(dfd);
+                                ::close(dfd);
+                            }
+                        }
+                    #endif
+                }
+
+                /// \brief Writes limit to the older slot and waits until it is on disk. mmutex must be held, or the
+                /// generator not shared yet.
+                void write_checkpoint (const T limit)
+                {
+                    Checkpoint c = { MAGIC, msequence + 1, (int64_t)this->initial_value (), (int64_t)this->step (), (int64_t)limit, 0 };
+                    c.mchecksum = checksum(c);
+                    std::array<std::byte, SLOT_SIZE> slot = {};
+                    std::memcpy(slot.data(), &c, sizeof(c));
+                    const uint64_t offset = (c.msequence % 2) * SLOT_SIZE;
+                    #if defined(_WIN32) || defined(_WIN64)
+                        OVERLAPPED position = {};
+                        position.Offset = (DWORD)offset;
+                        DWORD written = 0;
+                        if (!WriteFile(mfile, slot.data(), (DWORD)SLOT_SIZE, &written, &position) || written != SLOT_SIZE || !FlushFileBuffers(mfile))
+                            log_throw(W("DurableGenerator: cannot write the checkpoint."));
+                    #else
+                        if (::pwrite(mfd, slot.data(), SLOT_SIZE, (off_t)offset) != (ssize_t)SLOT_SIZE)
+                            log_throw(W("DurableGenerator: cannot write the checkpoint."));
+                        #if defined(__APPLE__)
+                            const int synced = ::fsync(mfd);
+                        #else
+                            const int synced = ::fdatasync(mfd);
+                        #endif
+                        if (synced != 0)
+                            log_throw(W("DurableGenerator: cannot sync the checkpoint."));
+                    #endif
+                    msequence = c.msequence;
+                    mcheckpoints.fetch_add(1, std::memory_order_relaxed);
+                }
+        }; // class DurableGenerator
+    } // namespace cpplib
+} // namespace pensar_digital
+
+#endif // DURABLE_GENERATOR_HPP
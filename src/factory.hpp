@@ -4,10 +4,18 @@
 #ifndef FACTORY_HPP_INCLUDED
 #define FACTORY_HPP_INCLUDED
 
+#include "memory_pool.hpp"
+
 #include <memory>
 #include <type_traits>
 #include <vector>
 #include <cassert>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <new>
+#include <cstddef>
 
 namespace pensar_digital
 {
@@ -40,87 +48,594 @@ namespace pensar_digital
                 T* mockup_pointer;
          };
 
+        /// \brief Pooled object with room for the control block of the shared_ptr that hands it out.
+        template <class T>
+        struct PoolNode
+        {
+            inline static constexpr size_t CONTROL_BLOCK_SIZE = 64;
+
+            alignas(std::max_align_t) std::byte mcontrol_block[CONTROL_BLOCK_SIZE];
+            T                   mobject;
+            PoolNode*           mnext = nullptr; //!< Next free node.
+            std::atomic<bool>   mlive = false;   //!< True while the object is handed out.
+            std::atomic<size_t> mholders = 0;    //!< The shared_ptr handing it out plus the for_each_live pins, 0 if free.
+
+            template <typename... Args>
+            PoolNode (const Args& ... args) : mobject(args ...) {}
+
+            /// \brief Adds a holder, so the node is not recycled until unpin. Returns false if the node is free.
+            bool pin () noexcept
+            {
+                size_t holders = mholders.load(std::memory_order_acquire);
+                while (holders != 0)
+                    if (mholders.compare_exchange_weak(holders, holders + 1, std::memory_order_acq_rel))
+                        return true;
+                return false;
+            }
+
+            /// \brief Removes a holder. Returns true if it was the last one: the caller puts the node back in a free list.
+            bool unpin () noexcept { return mholders.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+        };
+
+        /// \brief Owns pool nodes allocated in contiguous slabs, one slab per refill.
+        template <class Node>
+        class PoolSlabs
+        {
+            public:
+                PoolSlabs () = default;
+                PoolSlabs (const PoolSlabs&) = delete;
+                PoolSlabs& operator= (const PoolSlabs&) = delete;
+
+                ~PoolSlabs ()
+                {
+                    for (const Slab& slab : mslabs)
+                        release(slab.mnodes, slab.mcount);
+                }
+
+                /// \brief Allocates a slab of count nodes built with args, linked through mnext. Returns the first one.
+                template <typename... Args>
+                Node* add (const size_t count, const Args& ... args)
+                {
+                    mslabs.reserve(mslabs.size() + 1);
+                    Node* nodes = static_cast<Node*>(::operator new(count * sizeof(Node), std::align_val_t(alignof(Node))));
+                    size_t built = 0;
+                    try
+                    {
+                        for (; built < count; ++built)
+                            new (nodes + built) Node(args ...);
+                    }
+                    catch (...)
+                    {
+                        release(nodes, built);
+                        throw;
+                    }
+                    for (size_t i = 0; i + 1 < count; ++i)
+                        nodes[i].mnext = nodes + i + 1;
+                    mslabs.push_back({ nodes, count });
+                    msize += count;
+                    return nodes;
+                }
+
+                size_t size () const noexcept { return msize; }
+
+                /// \brief Calls f(node) for every node, slab by slab in address order.
+                template <class F>
+                void for_each (F&& f) const
+                {
+                    for (const Slab& slab : mslabs)
+                        for (size_t i = 0; i < slab.mcount; ++i)
+                            f(slab.mnodes[i]);
+                }
+
+            private:
+                struct Slab
+                {
+                    Node*  mnodes;
+                    size_t mcount;
+                };
+
+                static void release (Node* nodes, const size_t count) noexcept
+                {
+                    for (size_t i = 0; i < count; ++i)
+                        nodes[i].~Node();
+                    ::operator delete(nodes, std::align_val_t(alignof(Node)));
+                }
+
+                std::vector<Slab> mslabs;
+                size_t            msize = 0;
+        };
+
+        /// \brief for_each_live of the pools. The live nodes are pinned under mutex and f is called on them after it is
+        /// released, so f may call get or release pooled pointers. A pinned node is not recycled: an object released
+        /// before f reaches it is skipped, and f never sees one initialized again for another owner. recycle(node)
+        /// puts back a node whose last holder was the pin.
+        template <class Node, class F, class Recycle>
+        void for_each_live_node (const PoolSlabs<Node>& slabs, std::mutex& mutex, F& f, Recycle recycle)
+        {
+            std::vector<Node*> pinned;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pinned.reserve(slabs.size());
+                slabs.for_each([&pinned](Node& node)
+                {
+                    if (node.mlive.load(std::memory_order_acquire) && node.pin())
+                        pinned.push_back(&node);
+                });
+            }
+            size_t i = 0;
+            try
+            {
+                for (; i < pinned.size(); ++i)
+                {
+                    if (pinned[i]->mlive.load(std::memory_order_acquire))
+                        f(pinned[i]->mobject);
+                    if (pinned[i]->unpin())
+                        recycle(pinned[i]);
+                }
+            }
+            catch (...)
+            {
+                for (; i < pinned.size(); ++i)
+                    if (pinned[i]->unpin())
+                        recycle(pinned[i]);
+                throw;
+            }
+        }
+
+        /// \brief Intrusive reference count for pool states, so handing out objects does not copy shared_ptrs.
+        template <class Derived>
+        class PoolReferenceCounted
+        {
+            public:
+                void add_reference () noexcept { mreferences.fetch_add(1, std::memory_order_relaxed); }
+
+                /// \brief Deletes the object when the last reference is removed.
+                void remove_reference () noexcept
+                {
+                    if (mreferences.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        delete static_cast<Derived*>(this);
+                }
+
+            private:
+                std::atomic<size_t> mreferences = 1;
+        };
+
+        /// \brief Deleter of pooled objects: the object only stops being live, the node is recycled by PoolNodeAllocator.
+        template <class Node>
+        struct PoolNodeDeleter
+        {
+            Node* mnode;
+            template <class T>
+            void operator() (T*) const noexcept { mnode->mlive.store(false, std::memory_order_release); }
+        };
+
+        /// \brief Places the shared_ptr control block inside the node and gives the node back to Owner when the control
+        /// block is released, which is the last time the shared_ptr machinery touches the node. Owner::release(node)
+        /// must also drop the reference taken for the object by get.
+        template <class U, class Node, class Owner>
+        struct PoolNodeAllocator
+        {
+            using value_type = U;
+
+            Node*  mnode;
+            Owner* mowner; //!< Referenced while the object is in use.
+
+            PoolNodeAllocator (Node* node, Owner* owner) noexcept : mnode(node), mowner(owner) {}
+
+            template <class V>
+            PoolNodeAllocator (const PoolNodeAllocator<V, Node, Owner>& other) noexcept : mnode(other.mnode), mowner(other.mowner) {}
+
+            U* allocate (const size_t n)
+            {
+                if constexpr (FITS)
+                    if (n == 1)
+                        return reinterpret_cast<U*>(mnode->mcontrol_block);
+                return static_cast<U*>(SizeClassPool::allocate(n * sizeof(U)));
+            }
+
+            void deallocate (U* p, const size_t n) noexcept
+            {
+                if (!FITS || n != 1)
+                    SizeClassPool::deallocate(p, n * sizeof(U));
+                mowner->release(mnode);
+            }
+
+            template <class V>
+            bool operator== (const PoolNodeAllocator<V, Node, Owner>& other) const noexcept { return mnode == other.mnode; }
+
+            inline static constexpr bool FITS = (sizeof(U) <= Node::CONTROL_BLOCK_SIZE) && (alignof(U) <= alignof(std::max_align_t));
+        };
+
+        /// \brief Pool of reusable objects.
+        ///
+        /// Objects are allocated in slabs of refill_size nodes, each node holding the object, the control block of the
+        /// shared_ptr that hands it out and the free list link, so pooled objects are contiguous in memory.
+        /// Free objects are kept in an intrusive free list, so get and release are O(1). get calls
+        /// T::initialize(args...) on the recycled object and returns a shared_ptr that puts the object back
+        /// in the list instead of deleting it. The pool state is shared with the returned pointers, so they may outlive
+        /// the factory. get and release are thread-safe.
         template <class T, typename... Args> //requires Initializable<T, Args...>
         class PoolFactory : public NewFactory <T, Args...>
         {
             private:
                 using P = NewFactory<T, Args...>::P;
-                /// <summary>
-                /// Creates a pool of objects of type T containing pool_size objects created with the arguments args.
-                /// </summary>
-                /// <param name="pool_size">Initial pool size.</param>
-                /// <param name="refill_size">When </param>
-                /// <param name="args"></param>
-                void fill_pool (const size_t& pool_size, const Args& ... args)
+                using Node = PoolNode<T>;
+
+                /// \brief Nodes and free list. Referenced by the factory and every object it handed out.
+                struct State : public PoolReferenceCounted<State>
                 {
-                    for (size_t i = 0; i < pool_size; ++i)
+                    mutable std::mutex mmutex;
+                    PoolSlabs<Node>    mslabs;            //!< Owns every node.
+                    Node*              mfree = nullptr;   //!< Head of the free list.
+                    size_t             mfree_count = 0;
+
+                    void release (Node* node) noexcept
                     {
-                        std::shared_ptr<T>&& ptr = std::make_shared<T>(args ...);
-                        pool.push_back(std::move(ptr));
+                        if (node->unpin())
+                            push(node);
+                        this->remove_reference();
                     }
-                    available_count = pool_size;
-                }
-                void add (const size_t& count, const Args& ... args)
-                {
-					for (size_t i = 0; i < count; ++i)
-					{
-                        std::shared_ptr<T>&& ptr = std::make_shared<T>(args ...);
-                        pool.push_back(ptr);
+
+                    /// \brief Puts node back in the free list.
+                    void push (Node* node) noexcept
+                    {
+                        std::lock_guard<std::mutex> lock(mmutex);
+                        node->mnext = mfree;
+                        mfree = node;
+                        ++mfree_count;
+                    }
+
+                    /// \brief Pops a free node or returns nullptr if there is none.
+                    Node* pop () noexcept
+                    {
+                        std::lock_guard<std::mutex> lock(mmutex);
+                        Node* node = mfree;
+                        if (node != nullptr)
+                        {
+                            mfree = node->mnext;
+                            --mfree_count;
+                        }
+                        return node;
                     }
-					available_count += count;
-				}
+                };
+
+                /// <summary>
+                /// Adds a slab of count objects created with the arguments args to the free list.
+                /// </summary>
+                void add (const size_t& count, const Args& ... args) const
+                {
+                    if (count == 0)
+                        return;
+                    std::lock_guard<std::mutex> lock(mstate->mmutex);
+                    Node* first = mstate->mslabs.add(count, args ...);
+                    first[count - 1].mnext = mstate->mfree;
+                    mstate->mfree = first;
+                    mstate->mfree_count += count;
+                }
         public:
             //inline static const Version::Ptr VERSION = pd::Version::get (1, 1, 1);
             PoolFactory (const size_t initial_pool_size, const size_t a_refill_size, const Args& ... args) :
-                         available_count (0), 
+                         mstate(new State()),
                          refill_size(a_refill_size)
             {
-                fill_pool(initial_pool_size, args ...);
+                try
+                {
+                    add(initial_pool_size, args ...);
+                }
+                catch (...)
+                {
+                    mstate->remove_reference();
+                    throw;
+                }
             };
             
             PoolFactory(const Args& ... args) : PoolFactory (10, 10, args ...) { };
+
+            PoolFactory (const PoolFactory&) = delete;
+            PoolFactory& operator= (const PoolFactory&) = delete;
             
-            virtual ~PoolFactory() {}
+            virtual ~PoolFactory() { mstate->remove_reference(); }
 
-            virtual P get(const Args& ... args) 
+            virtual P get(const Args& ... args) const
             { 
-                // Iterate through the pool to find an available object.
-                for (auto& ptr : pool)
-                {
-					if (ptr.use_count () < 2)
-					{
-                        ptr->initialize (args ...);
-                        available_count--;
-
-                        // Need to copy to increase the use count.
-						return * new (std::shared_ptr<T>) (ptr); 
-					}
-				}
-                assert(available_count <= 0);
-    			add (refill_size, args ...);
-                return get (args ...);
+                Node* node = mstate->pop();
+                while (node == nullptr)
+                {
+                    add(refill_size > 0 ? refill_size : 1, args ...);
+                    node = mstate->pop();
+                }
+                node->mobject.initialize(args ...);
+                node->mholders.store(1, std::memory_order_relaxed);
+                node->mlive.store(true, std::memory_order_release);
+                mstate->add_reference();
+                try
+                {
+                    return P(&node->mobject, PoolNodeDeleter<Node>{ node }, PoolNodeAllocator<T, Node, State>(node, mstate));
+                }
+                catch (...)
+                {
+                    mstate->release(node);
+                    throw;
+                }
             }
-            size_t get_available_count() const { return available_count; }
 
-            size_t get_pool_size() const { return pool.size(); }
+            /// \brief Calls f(T&) for every object currently handed out, walking the slabs linearly. f runs outside the
+            /// pool lock, on objects pinned so that they are not recycled meanwhile (see for_each_live_node).
+            template <class F>
+            void for_each_live (F&& f) const
+            {
+                State* state = mstate;
+                for_each_live_node(state->mslabs, state->mmutex, f, [state](Node* node) { state->push(node); });
+            }
+
+            size_t get_available_count() const 
+            { 
+                std::lock_guard<std::mutex> lock(mstate->mmutex);
+                return mstate->mfree_count; 
+            }
+
+            size_t get_pool_size() const 
+            { 
+                std::lock_guard<std::mutex> lock(mstate->mmutex);
+                return mstate->mslabs.size(); 
+            }
 
             size_t get_refill_size() const { return refill_size; }
 
             void set_refill_size(const size_t& value) { refill_size = value; }
 
+            /// \brief Starts a new pool. Objects still in use go back to the old one, which is freed with the last of them.
             void reset(const size_t& initial_pool_size, const size_t& a_refill_size, const Args& ... args)
 			{
-				pool.clear();
-				fill_pool(initial_pool_size, args ...);
-				available_count = initial_pool_size;
+				State* state = new State();
+				mstate->remove_reference();
+				mstate = state;
 				refill_size = a_refill_size;
+				add(initial_pool_size, args ...);
 			}
         private:
-            std::vector<typename std::shared_ptr<T>> pool;
-            size_t available_count;
+            State* mstate; //!< Holds one reference.
             size_t refill_size;
         };
 
+        /// \brief Tag to build a Factory on a ShardedPoolFactory.
+        struct ShardedPoolTag {};
+        inline constexpr ShardedPoolTag SHARDED_POOL = {};
+
+        /// \brief Pool of reusable objects split in shards to avoid contention between threads.
+        ///
+        /// Each thread has a home shard that works as its local cache: get takes free objects from it and released
+        /// objects go back to the home shard of the releasing thread. When the home shard is empty, get steals a batch
+        /// of up to refill_size objects from another shard, and only allocates a refill when every shard is empty.
+        /// Objects are recycled with the same initialize(args...) contract as PoolFactory.
+        template <class T, typename... Args>
+        class ShardedPoolFactory : public NewFactory <T, Args...>
+        {
+            private:
+                using P = NewFactory<T, Args...>::P;
+                using Node = PoolNode<T>;
+
+                struct alignas(64) Shard
+                {
+                    std::mutex mmutex;
+                    Node*      mfree = nullptr;
+                    size_t     mfree_count = 0;
+
+                    /// \brief Pushes the chain first..last of count nodes.
+                    void push (Node* first, Node* last, const size_t count) noexcept
+                    {
+                        std::lock_guard<std::mutex> lock(mmutex);
+                        last->mnext = mfree;
+                        mfree = first;
+                        mfree_count += count;
+                    }
+
+                    /// \brief Detaches up to max free nodes and returns the first one (nullptr if empty).
+                    Node* pop (const size_t max, size_t& count) noexcept
+                    {
+                        std::lock_guard<std::mutex> lock(mmutex);
+                        Node* first = mfree;
+                        Node* last  = nullptr;
+                        count = 0;
+                        for (Node* node = mfree; node != nullptr && count < max; node = node->mnext, ++count)
+                            last = node;
+                        if (last != nullptr)
+                        {
+                            mfree = last->mnext;
+                            last->mnext = nullptr;
+                            mfree_count -= count;
+                        }
+                        return (count == 0) ? nullptr : first;
+                    }
+                };
+
+                /// \brief Referenced by every Anchor.
+                struct State : public PoolReferenceCounted<State>
+                {
+                    std::unique_ptr<Shard[]>           mshards;
+                    size_t                             mshard_count;
+                    mutable std::mutex                 mslabs_mutex;
+                    PoolSlabs<Node>                    mslabs;     //!< Owns every node.
+                    std::atomic<size_t>                msteals = 0;
+
+                    State (const size_t shard_count) : mshards(new Shard[shard_count]), mshard_count(shard_count) {}
+
+                    size_t home_index () const noexcept { return thread_index() % mshard_count; }
+                    Shard& home () noexcept { return mshards[home_index()]; }
+                };
+
+                /// \brief Keeps the state alive. There is one per shard, so handing out objects does not make every
+                /// thread update the same reference count.
+                struct alignas(64) Anchor : public PoolReferenceCounted<Anchor>
+                {
+                    State* mstate;
+
+                    Anchor (State* state) noexcept : mstate(state) { state->add_reference(); }
+                    ~Anchor () { mstate->remove_reference(); }
+
+                    /// \brief Gives node back to the home shard of the releasing thread.
+                    void release (Node* node) noexcept
+                    {
+                        if (node->unpin())
+                            mstate->home().push(node, node, 1);
+                        this->remove_reference();
+                    }
+                };
+
+                /// \brief Small sequential index of the calling thread.
+                static size_t thread_index () noexcept
+                {
+                    static std::atomic<size_t> next = 0;
+                    thread_local const size_t index = next++;
+                    return index;
+                }
+
+                /// \brief Allocates a slab of count objects into shard.
+                void add (Shard& shard, const size_t count, const Args& ... args) const
+                {
+                    if (count == 0)
+                        return;
+                    Node* first;
+                    {
+                        std::lock_guard<std::mutex> lock(mstate->mslabs_mutex);
+                        first = mstate->mslabs.add(count, args ...);
+                    }
+                    shard.push(first, first + count - 1, count);
+                }
+
+                /// \brief Takes a batch from another shard, keeps the first node and moves the rest to home.
+                Node* steal (Shard& home) const noexcept
+                {
+                    const size_t n = mstate->mshard_count;
+                    const size_t start = thread_index();
+                    for (size_t i = 1; i < n; ++i)
+                    {
+                        size_t count;
+                        Node* first = mstate->mshards[(start + i) % n].pop(std::max<size_t>(refill_size, 1), count);
+                        if (first == nullptr)
+                            continue;
+                        ++mstate->msteals;
+                        if (count > 1)
+                        {
+                            Node* last = first->mnext;
+                            while (last->mnext != nullptr)
+                                last = last->mnext;
+                            home.push(first->mnext, last, count - 1);
+                        }
+                        return first;
+                    }
+                    return nullptr;
+                }
+
+            public:
+                /// \brief shard_count 0 means one shard per hardware thread.
+                ShardedPoolFactory (const size_t initial_pool_size, const size_t a_refill_size, const Args& ... args) :
+                    ShardedPoolFactory(0, initial_pool_size, a_refill_size, args ...)
+                {
+                }
+
+                ShardedPoolFactory (const size_t shard_count, const size_t initial_pool_size, const size_t a_refill_size, const Args& ... args) :
+                    mstate(new State(shard_count > 0 ? shard_count : std::max(1u, std::thread::hardware_concurrency()))),
+                    refill_size(a_refill_size)
+                {
+                    try
+                    {
+                        manchors.reserve(mstate->mshard_count);
+                        for (size_t i = 0; i < mstate->mshard_count; ++i)
+                            manchors.push_back(new Anchor(mstate));
+                        add(mstate->home(), initial_pool_size, args ...);
+                    }
+                    catch (...)
+                    {
+                        release_references();
+                        throw;
+                    }
+                }
+
+                ShardedPoolFactory (const ShardedPoolFactory&) = delete;
+                ShardedPoolFactory& operator= (const ShardedPoolFactory&) = delete;
+
+                virtual ~ShardedPoolFactory () { release_references(); }
+
+                virtual P get (const Args& ... args) const
+                {
+                    const size_t index = mstate->home_index();
+                    Shard& home = mstate->mshards[index];
+                    size_t count;
+                    Node* node = home.pop(1, count);
+                    if (node == nullptr)
+                        node = steal(home);
+                    while (node == nullptr)
+                    {
+                        add(home, std::max<size_t>(refill_size, 1), args ...);
+                        node = home.pop(1, count);
+                    }
+                    node->mobject.initialize(args ...);
+                    node->mholders.store(1, std::memory_order_relaxed);
+                    node->mlive.store(true, std::memory_order_release);
+                    Anchor* anchor = manchors[index];
+                    anchor->add_reference();
+                    try
+                    {
+                        return P(&node->mobject, PoolNodeDeleter<Node>{ node }, PoolNodeAllocator<T, Node, Anchor>(node, anchor));
+                    }
+                    catch (...)
+                    {
+                        anchor->release(node);
+                        throw;
+                    }
+                }
+
+                /// \brief Calls f(T&) for every object currently handed out, walking the slabs linearly.
+                /// Objects acquired by other threads meanwhile may or may not be visited. As in PoolFactory, f runs
+                /// outside the slab lock on pinned objects (see for_each_live_node).
+                template <class F>
+                void for_each_live (F&& f) const
+                {
+                    State* state = mstate;
+                    for_each_live_node(state->mslabs, state->mslabs_mutex, f, [state](Node* node) { state->home().push(node, node, 1); });
+                }
+
+                size_t get_available_count () const
+                {
+                    size_t count = 0;
+                    for (size_t i = 0; i < mstate->mshard_count; ++i)
+                    {
+                        std::lock_guard<std::mutex> lock(mstate->mshards[i].mmutex);
+                        count += mstate->mshards[i].mfree_count;
+                    }
+                    return count;
+                }
+
+                size_t get_pool_size () const
+                {
+                    std::lock_guard<std::mutex> lock(mstate->mslabs_mutex);
+                    return mstate->mslabs.size();
+                }
+
+                size_t get_shard_count () const noexcept { return mstate->mshard_count; }
+
+                /// \brief Number of batches taken from another shard.
+                size_t get_steal_count () const noexcept { return mstate->msteals; }
+
+                size_t get_refill_size () const { return refill_size; }
+
+                void set_refill_size (const size_t& value) { refill_size = value; }
+
+            private:
+                void release_references () noexcept
+                {
+                    State* state = mstate; // Holds the reference taken at construction, the anchors hold the others.
+                    for (Anchor* anchor : manchors)
+                        anchor->remove_reference();
+                    state->remove_reference();
+                }
+
+                State*               mstate;   //!< Kept alive by the anchors.
+                std::vector<Anchor*> manchors; //!< One per shard, each holding one reference.
+                size_t refill_size;
+        };
+
         template <class T, typename... Args>
         class SingletonFactory : public NewFactory <T, Args...>
 		{
@@ -135,7 +650,7 @@ namespace pensar_digital
 				std::shared_ptr<T> singleton;
         };
 
-        // Factory can be configured to be a NewFactory, MockupFactory, PoolFactory or SingletonFactory.   
+        // Factory can be configured to be a NewFactory, MockupFactory, PoolFactory, ShardedPoolFactory or SingletonFactory.   
 		template <class T, typename... Args>
 		class Factory
 		{
@@ -148,6 +663,12 @@ namespace pensar_digital
                     mfactory_ptr = std::make_shared<PoolFactory<T, Args...>>(pool_size, refill_size, args ...);
                 };
 
+                /// \brief Builds the factory on a ShardedPoolFactory, for objects acquired by many threads.
+                Factory (const ShardedPoolTag, const size_t pool_size, const size_t refill_size, const Args& ... args) 
+                { 
+                    mfactory_ptr = std::make_shared<ShardedPoolFactory<T, Args...>>(pool_size, refill_size, args ...);
+                };
+
                 virtual ~Factory() { }
 				
                 virtual P get (const Args& ... args) { return mfactory_ptr->get(args ...); }
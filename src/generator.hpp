@@ -15,6 +15,9 @@
 #include <iosfwd>   // istream, ostream
 #include <bit>      // endian
 #include <concepts> // std::convertible_to
+#include <atomic>   // atomic, atomic_ref
+#include <array>
+#include <cstdint>
 
 namespace pensar_digital
 {
@@ -36,6 +39,13 @@ namespace pensar_digital
       ///
       ///  };
       /// \endcode
+      ///
+      /// get_id is thread safe: the value is bumped with one atomic fetch-add. With set_block_size(n), n > 1, each
+      /// thread reserves n ids per fetch-add (hi/lo) and hands them out locally, so threads don't contend on the value.
+      /// Ids keep the initial_value + k * step sequence but are only unique, no longer ordered across threads, and
+      /// current() is the last id reserved by any thread. Ids reserved but not handed out are skipped, also after a
+      /// save and reload, which never hands out an id twice. set_value, initialize and assign start a new sequence and
+      /// must not run concurrently with get_id.
       template <typename Type = Id, typename T = Id>
       class Generator : public Object     
       {
@@ -46,17 +56,51 @@ namespace pensar_digital
             using G = Generator<Type, T>; //!< Generator alias.
             using GeneratorPtr = std::shared_ptr<G>;
             using Factory = pd::Factory<G, T, T, T>;
-            inline static Factory mfactory = { 3, 10, null_value<T>(), 0, 1}; //!< Member variable "factory"
+            inline static Factory mfactory = { SHARDED_POOL, 3, 10, null_value<T>(), 0, 1}; //!< Member variable "factory". Shared by every thread.
             
        private:
           struct Data : public pd::Data
           {
               T minitial_value; //!< Generator initial_value.
-              T mvalue; //!< Generator current value.
+              alignas(std::atomic_ref<T>::required_alignment) T mvalue; //!< Generator current value, updated atomically.
               T mstep; //!< Step to increment value.
               Data(T initial_value = 0, T step = 1) : minitial_value(initial_value), mvalue(initial_value), mstep(step) {}
           }; // struct Data
           Data mdata;
+
+          /// \brief Ids reserved by the calling thread from one generator.
+          struct Reservation
+          {
+              uint64_t mepoch = 0;     //!< Epoch of the generator the ids come from, 0 if unused.
+              T        mnext = 0;      //!< Next id to hand out.
+              T        mremaining = 0; //!< Ids left in the block.
+          };
+
+          inline static constexpr size_t RESERVATIONS = 8; //!< Generators a thread keeps a block from at once.
+          inline static std::atomic<uint64_t> mnext_epoch = 1;
+
+          T mblock_size = 1; //!< Ids reserved per fetch-add. Not persisted.
+          std::atomic<uint64_t> mepoch = mnext_epoch++; //!< Identifies the current sequence, a new one invalidates the reserved blocks.
+
+          inline std::atomic_ref<T> value () const noexcept { return std::atomic_ref<T>(const_cast<T&>(mdata.mvalue)); }
+
+          /// \brief Starts a new sequence: blocks reserved from the previous one are dropped.
+          inline void restart () noexcept { mepoch = mnext_epoch++; }
+
+          /// \brief Block of the calling thread for this generator. A thread using more than RESERVATIONS generators
+          /// with blocks drops the oldest one.
+          Reservation& reservation () const noexcept
+          {
+              thread_local std::array<Reservation, RESERVATIONS> reservations;
+              thread_local size_t victim = 0;
+              const uint64_t epoch = mepoch.load(std::memory_order_relaxed);
+              for (Reservation& r : reservations)
+                  if (r.mepoch == epoch)
+                      return r;
+              Reservation& r = reservations[victim++ % RESERVATIONS];
+              r = { epoch, 0, 0 };
+              return r;
+          }
    
           public:
 
@@ -64,7 +108,7 @@ namespace pensar_digital
             inline virtual const ClassInfo* info_ptr() const noexcept { return &INFO; }
             using DataType = Data;
             inline static constexpr size_t DATA_SIZE = sizeof(mdata);
-            inline static constexpr size_t      SIZE = DATA_SIZE + sizeof(INFO) + Object::SIZE;
+            inline static constexpr size_t      SIZE = DATA_SIZE + ClassInfo::SIZE + Object::SIZE;
 
           inline const   pd::Data* generator_data     () const noexcept { return &mdata   ; }
           virtual const pd::Data* data() const noexcept { return &mdata; }
@@ -78,6 +122,18 @@ namespace pensar_digital
             /// \param [in] astep Step to be used when incrementing the generator, defaults to 1.
             Generator (T aid = null_value<T>(), T initial_value = 0, T step = 1) noexcept : Object(aid == null_value<T>() ? 0 : aid), mdata(initial_value, step) {};
 
+            /// \brief Copies the state of g. The copy is a new sequence: it does not share g's reserved blocks.
+            Generator (const Generator& g) noexcept : Object(g), mdata(g.mdata), mblock_size(g.mblock_size) {}
+
+            Generator& operator= (const Generator& g) noexcept
+            {
+                Object::operator= (g);
+                mdata = g.mdata;
+                mblock_size = g.mblock_size;
+                restart ();
+                return *this;
+            }
+
 			// Constructor from MemoryBuffer.
 			Generator(MemoryBuffer& mb) noexcept : Object(mb)
             {
@@ -89,6 +145,7 @@ namespace pensar_digital
             {
                 INFO.test_class_name_and_version(mb);
                 mb.read_known_size((BytePtr)(&mdata), DATA_SIZE);
+                restart ();
                 return *this;
             }
 
@@ -103,34 +160,80 @@ namespace pensar_digital
 				return generator_assign (mb);
 			}
 
+            inline virtual Object& assign(const Object& o) noexcept
+            {
+                Object::assign (o);
+                restart ();
+                return *this;
+            }
+
+            inline const G& generator_write(MemoryBuffer& mb) const noexcept
+            {
+                object_write (mb);
+                INFO.write (mb);
+                mb.write (generator_data_bytes (), DATA_SIZE);
+                return *this;
+            }
+
+            inline virtual const Object& write_to(MemoryBuffer& mb) const noexcept
+            {
+                return generator_write (mb);
+            }
+
             inline virtual MemoryBuffer::Ptr bytes() const noexcept
             {
-                MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(SIZE);
-				mb->append (object_bytes ());
-                mb->append (INFO.bytes());
-				mb->write ((BytePtr)data (), data_size ());
+                MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(SIZE, IndexMode::NO_INDEX);
+                write_to (*mb);
 				return mb;
             }
 
             inline MemoryBuffer::Ptr generator_bytes() const noexcept
             {
-                MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(SIZE);
-                mb->append(object_bytes()->data (), Object::SIZE);
-                mb->append(INFO.bytes ());
-                mb->write(generator_data_bytes (), DATA_SIZE);
+                MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(SIZE, IndexMode::NO_INDEX);
+                generator_write (*mb);
                 return mb;
             }
-            /// \brief Increments value and return the new value.
+            /// \brief Increments value and return the new value. Thread safe.
             /// \return The new value.
-            inline virtual T get_id () { mdata.mvalue += mdata.mstep; return mdata.mvalue; }
+            inline virtual T get_id ()
+            {
+                if (mblock_size <= 1)
+                    return value ().fetch_add (mdata.mstep, std::memory_order_relaxed) + mdata.mstep;
+                Reservation& r = reservation ();
+                if (r.mremaining == 0)
+                {
+                    r.mnext = value ().fetch_add (mdata.mstep * mblock_size, std::memory_order_relaxed) + mdata.mstep;
+                    r.mremaining = mblock_size;
+                }
+                --r.mremaining;
+                const T id = r.mnext;
+                r.mnext += mdata.mstep;
+                return id;
+            }
 
             /// \brief Gets the next value without incrementing the current one.
             /// \return The next value.
-            inline virtual const T next() { return (mdata.mvalue + mdata.mstep); }
+            inline virtual const T next() { return (current () + mdata.mstep); }
 
             /// \brief Gets the current value.
             /// \return The current value.
-            inline virtual const T current () const { return mdata.mvalue; }
+            inline virtual const T current () const { return value ().load (std::memory_order_relaxed); }
+
+            /// \brief Gets the initial value.
+            inline T initial_value () const noexcept { return mdata.minitial_value; }
+
+            /// \brief Gets the step.
+            inline T step () const noexcept { return mdata.mstep; }
+
+            /// \brief Number of ids each thread reserves at once, 1 (the default) to bump the value on every get_id.
+            /// \param [in] size Ids per block. Set it before the generator is shared by several threads.
+            inline void set_block_size (const T size) noexcept
+            {
+                mblock_size = size < 1 ? 1 : size;
+                restart ();
+            }
+
+            inline T block_size () const noexcept { return mblock_size; }
             
             /// \brief Initialize a Generator.
             /// \param [in] initial_value Initial value for the generator, defaults to 0.
@@ -141,6 +244,8 @@ namespace pensar_digital
                 mdata.minitial_value = initial_value;
                 mdata.mvalue = initial_value;
                 mdata.mstep = step;
+                mblock_size = 1; // A pooled generator is recycled without being destroyed.
+                restart ();
                 return ok;
             }
             
@@ -148,13 +253,14 @@ namespace pensar_digital
 
             /// \brief Set value. Next call to get will get value + 1.
             /// \param val New value to set
-            inline virtual void set_value(T val) { mdata.mvalue = val; }
+            inline virtual void set_value(T val) { value ().store (val, std::memory_order_relaxed); restart (); }
 
             virtual std::istream& binary_read(std::istream& is, const std::endian& byte_order = std::endian::native)
             {
                 Object::binary_read (is, byte_order);
                 INFO.test_class_name_and_version (is, byte_order);
                 is.read((char*)data(), data_size());
+                restart ();
                 return is;
             };
 
@@ -185,6 +291,7 @@ namespace pensar_digital
                 is >> mdata.minitial_value; 
                 is >> mdata.mstep;
                 is >> mdata.mvalue;
+                restart ();
                 return is;
             }
 
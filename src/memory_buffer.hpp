@@ -8,8 +8,9 @@
 #include "concept.hpp"
 
 #include "factory.hpp"
+#include "memory_pool.hpp"
 
-#include <memory> // for std::shared_ptr
+#include <memory> // for std::shared_ptr, std::allocator, std::allocator_traits
 #include <concepts>
 #include <exception>
 #include <string>
@@ -20,6 +21,11 @@
 #include <functional>    // for std::hash
 #include <typeindex>
 #include <span>
+#include <vector>        // for std::vector
+#include <variant>       // for std::variant
+#include <algorithm>     // for std::lower_bound
+#include <fstream>       // for std::ifstream
+#include <stdexcept>     // for std::runtime_error
 
 namespace pd = pensar_digital::cpplib;
 
@@ -27,55 +33,192 @@ namespace pensar_digital
 {
     namespace cpplib
     { 
-        class MemoryBuffer
+        /// \brief Growth policy that multiplies the current capacity by NUM / DEN until the required size fits.
+        /// Appending N records costs O(N) amortized. The default factor is 2.
+        template <size_t NUM = 2, size_t DEN = 1>
+        struct GeometricGrowth
+        {
+            static_assert(NUM > DEN, "GeometricGrowth factor must be greater than 1.");
+
+            static constexpr size_t capacity (const size_t current, const size_t required) noexcept
+            {
+                size_t new_capacity = (current == 0) ? MIN_CAPACITY : current;
+                while (new_capacity < required)
+                    new_capacity = std::max(new_capacity + 1, (new_capacity / DEN) * NUM);
+                return new_capacity;
+            }
+
+            inline static constexpr size_t MIN_CAPACITY = 64; ///< Capacity used when growing an empty buffer.
+        };
+
+        /// \brief Growth policy that allocates exactly the required size. This was the MemoryBuffer behavior before
+        /// growth policies were introduced. Appending N records costs O(N^2). Use it only when memory is very tight.
+        struct ExactGrowth
+        {
+            static constexpr size_t capacity (const size_t /*current*/, const size_t required) noexcept
+            {
+                return required;
+            }
+        };
+
+        /// \brief How a MemoryBuffer keeps track of the size of each element written to it.
+        enum class IndexMode : uint8_t
+        {
+            NO_INDEX,      ///< No index. Only sequential decoding with known sizes (read_known_size) is possible.
+            COMPACT_INDEX, ///< Flat std::vector of (offset, size) pairs sorted by offset, searched with binary search.
+            HASH_INDEX     ///< std::unordered_map from offset to size. One node allocation per element.
+        };
+
+        /// \brief Byte buffer used for binary serialization.
+        /// \tparam Allocator Allocator for the byte storage. Use it to place the buffer in an arena, a pool or an mmap'd region.
+        /// The default PoolAllocator recycles storage through the thread-local SizeClassPool. MemoryBuffer objects
+        /// allocated with new (e.g. std::make_unique) are recycled through the same pool.
+        /// \tparam Growth Policy used to compute the new capacity when a write does not fit. See GeometricGrowth and ExactGrowth.
+        template <class Allocator = PoolAllocator<std::byte>, class Growth = GeometricGrowth<>>
+        class BasicMemoryBuffer
         {
             public:
-                using Offset = size_t;
-                using Ptr    = std::unique_ptr<MemoryBuffer>;
+                using Offset        = size_t;
+                using Ptr           = std::unique_ptr<BasicMemoryBuffer>;
+                using AllocatorType = Allocator;
+                using GrowthType    = Growth;
+                inline static const size_t DEFAULT_SIZE = 1024 * 1024; ///< Default initial capacity in bytes.
             protected:
+                using AllocatorTraits = std::allocator_traits<Allocator>;
+                static_assert(std::is_same_v<typename AllocatorTraits::value_type, std::byte>, "BasicMemoryBuffer allocator must allocate std::byte.");
+
+                [[no_unique_address]] Allocator mallocator; //!< Allocator used for the buffer storage.
                 std::span<std::byte> mbuffer; //!< Buffer.
                 Offset mwrite_offset;         //!< Write offset.
                 Offset mread_offset;          //!< Read offset.
-                std::unordered_map<Offset, size_t> mindex; //!< Returns the element size in bytes at the given offset.
+                using CompactIndex = std::vector<std::pair<Offset, size_t>>;
+                using HashIndex    = std::unordered_map<Offset, size_t>;
+                IndexMode mindex_mode;        //!< Index mode chosen at construction time.
+                size_t mcount;                //!< Number of elements written to the buffer.
+                std::variant<std::monostate, CompactIndex, HashIndex> mindex; //!< Returns the element size in bytes at the given offset.
+
+                /// \brief Records that an element of size bytes was written at offset.
+                inline void index_add (const Offset offset, const size_t size)
+                {
+                    if (size == 0)
+                        return;
+                    switch (mindex_mode)
+                    {
+                        case IndexMode::COMPACT_INDEX:
+                        {
+                            // Writes are sequential so offsets arrive in ascending order and push_back keeps the vector sorted.
+                            std::get<CompactIndex>(mindex).emplace_back(offset, size);
+                            break;
+                        }
+                        case IndexMode::HASH_INDEX:
+                            std::get<HashIndex>(mindex)[offset] = size;
+                            break;
+                        default:
+                            break;
+                    }
+                    ++mcount; // Counted last so a throwing index insert leaves the count alone.
+                }
+
+                /// \brief Returns the size of the element written at offset or 0 if there is none.
+                inline size_t index_size (const Offset offset) const
+                {
+                    switch (mindex_mode)
+                    {
+                        case IndexMode::COMPACT_INDEX:
+                        {
+                            const CompactIndex& index = std::get<CompactIndex>(mindex);
+                            auto it = std::lower_bound(index.begin(), index.end(), offset, [](const std::pair<Offset, size_t>& e, const Offset o) { return e.first < o; });
+                            return (it != index.end() && it->first == offset) ? it->second : 0;
+                        }
+                        case IndexMode::HASH_INDEX:
+                        {
+                            const HashIndex& index = std::get<HashIndex>(mindex);
+                            auto it = index.find(offset);
+                            return (it != index.end()) ? it->second : 0;
+                        }
+                        default:
+                            throw std::runtime_error("MemoryBuffer::read: buffer has no index, use read_known_size.");
+                    }
+                }
+
+                inline void init_index ()
+                {
+                    switch (mindex_mode)
+                    {
+                        case IndexMode::COMPACT_INDEX: mindex.emplace<CompactIndex>(); break;
+                        case IndexMode::HASH_INDEX   : mindex.emplace<HashIndex>   (); break;
+                        default                      : mindex.emplace<std::monostate>(); break;
+                    }
+                }
+
+                /// \brief Allocates a new storage with new_capacity bytes, copies the written data to it and releases the old one.
+                void reallocate (const size_t new_capacity)
+                {
+                    std::byte* new_data = (new_capacity == 0) ? nullptr : AllocatorTraits::allocate(mallocator, new_capacity);
+                    if (mwrite_offset > 0)
+                        memcpy(new_data, mbuffer.data(), mwrite_offset);
+                    release();
+                    mbuffer = std::span<std::byte>(new_data, new_capacity);
+                }
+
+                /// \brief Releases the storage.
+                void release () noexcept
+                {
+                    if (mbuffer.data() != nullptr)
+                        AllocatorTraits::deallocate(mallocator, mbuffer.data(), mbuffer.size());
+                    mbuffer = std::span<std::byte>();
+                }
+
+                /// \brief Grows the buffer according to the growth policy so that size more bytes can be written.
+                inline void ensure_wavailable (const size_t size)
+                {
+                    if (wavailable() < size)
+                        reallocate(Growth::capacity(mbuffer.size(), mwrite_offset + size));
+                }
 
         public:
             /// Default constructor.
-            MemoryBuffer(size_t initial_size = 1024*1024) : mread_offset(0), mwrite_offset(0)
+            /// \param initial_size Initial capacity in bytes.
+            /// \param index_mode How element sizes are indexed. Use NO_INDEX for sequential encode/decode.
+            /// \param allocator Allocator used for the storage.
+            BasicMemoryBuffer(size_t initial_size = DEFAULT_SIZE, IndexMode index_mode = IndexMode::HASH_INDEX, const Allocator& allocator = Allocator()) 
+                : mallocator(allocator), mwrite_offset(0), mread_offset(0), mindex_mode(index_mode), mcount(0)
             {
+                init_index();
                 // Allocate memory.
-                mbuffer = std::span<std::byte>(new std::byte[initial_size], initial_size);
+                reallocate(initial_size);
             }
 
-			MemoryBuffer(BytePtr bp, size_t size) : MemoryBuffer()
+			BasicMemoryBuffer(BytePtr bp, size_t size) : BasicMemoryBuffer(size)
 			{
 				// Copy the data to the buffer.
 				write (bp, size);
 			}
 
-            MemoryBuffer (const Ptr ptr, size_t size)
-                : MemoryBuffer()
+            BasicMemoryBuffer (const Ptr ptr, size_t size)
+                : BasicMemoryBuffer(size)
             {
                 // Copy the data to the buffer.
                 write(ptr->data(), size);
 			}
 
             // Copy constructor.
-			MemoryBuffer(const MemoryBuffer& mb) : MemoryBuffer()
+			BasicMemoryBuffer(const BasicMemoryBuffer& mb) : BasicMemoryBuffer(mb.data_size(), mb.mindex_mode)
 			{
 				// Copy the data to the buffer.
-				write(mb.mbuffer.data(), mb.size());
+				write(mb.mbuffer.data(), mb.data_size());
 			}
 
             // Memory buffer constructor that takes a trivially copyable type as input argument.
 			template <class T> requires std::is_trivially_copyable_v<T>
-            MemoryBuffer(const T* t) : MemoryBuffer()
+            BasicMemoryBuffer(const T* t) : BasicMemoryBuffer(sizeof(T))
             {
                 write(t, sizeof(T));
             }
 
 			// Memory buffer constructor for StdLayoutTriviallyCopyableData types which has no other aggregate objects.
 			template <HasStdLayoutTriviallyCopyableData T>
-			MemoryBuffer(const T& t) : MemoryBuffer()
+			BasicMemoryBuffer(const T& t) : BasicMemoryBuffer(T::DATA_SIZE)
 			{
 				// Write the data to the buffer.
 				write(t.data_bytes(), T::DATA_SIZE);
@@ -83,7 +226,7 @@ namespace pensar_digital
             
             // Memory buffer constructor for StdLayoutTriviallyCopyableData types with default constructors.
             template <HasStdLayoutTriviallyCopyableData T>
-            MemoryBuffer() : MemoryBuffer()
+            BasicMemoryBuffer() : BasicMemoryBuffer(T::DATA_SIZE)
             {
                 // Write the data to the buffer.
 				T t;
@@ -92,7 +235,7 @@ namespace pensar_digital
 
             // += operator for StdLayoutTriviallyCopyableData types.    
 			template <HasStdLayoutTriviallyCopyableData T>
-			MemoryBuffer& operator+=(const T& t)
+			BasicMemoryBuffer& operator+=(const T& t)
 			{
 				write(t.data_bytes(), T::DATA_SIZE);
 				return *this;
@@ -113,17 +256,31 @@ namespace pensar_digital
                 return mread_offset;
 			}
 
+            /// \brief Skips amount bytes of unread data.
+            Offset add_to_read_offset (const Offset& amount)
+            {
+                if (amount > ravailable())
+                    throw std::runtime_error("MemoryBuffer::add_to_read_offset: not enough data in the buffer.");
+                mread_offset += amount;
+                return mread_offset;
+            }
+
             void reset_read_offset ()
             {
                 // Set the read offset to 0.
                 mread_offset = 0;
 			}
 
+            /// \brief Buffers created with new are recycled through the thread-local SizeClassPool.
+            static void* operator new (const size_t size) { return SizeClassPool::allocate(size); }
+
+            static void operator delete (void* p, const size_t size) noexcept { SizeClassPool::deallocate(p, size); }
+
             /** Default destructor */
-            virtual ~MemoryBuffer()
+            virtual ~BasicMemoryBuffer()
             {
                 // Delete the buffer.
-                delete[] mbuffer.data();
+                release();
             }
 
 			/// \brief Returns a BytePtr to the buffer.
@@ -135,8 +292,17 @@ namespace pensar_digital
             /// \brief Returns the buffer size in bytes.
             const size_t size() const noexcept { return mbuffer.size(); }
 
+            /// \brief Returns the buffer capacity in bytes. Same as size().
+            const size_t capacity() const noexcept { return mbuffer.size(); }
+
+            /// \brief Returns a copy of the allocator.
+            Allocator get_allocator() const noexcept { return mallocator; }
+
             /// \brief Returns the number of elements in the buffer.
-            const size_t count() const noexcept { return mindex.size(); }
+            const size_t count() const noexcept { return mcount; }
+
+            /// \brief Returns the index mode chosen at construction time.
+            IndexMode index_mode() const noexcept { return mindex_mode; }
 
             /// \brief Returns the buffer write offset in bytes.
             const Offset woffset() const noexcept { return mwrite_offset; }
@@ -153,27 +319,32 @@ namespace pensar_digital
             /// \brief Available data to read from the buffer.
             const size_t ravailable() const noexcept { return mwrite_offset - mread_offset; }
 
-			/// \brief Write data to the buffer.
-            Offset write(const BytePtr data, const size_t size) noexcept
+            /// \brief Makes sure the buffer can hold at least new_capacity bytes without reallocating.
+            void reserve (const size_t new_capacity)
+            {
+                if (new_capacity > mbuffer.size())
+                    reallocate(new_capacity);
+            }
+
+            /// \brief Releases the unused capacity so that size() == data_size().
+            void shrink_to_fit ()
+            {
+                if (mbuffer.size() > mwrite_offset)
+                    reallocate(mwrite_offset);
+            }
+
+			/// \brief Write data to the buffer. Throws std::bad_alloc if the buffer or its index cannot grow. On
+			/// failure the write offset, count and index are left unchanged.
+            Offset write(const BytePtr data, const size_t size)
             {
                 // Check if there is enough space in the buffer.
-                if (wavailable() < size)
-                {
-                    // Allocate more memory.
-                    auto new_buffer = std::span<std::byte>(new std::byte[mbuffer.size() + size], mbuffer.size() + size);
-                    // Copy the old buffer to the new one.
-                    memcpy(new_buffer.data(), mbuffer.data(), mbuffer.size());
-                    // Delete the old buffer.
-                    delete[] mbuffer.data();
-                    // Update the buffer variable.
-                    mbuffer = new_buffer;
-                }
+                ensure_wavailable(size);
 
                 // Copy the data to the buffer.
                 memcpy(mbuffer.data() + mwrite_offset, data, size);
                 
                 // Update the index.
-                mindex[mwrite_offset] = size;
+                index_add(mwrite_offset, size);
 				Offset offset = mwrite_offset;
                 // Update the offset.
                 mwrite_offset += size;
@@ -182,8 +353,9 @@ namespace pensar_digital
 
             Offset write (std::ifstream& in, const size_t size)
             {
+                ensure_wavailable(size);
                 in.read((char*)(mbuffer.data() + mwrite_offset), size);
-				mindex[mwrite_offset] = size;
+				index_add(mwrite_offset, size);
 				Offset offset = mwrite_offset;
 				mwrite_offset += size;
 				return offset;
@@ -209,7 +381,7 @@ namespace pensar_digital
 
             void read (BytePtr dest, const Offset offset)
             {
-                size_t size = mindex[offset];
+                size_t size = index_size(offset);
 				if (size == 0)
 				{
 					throw std::runtime_error("MemoryBuffer::read: not enough data in the buffer.");
@@ -240,38 +412,34 @@ namespace pensar_digital
                 read(t->data_bytes(), offset, T::DATA_SIZE);
             }
 
-            Offset copy (const MemoryBuffer& mb, const Offset offset = 0)
+            /// \brief Appends the data written to mb (data_size() bytes, not its whole capacity).
+            template <class A, class G>
+            Offset copy (const BasicMemoryBuffer<A, G>& mb, const Offset offset = 0)
 			{
+				const size_t size = mb.data_size();
+
 				// Check if there is enough space in the buffer.
-				if (wavailable() < mb.size())
-				{
-					// Allocate more memory.
-					auto new_buffer = std::span<std::byte>(new std::byte[mbuffer.size() + mb.size()], mbuffer.size() + mb.size());
-					// Copy the old buffer to the new one.
-					memcpy(new_buffer.data(), mbuffer.data(), mbuffer.size());
-					// Delete the old buffer.
-					delete[] mbuffer.data();
-					// Update the buffer variable.
-					mbuffer = new_buffer;
-				}
+				ensure_wavailable(size);
 
                 // Update the index.
-                mindex[mwrite_offset] = mb.size();
+                index_add(mwrite_offset, size);
                 // Copy the data to the buffer.
-				memcpy(mbuffer.data() + mwrite_offset, mb.mbuffer.data(), mb.size());
+				memcpy(mbuffer.data() + mwrite_offset, mb.data(), size);
 
 				// Update the offset.
-				mwrite_offset += mb.size();
+				mwrite_offset += size;
 
 				return offset;
 			}
 
-            inline Offset append (const MemoryBuffer& mb)
+            template <class A, class G>
+            inline Offset append (const BasicMemoryBuffer<A, G>& mb)
             {
                 return copy(mb, mwrite_offset);
             }
 
-			inline Offset append(const MemoryBuffer::Ptr& mb)
+            template <class A, class G>
+			inline Offset append(const std::unique_ptr<BasicMemoryBuffer<A, G>>& mb)
             {
                 if (!mb)
                 {
@@ -286,7 +454,8 @@ namespace pensar_digital
 			}
 
 			// += operator
-            inline Offset operator+=(const MemoryBuffer& mb)
+            template <class A, class G>
+            inline Offset operator+=(const BasicMemoryBuffer<A, G>& mb)
             {
                 return append (mb);
             }
@@ -296,7 +465,10 @@ namespace pensar_digital
 			{
 				return write(t.data_bytes (), T::DATA_SIZE);
 			}
-        }; // MemoryBuffer
+        }; // BasicMemoryBuffer
+
+        /// \brief MemoryBuffer used across the library: PoolAllocator with power of two growth.
+        using MemoryBuffer = BasicMemoryBuffer<>;
 
         // MemoryBufferPtrConvertible concept requires a public method bytes() returning something convertible to MemoryBuffer::Ptr.
         template <typename T>
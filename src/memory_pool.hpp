@@ -0,0 +1,157 @@
+// author : Mauricio Gomes
+// license: MIT (https://opensource.org/licenses/MIT)
+
+#ifndef MEMORY_POOL_HPP
+#define MEMORY_POOL_HPP
+
+#include <array>
+#include <bit>       // for std::bit_width
+#include <cstddef>
+#include <new>       // for ::operator new
+#include <vector>
+
+namespace pensar_digital
+{
+    namespace cpplib
+    {
+        /// \brief Thread-local recycling pool for memory blocks, organized in power of two size classes.
+        ///
+        /// Blocks are obtained one by one from ::operator new and kept in a per thread free list when released,
+        /// so a block allocated by one thread may be safely released by another one. Requests larger than
+        /// MAX_BLOCK_SIZE bypass the pool. Each size class keeps at most MAX_FREE_BYTES_PER_CLASS bytes (at least one block).
+        class SizeClassPool
+        {
+            public:
+                inline static constexpr size_t MIN_BLOCK_SIZE           = 64;          ///< Smallest size class in bytes.
+                inline static constexpr size_t MAX_BLOCK_SIZE           = 1024 * 1024; ///< Largest size class in bytes.
+                inline static constexpr size_t MAX_FREE_BYTES_PER_CLASS = 4 * MAX_BLOCK_SIZE;
+                inline static constexpr size_t CLASS_COUNT = std::bit_width(MAX_BLOCK_SIZE) - std::bit_width(MIN_BLOCK_SIZE) + 1;
+
+                /// \brief Returns the size class index for a block of size bytes. size must be <= MAX_BLOCK_SIZE.
+                static constexpr size_t size_class (const size_t size) noexcept
+                {
+                    return (size <= MIN_BLOCK_SIZE) ? 0 : std::bit_width(size - 1) - std::bit_width(MIN_BLOCK_SIZE - 1);
+                }
+
+                /// \brief Returns the block size in bytes for a size class.
+                static constexpr size_t class_size (const size_t size_class) noexcept { return MIN_BLOCK_SIZE << size_class; }
+
+                /// \brief Returns the pool of the calling thread.
+                static SizeClassPool& instance () noexcept
+                {
+                    thread_local SizeClassPool pool;
+                    return pool;
+                }
+
+                /// \brief Allocates at least size bytes.
+                static void* allocate (const size_t size)
+                {
+                    if (size > MAX_BLOCK_SIZE)
+                        return ::operator new(size);
+                    // After thread exit the block is still rounded up to its class: it may be released on another
+                    // thread and recycled from that thread's free list as a full class_size block.
+                    if (mdestroyed)
+                        return ::operator new(class_size(size_class(size)));
+                    return instance().pop(size_class(size));
+                }
+
+                /// \brief Releases a block previously obtained from allocate with the same size.
+                static void deallocate (void* p, const size_t size) noexcept
+                {
+                    if (p == nullptr)
+                        return;
+                    if (size > MAX_BLOCK_SIZE || mdestroyed)
+                        ::operator delete(p);
+                    else
+                        instance().push(p, size_class(size));
+                }
+
+                /// \brief Number of allocations served from a free list on this thread.
+                size_t hits   () const noexcept { return mhits; }
+
+                /// \brief Number of allocations that had to call ::operator new on this thread.
+                size_t misses () const noexcept { return mmisses; }
+
+                /// \brief Number of free blocks kept for the size class.
+                size_t free_count (const size_t size_class) const noexcept { return mfree[size_class].size(); }
+
+                ~SizeClassPool ()
+                {
+                    mdestroyed = true;
+                    for (auto& list : mfree)
+                        for (void* p : list)
+                            ::operator delete(p);
+                }
+
+            private:
+                SizeClassPool () = default;
+                SizeClassPool (const SizeClassPool&) = delete;
+                SizeClassPool& operator= (const SizeClassPool&) = delete;
+
+                void* pop (const size_t size_class)
+                {
+                    std::vector<void*>& list = mfree[size_class];
+                    if (list.empty())
+                    {
+                        ++mmisses;
+                        return ::operator new(class_size(size_class));
+                    }
+                    ++mhits;
+                    void* p = list.back();
+                    list.pop_back();
+                    return p;
+                }
+
+                void push (void* p, const size_t size_class) noexcept
+                {
+                    std::vector<void*>& list = mfree[size_class];
+                    const size_t max_blocks = (MAX_FREE_BYTES_PER_CLASS / class_size(size_class));
+                    if (list.size() >= max_blocks)
+                    {
+                        ::operator delete(p);
+                        return;
+                    }
+                    try
+                    {
+                        list.push_back(p);
+                    }
+                    catch (...)
+                    {
+                        ::operator delete(p); // Could not grow the free list (bad_alloc): release the block instead.
+                    }
+                }
+
+                std::array<std::vector<void*>, CLASS_COUNT> mfree; //!< Free blocks for each size class.
+                size_t mhits   = 0;
+                size_t mmisses = 0;
+                inline static thread_local bool mdestroyed = false; //!< Set when the thread's pool has been destroyed (thread exit).
+        };
+
+        /// \brief Standard allocator backed by the thread-local SizeClassPool.
+        template <class T>
+        class PoolAllocator
+        {
+            public:
+                using value_type = T;
+
+                PoolAllocator () noexcept = default;
+
+                template <class U>
+                PoolAllocator (const PoolAllocator<U>&) noexcept {}
+
+                T* allocate (const size_t n)
+                {
+                    return static_cast<T*>(SizeClassPool::allocate(n * sizeof(T)));
+                }
+
+                void deallocate (T* p, const size_t n) noexcept
+                {
+                    SizeClassPool::deallocate(p, n * sizeof(T));
+                }
+
+                template <class U>
+                bool operator== (const PoolAllocator<U>&) const noexcept { return true; }
+        };
+    } // namespace cpplib
+} // namespace pensar_digital
+#endif // MEMORY_POOL_HPP
@@ -27,6 +27,10 @@
 #include <cstddef>
 #include <bit>
 #include <cstring>
+#include <array>
+#include <string_view>
+#include <unordered_map>
+#include <type_traits>
 
 #include <bit> // for std::byteswap
 
@@ -55,6 +59,26 @@ namespace pensar_digital
             return l; 
         }
     
+        /// \brief ClassInfo as the legacy format copied it to streams, trailing padding included. Frozen: old streams
+        /// are read with this layout.
+        struct LegacyClassInfo
+        {
+            using Identifier = CS<0, 100>;
+            Identifier mnamespace;
+            Identifier mclass_name;
+            VersionInt mpublic_interface_version;
+            VersionInt mprotected_interface_version;
+            VersionInt mprivate_interface_version;
+        };
+        static_assert(sizeof(C) != 1 || sizeof(LegacyClassInfo) == 210, "LegacyClassInfo must keep the legacy layout");
+        static_assert(sizeof(C) != 2 || sizeof(LegacyClassInfo) == 410, "LegacyClassInfo must keep the legacy layout");
+        static_assert(sizeof(C) != 4 || sizeof(LegacyClassInfo) == 816, "LegacyClassInfo must keep the legacy layout");
+
+        /// \brief Identifies a class and its interface versions.
+        ///
+        /// On the wire a class is identified by its 64-bit fingerprint (ClassInfo::SIZE bytes). The fingerprint's first
+        /// byte in memory is always FINGERPRINT_MARKER, which lets readers tell it apart from the legacy format where the
+        /// whole ClassInfo (LEGACY_SIZE bytes, starting with the namespace characters) was copied to the stream.
         struct ClassInfo
 		{
             inline static const size_t MAX_IDENTIFIER_SIZE = 100; ///< Maximum size for identifier strings.
@@ -64,35 +88,109 @@ namespace pensar_digital
 			VersionInt mpublic_interface_version;
 			VersionInt mprotected_interface_version;
 			VersionInt mprivate_interface_version;
+            Fingerprint mfingerprint; ///< Hash of the fields above. Not part of the legacy layout.
 			inline static const VersionInt NULL_VERSION = -1; ///< Null version constant.
+            inline static constexpr uint8_t FINGERPRINT_MARKER = 0xFF; ///< First byte in memory of every fingerprint.
+            inline static constexpr size_t SIZE = sizeof(Fingerprint); ///< Serialized size of a class tag.
+            inline static constexpr size_t LEGACY_SIZE = sizeof(LegacyClassInfo); ///< Serialized size in the legacy format.
+
+            /// \brief 64-bit FNV-1a fingerprint of a namespace, a class name and its versions. Usable at compile time.
+            ///
+            /// 56 bits come from the hash, the byte that comes first in memory is replaced by FINGERPRINT_MARKER.
+            static constexpr Fingerprint fingerprint (std::basic_string_view<C> ns, std::basic_string_view<C> cn, VersionInt pub_ver, VersionInt pro_ver, VersionInt pri_ver) noexcept
+            {
+                Fingerprint h = 14695981039346656037ull;
+                auto mix = [&h](const uint64_t v) { h ^= v; h *= 1099511628211ull; };
+                for (const C c : ns)
+                    mix(static_cast<std::make_unsigned_t<C>>(c));
+                mix(0);
+                for (const C c : cn)
+                    mix(static_cast<std::make_unsigned_t<C>>(c));
+                mix(0);
+                mix(static_cast<uint16_t>(pub_ver));
+                mix(static_cast<uint16_t>(pro_ver));
+                mix(static_cast<uint16_t>(pri_ver));
+                if constexpr (std::endian::native == std::endian::little)
+                    return (h << 8) | FINGERPRINT_MARKER;
+                else
+                    return (h >> 8) | (static_cast<Fingerprint>(FINGERPRINT_MARKER) << 56);
+            }
 
             ClassInfo(const S& ns = EMPTY, const S& cn = EMPTY, VersionInt pub_ver = NULL_VERSION, VersionInt pro_ver = NULL_VERSION, VersionInt pri_ver = NULL_VERSION) noexcept
                 : mnamespace  (ns), 
                     mclass_name (cn), 
                     mpublic_interface_version    (pub_ver),
 					mprotected_interface_version (pro_ver), 
-                    mprivate_interface_version   (pri_ver) {}
+                    mprivate_interface_version   (pri_ver) 
+            {
+                update_fingerprint();
+            }
+
+            /// \brief Size of the legacy serialized format.
+            static constexpr size_t legacy_size () noexcept { return LEGACY_SIZE; }
+
+            /// \brief True if first is the first byte of a compact class tag.
+            static constexpr bool is_compact (const std::byte first) noexcept { return first == std::byte{ FINGERPRINT_MARKER }; }
+
+            /// \brief Recomputes mfingerprint from the names and versions.
+            inline void update_fingerprint () noexcept
+            {
+                mfingerprint = fingerprint(view(mnamespace), view(mclass_name), mpublic_interface_version, mprotected_interface_version, mprivate_interface_version);
+            }
 
+            /// \brief Writes the compact class tag.
             inline void write (MemoryBuffer& mb) const noexcept
             {
-                mb.write((BytePtr)this, sizeof(ClassInfo));
+                mb.write((BytePtr)&mfingerprint, SIZE);
 			}
 
+            /// \brief Writes the full names and versions in the legacy format.
+            inline void write_full (MemoryBuffer& mb) const noexcept
+            {
+                const LegacyClassInfo l = legacy();
+                mb.write((BytePtr)&l, LEGACY_SIZE);
+            }
+
+            /// \brief Reads a class tag in either format. A compact tag only restores mfingerprint.
             inline void read (MemoryBuffer& mb) 
             {
-                mb.read_known_size((BytePtr)this, sizeof(ClassInfo));
+                if (mb.ravailable() < SIZE)
+                    log_throw(W("MemoryBuffer has not enough data for a class tag."));
+                if (is_compact(mb.data()[mb.roffset()]))
+                {
+                    *this = ClassInfo();
+                    mb.read_known_size((BytePtr)&mfingerprint, SIZE);
+                }
+                else
+                    read_full(mb);
 			}
 
+            /// \brief Reads the full names and versions written in the legacy format.
+            inline void read_full (MemoryBuffer& mb)
+            {
+                LegacyClassInfo l;
+                mb.read_known_size((BytePtr)&l, LEGACY_SIZE);
+                assign(l);
+            }
+
+            /// \brief Reads a class tag in either format and returns its fingerprint.
+            static Fingerprint read_fingerprint (MemoryBuffer& mb)
+            {
+                ClassInfo info;
+                info.read(mb);
+                return info.mfingerprint;
+            }
+
             MemoryBuffer::Ptr bytes() const noexcept
             {
-                MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(sizeof(ClassInfo));
+                MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(SIZE, IndexMode::NO_INDEX);
                 write(*mb);
                 return mb;
             }
 
             inline bool operator==(const ClassInfo& other) const noexcept
             {
-                return equal<ClassInfo> (*this, other);
+                return mfingerprint == other.mfingerprint;
             }
 
             inline bool operator!=(const ClassInfo& other) const noexcept
@@ -102,13 +200,7 @@ namespace pensar_digital
 
             inline void test_class_name_and_version(MemoryBuffer& mb) const
             {
-                if (mb.size() < sizeof(ClassInfo))
-                    log_throw(W("MemoryBuffer size is smaller than ClassInfo size."));
-                
-                ClassInfo info;
-                info.read   (mb);
-                
-                if (info != *this)
+                if (read_fingerprint(mb) != mfingerprint)
                     log_throw(W("Version mismatch."));
 			}
 
@@ -122,14 +214,40 @@ namespace pensar_digital
                 return ss.str();
 			}
 
+            /// \brief Reads a class tag in either format. A compact tag only restores mfingerprint.
             inline std::istream& binary_read(std::istream& is, const std::endian& byte_order)
             {
-                return is.read((char*)(this), sizeof(ClassInfo));
+                const auto first = is.peek();
+                if (first == std::char_traits<char>::eof())
+                    log_throw(W("Stream has not enough data for a class tag."));
+                if (is_compact(static_cast<std::byte>(first)))
+                {
+                    *this = ClassInfo();
+                    return is.read((char*)&mfingerprint, SIZE);
+                }
+                return binary_read_full(is);
             }
 
+            /// \brief Writes the compact class tag.
             inline std::ostream& binary_write(std::ostream& os, const std::endian& byte_order) const
             {
-                return os.write((const char*) this, sizeof(ClassInfo));
+                return os.write((const char*)&mfingerprint, SIZE);
+            }
+
+            /// \brief Reads the full names and versions written in the legacy format.
+            inline std::istream& binary_read_full (std::istream& is)
+            {
+                LegacyClassInfo l;
+                is.read((char*)&l, LEGACY_SIZE);
+                assign(l);
+                return is;
+            }
+
+            /// \brief Writes the full names and versions in the legacy format.
+            inline std::ostream& binary_write_full (std::ostream& os) const
+            {
+                const LegacyClassInfo l = legacy();
+                return os.write((const char*)&l, LEGACY_SIZE);
             }
 
             inline void test_class_name_and_version (std:: istream& is, const std::endian& byte_order = std::endian::native) const
@@ -139,9 +257,135 @@ namespace pensar_digital
                 if (info != *this)
                     log_throw(W("Version mismatch."));
 			}
+
+        private:
+            static_assert(std::is_same_v<Identifier, LegacyClassInfo::Identifier>);
+
+            /// \brief The names and versions in the legacy layout, padding zeroed.
+            LegacyClassInfo legacy () const noexcept
+            {
+                LegacyClassInfo l;
+                std::memset((void*)&l, 0, LEGACY_SIZE);
+                l.mnamespace                   = mnamespace;
+                l.mclass_name                  = mclass_name;
+                l.mpublic_interface_version    = mpublic_interface_version;
+                l.mprotected_interface_version = mprotected_interface_version;
+                l.mprivate_interface_version   = mprivate_interface_version;
+                return l;
+            }
+
+            void assign (const LegacyClassInfo& l) noexcept
+            {
+                mnamespace                   = l.mnamespace;
+                mclass_name                  = l.mclass_name;
+                mpublic_interface_version    = l.mpublic_interface_version;
+                mprotected_interface_version = l.mprotected_interface_version;
+                mprivate_interface_version   = l.mprivate_interface_version;
+                update_fingerprint();
+            }
+
+            static std::basic_string_view<C> view (const Identifier& id) noexcept
+            {
+                const auto end = std::find(id.data.begin(), id.data.end(), C(0));
+                return std::basic_string_view<C>(id.data.data(), end - id.data.begin());
+            }
         };
 
         static_assert(StdLayoutTriviallyCopyable<ClassInfo>, W("ClassInfo must be a trivially copyable type"));
+
+        /// \brief Maps class fingerprints back to their full names and versions.
+        ///
+        /// It may be written as an optional header in front of a stream of compact class tags:
+        /// MAGIC, the number of entries (size_t) and each ClassInfo in the legacy format.
+        class ClassDictionary
+        {
+            public:
+                /// \brief Header signature. Its first byte is neither FINGERPRINT_MARKER nor a plausible namespace character.
+                inline static constexpr std::array<char, 8> MAGIC = { '\xFE', 'P', 'D', 'C', 'L', 'D', 'I', 'C' };
+
+                /// \brief Adds info. Returns false if its fingerprint was already there.
+                bool add (const ClassInfo& info) { return mclasses.emplace(info.mfingerprint, info).second; }
+
+                /// \brief Returns the class with the fingerprint or nullptr if it is unknown.
+                const ClassInfo* find (const Fingerprint fingerprint) const noexcept
+                {
+                    const auto it = mclasses.find(fingerprint);
+                    return (it == mclasses.end()) ? nullptr : &it->second;
+                }
+
+                size_t size () const noexcept { return mclasses.size(); }
+
+                /// \brief Size in bytes of the header written by write.
+                size_t header_size () const noexcept { return MAGIC.size() + sizeof(size_t) + mclasses.size() * ClassInfo::legacy_size(); }
+
+                /// \brief True if the unread data in mb starts with a dictionary header.
+                static bool has_header (const MemoryBuffer& mb) noexcept
+                {
+                    return (mb.ravailable() >= MAGIC.size()) && (std::memcmp(mb.data() + mb.roffset(), MAGIC.data(), MAGIC.size()) == 0);
+                }
+
+                /// \brief Writes the dictionary header.
+                void write (MemoryBuffer& mb) const noexcept
+                {
+                    const size_t count = mclasses.size();
+                    mb.write((BytePtr)MAGIC.data(), MAGIC.size());
+                    mb.write((BytePtr)&count, sizeof(count));
+                    for (const auto& [fingerprint, info] : mclasses)
+                        info.write_full(mb);
+                }
+
+                /// \brief Reads a dictionary header if there is one at the read offset, adding its entries. Returns true if a header was read.
+                bool read (MemoryBuffer& mb)
+                {
+                    if (!has_header(mb))
+                        return false;
+                    std::array<char, 8> magic;
+                    mb.read_known_size((BytePtr)magic.data(), magic.size());
+                    size_t count;
+                    mb.read_known_size((BytePtr)&count, sizeof(count));
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        ClassInfo info;
+                        info.read_full(mb);
+                        add(info);
+                    }
+                    return true;
+                }
+
+                /// \brief Writes the dictionary header to a stream.
+                std::ostream& binary_write (std::ostream& os) const
+                {
+                    const size_t count = mclasses.size();
+                    os.write(MAGIC.data(), MAGIC.size());
+                    os.write((const char*)&count, sizeof(count));
+                    for (const auto& [fingerprint, info] : mclasses)
+                        info.binary_write_full(os);
+                    return os;
+                }
+
+                /// \brief Reads a dictionary header if the stream starts with one. Returns true if a header was read.
+                bool binary_read (std::istream& is)
+                {
+                    if (is.peek() != static_cast<unsigned char>(MAGIC[0]))
+                        return false;
+                    std::array<char, 8> magic;
+                    is.read(magic.data(), magic.size());
+                    if (magic != MAGIC)
+                        log_throw(W("Invalid class dictionary header."));
+                    size_t count;
+                    is.read((char*)&count, sizeof(count));
+                    for (size_t i = 0; i < count && is; ++i)
+                    {
+                        ClassInfo info;
+                        info.binary_read_full(is);
+                        add(info);
+                    }
+                    return true;
+                }
+
+            private:
+                std::unordered_map<Fingerprint, ClassInfo> mclasses;
+        };
         
         template<typename T>
         concept HasClassInfo = requires
@@ -187,10 +431,10 @@ namespace pensar_digital
             virtual const BytePtr data_bytes() const noexcept { return (BytePtr)&this->mdata; }
 
             inline static constexpr size_t DATA_SIZE = sizeof(mdata);
-            inline static constexpr size_t      SIZE = DATA_SIZE + sizeof(ClassInfo);
+            inline static constexpr size_t      SIZE = DATA_SIZE + ClassInfo::SIZE;
 
             virtual size_t data_size() const noexcept { return sizeof(this->mdata); }
-            virtual size_t size() const noexcept { return data_size() + sizeof(ClassInfo); }
+            virtual size_t size() const noexcept { return data_size() + ClassInfo::SIZE; }
         protected:
             /// Set id
             /// \param val New value to set
@@ -269,18 +513,27 @@ namespace pensar_digital
             }
             */
 
+            /// \brief Serializes the whole object into mb in a single pass. Derived classes override it to append
+            /// their own ClassInfo and data after calling their parent's write_to, so nested objects are written
+            /// straight into the caller's buffer without intermediate buffers.
+            inline virtual const Object& write_to(MemoryBuffer& mb) const noexcept
+            {
+                return object_write(mb);
+            }
+
             inline MemoryBuffer::Ptr object_bytes() const noexcept
             {
-                MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(SIZE);
-                mb->append((BytePtr)&INFO, sizeof(ClassInfo));
-                mb->append((BytePtr)(&mdata), DATA_SIZE);
+                MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(SIZE, IndexMode::NO_INDEX);
+                object_write(*mb);
                 return mb;
             }
 
             /// \brief Returns a MemoryBuffer::Ptr with the object data.
             inline virtual MemoryBuffer::Ptr bytes() const noexcept
             {
-               return object_bytes ();
+                MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(SIZE, IndexMode::NO_INDEX);
+                write_to(*mb);
+                return mb;
             }
 
             // Implicit convertion to MemoryBuffer::Ptr.
@@ -322,9 +575,10 @@ namespace pensar_digital
             // Clone method. 
             inline Object::Ptr clone() const noexcept { return pd::clone<Object>(*this, mdata.mid); }
 
+            /// \brief Returns a new object owned by the caller. Pooled objects go back to mfactory when released, so they are not used here.
             inline virtual Object* get_obj() const noexcept
             {
-                return ((Object*)(&(*(mfactory.get(NULL_DATA)))));
+                return new Object(NULL_DATA);
             }
 
             /*inline virtual Object* clone() const noexcept
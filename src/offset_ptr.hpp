@@ -0,0 +1,592 @@
+// author : Mauricio Gomes
+// license: MIT (https://opensource.org/licenses/MIT)
+
+#ifndef OFFSET_PTR_HPP
+#define OFFSET_PTR_HPP
+
+#include <array>
+#include <bit>           // for std::bit_width
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>           // for std::bad_alloc
+#include <span>
+#include <stdexcept>     // for std::runtime_error
+#include <string_view>
+#include <type_traits>
+#include <utility>       // for std::move
+
+namespace pensar_digital
+{
+    namespace cpplib
+    {
+        /// \brief Pointer stored as the distance from its own address to the pointee.
+        ///
+        /// When a region holding both the pointer and the pointee is mapped at another address (e.g. a block reopened by
+        /// ThreadBlockAllocator::load_block) the pointer is still valid. Copying recomputes the distance for the new
+        /// address, so OffsetPtr is not trivially copyable. A distance of 1 stands for nullptr, as no T can start one byte
+        /// after an OffsetPtr pointing to it.
+        template <class T>
+        class OffsetPtr
+        {
+            public:
+                using element_type    = T;
+                using difference_type = std::ptrdiff_t;
+
+                OffsetPtr () noexcept = default;
+                OffsetPtr (std::nullptr_t) noexcept {}
+                OffsetPtr (T* p) noexcept { set(p); }
+                OffsetPtr (const OffsetPtr& other) noexcept { set(other.get()); }
+
+                template <class U>
+                    requires std::is_convertible_v<U*, T*>
+                OffsetPtr (const OffsetPtr<U>& other) noexcept { set(other.get()); }
+
+                OffsetPtr& operator= (const OffsetPtr& other) noexcept { set(other.get()); return *this; }
+                OffsetPtr& operator= (T* p) noexcept { set(p); return *this; }
+                OffsetPtr& operator= (std::nullptr_t) noexcept { moffset = NULL_OFFSET; return *this; }
+
+                T* get () const noexcept
+                {
+                    if (moffset == NULL_OFFSET)
+                        return nullptr;
+                    return reinterpret_cast<T*>(const_cast<char*>(reinterpret_cast<const char*>(this)) + moffset);
+                }
+
+                template <class U = T>
+                    requires (!std::is_void_v<U>)
+                U& operator*  () const noexcept { return *get(); }
+                T* operator-> () const noexcept { return get(); }
+
+                template <class U = T>
+                    requires (!std::is_void_v<U>)
+                U& operator[] (const difference_type i) const noexcept { return get()[i]; }
+
+                explicit operator bool () const noexcept { return moffset != NULL_OFFSET; }
+
+                bool operator== (const OffsetPtr& other) const noexcept { return get() == other.get(); }
+                bool operator== (std::nullptr_t) const noexcept { return moffset == NULL_OFFSET; }
+
+                OffsetPtr& operator+= (const difference_type n) noexcept { set(get() + n); return *this; }
+                OffsetPtr& operator++ () noexcept { return *this += 1; }
+
+            private:
+                inline static constexpr std::ptrdiff_t NULL_OFFSET = 1;
+
+                void set (T* p) noexcept
+                {
+                    moffset = (p == nullptr) ? NULL_OFFSET
+                                             : reinterpret_cast<const char*>(p) - reinterpret_cast<const char*>(this);
+                }
+
+                std::ptrdiff_t moffset = NULL_OFFSET; //!< Distance in bytes from this to the pointee.
+        };
+
+        class OffsetHeap;
+
+        /// \brief T is built in an OffsetHeap by passing the heap before Args. Moves and copies of T are not.
+        template <class T, class... Args>
+        concept TakesOffsetHeap = std::is_constructible_v<T, OffsetHeap&, Args...>
+                                  && !(sizeof...(Args) == 1 && (std::is_same_v<std::remove_cvref_t<Args>, T> && ...));
+
+        /// \brief Memory manager living at the start of a memory region, whose whole state is kept in the region.
+        ///
+        /// Objects built in the heap that only use OffsetPtr, OffsetVector, OffsetString and OffsetHashMap to refer to
+        /// each other can be saved with the region and used right after it is mapped again, at any address, with no
+        /// deserialization. Blocks are ALIGNMENT aligned and come in power of two size classes, each with a free list,
+        /// so freed memory (e.g. the old storage of a growing vector) is reused. The heap is not thread safe.
+        ///
+        /// With ThreadBlockAllocator:
+        ///     ThreadBlockAllocator<OffsetHeap::Page> pages;
+        ///     pages.add_thread_block(1024 * sizeof(OffsetHeap::Page), "heap.dat");
+        ///     OffsetHeap* heap = OffsetHeap::create(std::span(pages.allocate(1024), 1024));
+        ///     ...
+        ///     pages.mark_dirty(pages.block_objects(0).data(), 1024); // The heap does not flag the pages it writes.
+        ///     pages.save().get();
+        /// and, in another process:
+        ///     pages.load_block("heap.dat");
+        ///     OffsetHeap* heap = OffsetHeap::open(pages.block_objects(0));
+        class OffsetHeap
+        {
+            public:
+                inline static constexpr size_t ALIGNMENT = alignof(std::max_align_t);
+                inline static constexpr size_t MIN_BLOCK_SIZE = 16;
+                inline static constexpr size_t CLASS_COUNT = 48;
+                inline static constexpr uint64_t MAGIC = 0x50414548544553ull; // "SETHEAP"
+
+                /// \brief Unit to allocate a heap region from a typed allocator, such as ThreadBlockAllocator.
+                struct alignas(ALIGNMENT) Page
+                {
+                    std::byte mbytes[4096];
+                };
+
+                /// \brief Builds an empty heap over [memory, memory + size). memory must be ALIGNMENT aligned.
+                static OffsetHeap* create (void* memory, const size_t size)
+                {
+                    if (size < sizeof(OffsetHeap) || reinterpret_cast<std::uintptr_t>(memory) % ALIGNMENT != 0)
+                        throw std::runtime_error("OffsetHeap: region too small or misaligned.");
+                    return new (memory) OffsetHeap(size);
+                }
+
+                static OffsetHeap* create (const std::span<Page> pages) { return create(pages.data(), pages.size_bytes()); }
+
+                /// \brief Returns the heap previously created at memory, possibly at another address.
+                static OffsetHeap* open (void* memory, const size_t size)
+                {
+                    OffsetHeap* heap = std::launder(static_cast<OffsetHeap*>(memory));
+                    if (size < sizeof(OffsetHeap) || heap->mmagic != MAGIC || heap->msize != size || heap->mused > size)
+                        throw std::runtime_error("OffsetHeap: no heap in the region.");
+                    return heap;
+                }
+
+                static OffsetHeap* open (const std::span<Page> pages) { return open(pages.data(), pages.size_bytes()); }
+
+                /// \brief Size class of a block of size bytes.
+                static constexpr size_t size_class (const size_t size) noexcept
+                {
+                    return (size <= MIN_BLOCK_SIZE) ? 0 : std::bit_width(size - 1) - std::bit_width(MIN_BLOCK_SIZE - 1);
+                }
+
+                static constexpr size_t class_size (const size_t size_class) noexcept { return MIN_BLOCK_SIZE << size_class; }
+
+                /// \brief Allocates size bytes aligned to ALIGNMENT. Throws std::bad_alloc when the region is full.
+                void* allocate (const size_t size)
+                {
+                    const size_t c = size_class(size);
+                    if (c >= CLASS_COUNT)
+                        throw std::bad_alloc();
+                    if (FreeBlock* block = mfree[c].get())
+                    {
+                        mfree[c] = block->mnext;
+                        return block;
+                    }
+                    const size_t bytes = class_size(c);
+                    if (bytes > msize - mused)
+                        throw std::bad_alloc();
+                    void* p = reinterpret_cast<char*>(this) + mused;
+                    mused += bytes;
+                    return p;
+                }
+
+                /// \brief Returns a block obtained from allocate with the same size to its free list.
+                void deallocate (void* p, const size_t size) noexcept
+                {
+                    if (p == nullptr)
+                        return;
+                    const size_t c = size_class(size);
+                    FreeBlock* block = new (p) FreeBlock;
+                    block->mnext = mfree[c];
+                    mfree[c] = block;
+                }
+
+                /// \brief Allocates and constructs a T. The heap is passed as first argument when T takes it.
+                template <class T, class... Args>
+                T* construct (Args&&... args)
+                {
+                    static_assert(alignof(T) <= ALIGNMENT, "OffsetHeap: alignment not supported.");
+                    void* p = allocate(sizeof(T));
+                    try
+                    {
+                        if constexpr (TakesOffsetHeap<T, Args...>)
+                            return new (p) T(*this, std::forward<Args>(args)...);
+                        else
+                            return new (p) T(std::forward<Args>(args)...);
+                    }
+                    catch (...)
+                    {
+                        deallocate(p, sizeof(T));
+                        throw;
+                    }
+                }
+
+                template <class T>
+                void destroy (T* p) noexcept
+                {
+                    if (p == nullptr)
+                        return;
+                    p->~T();
+                    deallocate(p, sizeof(T));
+                }
+
+                /// \brief Object from which the rest of the heap is reached.
+                template <class T>
+                T* root () const noexcept { return static_cast<T*>(mroot.get()); }
+
+                void set_root (void* p) noexcept { mroot = p; }
+
+                bool contains (const void* p) const noexcept
+                {
+                    const char* q = static_cast<const char*>(p);
+                    return q >= reinterpret_cast<const char*>(this) && q < reinterpret_cast<const char*>(this) + msize;
+                }
+
+                size_t size      () const noexcept { return msize; }
+                size_t used      () const noexcept { return mused; }
+                size_t available () const noexcept { return msize - mused; }
+
+            private:
+                struct FreeBlock
+                {
+                    OffsetPtr<FreeBlock> mnext;
+                };
+
+                explicit OffsetHeap (const size_t size) noexcept : msize(size)
+                {
+                    mused = (sizeof(OffsetHeap) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+                }
+
+                OffsetHeap (const OffsetHeap&) = delete;
+                OffsetHeap& operator= (const OffsetHeap&) = delete;
+
+                uint64_t mmagic = MAGIC;
+                uint64_t msize;  //!< Region size in bytes, including this header.
+                uint64_t mused;  //!< Offset of the first byte never allocated.
+                OffsetPtr<void> mroot;
+                std::array<OffsetPtr<FreeBlock>, CLASS_COUNT> mfree; //!< Free blocks of each size class.
+        };
+
+        /// \brief Hash with the same result in every process and build, so hash tables can be persisted.
+        /// Strings (anything with view() or convertible to std::string_view) hash their characters, other trivially
+        /// copyable types their bytes. FNV-1a 64.
+        struct OffsetHash
+        {
+            static constexpr uint64_t hash_bytes (const void* data, const size_t size, uint64_t h = 14695981039346656037ull) noexcept
+            {
+                const unsigned char* p = static_cast<const unsigned char*>(data);
+                for (size_t i = 0; i < size; ++i)
+                    h = (h ^ p[i]) * 1099511628211ull;
+                return h;
+            }
+
+            template <class K>
+            uint64_t operator() (const K& key) const noexcept
+            {
+                if constexpr (requires { key.view(); })
+                    return (*this)(key.view());
+                else if constexpr (std::is_convertible_v<const K&, std::string_view>)
+                {
+                    const std::string_view s = key;
+                    return hash_bytes(s.data(), s.size());
+                }
+                else
+                {
+                    static_assert(std::is_trivially_copyable_v<K>, "OffsetHash: key must be a string or trivially copyable.");
+                    return hash_bytes(&key, sizeof(K));
+                }
+            }
+        };
+
+        /// \brief std::vector like sequence whose storage is in an OffsetHeap. The vector itself must live in the same heap
+        /// (see OffsetHeap::construct) for the whole structure to be relocatable.
+        template <class T>
+        class OffsetVector
+        {
+            public:
+                using value_type = T;
+                using iterator = T*;
+                using const_iterator = const T*;
+
+                explicit OffsetVector (OffsetHeap& heap) noexcept : mheap(&heap) {}
+
+                OffsetVector (OffsetVector&& other) noexcept
+                    : mheap(other.mheap), mdata(other.mdata), msize(other.msize), mcapacity(other.mcapacity)
+                {
+                    other.mdata = nullptr;
+                    other.msize = other.mcapacity = 0;
+                }
+
+                OffsetVector (const OffsetVector&) = delete;
+                OffsetVector& operator= (const OffsetVector&) = delete;
+
+                ~OffsetVector ()
+                {
+                    clear();
+                    mheap->deallocate(mdata.get(), mcapacity * sizeof(T));
+                }
+
+                size_t size     () const noexcept { return msize; }
+                size_t capacity () const noexcept { return mcapacity; }
+                bool   empty    () const noexcept { return msize == 0; }
+                OffsetHeap& heap () const noexcept { return *mheap; }
+
+                T*       data  ()       noexcept { return mdata.get(); }
+                const T* data  () const noexcept { return mdata.get(); }
+                T*       begin ()       noexcept { return data(); }
+                T*       end   ()       noexcept { return data() + msize; }
+                const T* begin () const noexcept { return data(); }
+                const T* end   () const noexcept { return data() + msize; }
+                T&       operator[] (const size_t i)       noexcept { return data()[i]; }
+                const T& operator[] (const size_t i) const noexcept { return data()[i]; }
+                T&       back  ()       noexcept { return data()[msize - 1]; }
+
+                void reserve (const size_t capacity)
+                {
+                    if (capacity <= mcapacity)
+                        return;
+                    T* storage = static_cast<T*>(mheap->allocate(capacity * sizeof(T)));
+                    T* old = data();
+                    for (size_t i = 0; i < msize; ++i)
+                    {
+                        new (storage + i) T(std::move(old[i]));
+                        old[i].~T();
+                    }
+                    mheap->deallocate(old, mcapacity * sizeof(T));
+                    mdata = storage;
+                    mcapacity = capacity;
+                }
+
+                /// \brief Constructs an element at the end. Elements taking an OffsetHeap& first receive the vector's heap.
+                template <class... Args>
+                T& emplace_back (Args&&... args)
+                {
+                    if (msize == mcapacity)
+                        reserve(mcapacity == 0 ? 4 : mcapacity * 2);
+                    T* p = data() + msize;
+                    if constexpr (TakesOffsetHeap<T, Args...>)
+                        new (p) T(*mheap, std::forward<Args>(args)...);
+                    else
+                        new (p) T(std::forward<Args>(args)...);
+                    ++msize;
+                    return *p;
+                }
+
+                void push_back (const T& value) { emplace_back(value); }
+                void push_back (T&& value) { emplace_back(std::move(value)); }
+
+                void pop_back () noexcept { data()[--msize].~T(); }
+
+                void clear () noexcept
+                {
+                    while (msize > 0)
+                        pop_back();
+                }
+
+            private:
+                OffsetPtr<OffsetHeap> mheap;
+                OffsetPtr<T> mdata;
+                size_t msize = 0;
+                size_t mcapacity = 0;
+        };
+
+        /// \brief Null terminated string whose characters are in an OffsetHeap.
+        class OffsetString
+        {
+            public:
+                explicit OffsetString (OffsetHeap& heap) noexcept : mchars(heap) {}
+
+                OffsetString (OffsetHeap& heap, const std::string_view s) : mchars(heap) { assign(s); }
+
+                OffsetString (OffsetString&& other) noexcept = default;
+
+                OffsetString& assign (const std::string_view s)
+                {
+                    mchars.clear();
+                    return append(s);
+                }
+
+                OffsetString& append (const std::string_view s)
+                {
+                    if (!mchars.empty())
+                        mchars.pop_back(); // Terminator.
+                    mchars.reserve(mchars.size() + s.size() + 1);
+                    for (const char c : s)
+                        mchars.push_back(c);
+                    mchars.push_back('\0');
+                    return *this;
+                }
+
+                OffsetString& operator= (const std::string_view s) { return assign(s); }
+
+                size_t size () const noexcept { return mchars.empty() ? 0 : mchars.size() - 1; }
+                bool empty () const noexcept { return size() == 0; }
+                const char* c_str () const noexcept { return mchars.empty() ? "" : mchars.data(); }
+                std::string_view view () const noexcept { return std::string_view(c_str(), size()); }
+                operator std::string_view () const noexcept { return view(); }
+
+                bool operator== (const std::string_view s) const noexcept { return view() == s; }
+                bool operator== (const OffsetString& other) const noexcept { return view() == other.view(); }
+
+            private:
+                OffsetVector<char> mchars;
+        };
+
+        /// \brief Open addressing (linear probing) hash map whose slots are in an OffsetHeap.
+        ///
+        /// Keys and values taking an OffsetHeap& as first constructor argument (e.g. OffsetString) receive the map's heap.
+        /// find and contains accept any key type Hash and K::operator== accept, e.g. std::string_view for OffsetString.
+        template <class K, class V, class Hash = OffsetHash>
+        class OffsetHashMap
+        {
+            public:
+                struct Entry
+                {
+                    K first;
+                    V second;
+                };
+
+                explicit OffsetHashMap (OffsetHeap& heap) noexcept : mheap(&heap) {}
+
+                OffsetHashMap (const OffsetHashMap&) = delete;
+                OffsetHashMap& operator= (const OffsetHashMap&) = delete;
+
+                ~OffsetHashMap ()
+                {
+                    for_each([](Entry& e) { e.~Entry(); });
+                    release(mstates.get(), mentries.get(), mcapacity);
+                }
+
+                size_t size  () const noexcept { return msize; }
+                bool   empty () const noexcept { return msize == 0; }
+
+                template <class Key>
+                V* find (const Key& key) noexcept
+                {
+                    const size_t i = slot_of(key);
+                    return (i == NPOS) ? nullptr : &mentries[i].second;
+                }
+
+                template <class Key>
+                const V* find (const Key& key) const noexcept { return const_cast<OffsetHashMap*>(this)->find(key); }
+
+                template <class Key>
+                bool contains (const Key& key) const noexcept { return find(key) != nullptr; }
+
+                /// \brief Inserts key with value, or assigns value to the existing key. Returns the stored value.
+                template <class Key, class Value>
+                V& insert_or_assign (const Key& key, Value&& value)
+                {
+                    if (V* existing = find(key))
+                    {
+                        *existing = std::forward<Value>(value);
+                        return *existing;
+                    }
+                    if ((msize + mtombstones + 1) * 10 > mcapacity * 7)
+                        rehash(mcapacity == 0 ? 16 : (msize + 1) * 10 / 7 * 2);
+                    size_t i = mix(Hash{}(key)) & (mcapacity - 1);
+                    while (mstates[i] == FULL)
+                        i = (i + 1) & (mcapacity - 1);
+                    if (mstates[i] == TOMBSTONE)
+                        --mtombstones;
+                    Entry* e = &mentries[i];
+                    construct_part(&e->first, key);
+                    try
+                    {
+                        construct_part(&e->second, std::forward<Value>(value));
+                    }
+                    catch (...)
+                    {
+                        e->first.~K();
+                        throw;
+                    }
+                    mstates[i] = FULL;
+                    ++msize;
+                    return e->second;
+                }
+
+                template <class Key>
+                bool erase (const Key& key) noexcept
+                {
+                    const size_t i = slot_of(key);
+                    if (i == NPOS)
+                        return false;
+                    mentries[i].~Entry();
+                    mstates[i] = TOMBSTONE;
+                    --msize;
+                    ++mtombstones;
+                    return true;
+                }
+
+                /// \brief Calls f(Entry&) for each entry, in slot order.
+                template <class F>
+                void for_each (F&& f)
+                {
+                    for (size_t i = 0; i < mcapacity; ++i)
+                        if (mstates[i] == FULL)
+                            f(mentries[i]);
+                }
+
+            private:
+                inline static constexpr uint8_t EMPTY = 0, FULL = 1, TOMBSTONE = 2;
+                inline static constexpr size_t NPOS = static_cast<size_t>(-1);
+
+                static constexpr size_t mix (uint64_t h) noexcept
+                {
+                    h ^= h >> 33;
+                    h *= 0xff51afd7ed558ccdull;
+                    h ^= h >> 33;
+                    return static_cast<size_t>(h);
+                }
+
+                template <class Part, class Arg>
+                void construct_part (Part* p, Arg&& arg)
+                {
+                    if constexpr (TakesOffsetHeap<Part, Arg>)
+                        new (p) Part(*mheap, std::forward<Arg>(arg));
+                    else
+                        new (p) Part(std::forward<Arg>(arg));
+                }
+
+                template <class Key>
+                size_t slot_of (const Key& key) const noexcept
+                {
+                    if (msize == 0)
+                        return NPOS;
+                    size_t i = mix(Hash{}(key)) & (mcapacity - 1);
+                    for (size_t probes = 0; probes < mcapacity && mstates[i] != EMPTY; ++probes)
+                    {
+                        if (mstates[i] == FULL && mentries[i].first == key)
+                            return i;
+                        i = (i + 1) & (mcapacity - 1);
+                    }
+                    return NPOS;
+                }
+
+                void rehash (size_t capacity)
+                {
+                    capacity = std::bit_ceil(capacity);
+                    uint8_t* states = static_cast<uint8_t*>(mheap->allocate(capacity));
+                    Entry* entries;
+                    try
+                    {
+                        entries = static_cast<Entry*>(mheap->allocate(capacity * sizeof(Entry)));
+                    }
+                    catch (...)
+                    {
+                        mheap->deallocate(states, capacity);
+                        throw;
+                    }
+                    std::memset(states, EMPTY, capacity);
+                    for (size_t i = 0; i < mcapacity; ++i)
+                    {
+                        if (mstates[i] != FULL)
+                            continue;
+                        size_t j = mix(Hash{}(mentries[i].first)) & (capacity - 1);
+                        while (states[j] == FULL)
+                            j = (j + 1) & (capacity - 1);
+                        new (&entries[j]) Entry(std::move(mentries[i]));
+                        mentries[i].~Entry();
+                        states[j] = FULL;
+                    }
+                    release(mstates.get(), mentries.get(), mcapacity);
+                    mstates = states;
+                    mentries = entries;
+                    mcapacity = capacity;
+                    mtombstones = 0;
+                }
+
+                void release (uint8_t* states, Entry* entries, const size_t capacity) noexcept
+                {
+                    mheap->deallocate(states, capacity);
+                    mheap->deallocate(entries, capacity * sizeof(Entry));
+                }
+
+                OffsetPtr<OffsetHeap> mheap;
+                OffsetPtr<uint8_t> mstates;  //!< EMPTY, FULL or TOMBSTONE for each slot.
+                OffsetPtr<Entry> mentries;
+                size_t mcapacity = 0;        //!< Number of slots, a power of two.
+                size_t msize = 0;
+                size_t mtombstones = 0;
+        };
+    } // namespace cpplib
+} // namespace pensar_digital
+#endif // OFFSET_PTR_HPP
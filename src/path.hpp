@@ -53,6 +53,9 @@ namespace pensar_digital
             // Move constructor.
             Path(Path&& p, const Id& aid = null_value<Id>()) noexcept : Object(aid), fs::path(p) {}
 
+            // Constructor from MemoryBuffer.
+            Path(MemoryBuffer& mb) : Object(mb) { assign_without_object(mb); }
+
             // virtual destructor.
             virtual ~Path() noexcept = default;
             static PathFactory::P get(const fs::path& p = ".", const Id& aid = null_value<Id>())
@@ -195,6 +198,42 @@ namespace pensar_digital
                 return true;
             }
 
+            /// \brief Reads the Path part written by write_to: ClassInfo, length in characters and the native characters.
+            Path& assign_without_object(MemoryBuffer& mb)
+            {
+                INFO.test_class_name_and_version(mb);
+                size_t length = 0;
+                mb.read_known_size((BytePtr)&length, sizeof(length));
+                string_type str(length, value_type());
+                mb.read_known_size((BytePtr)str.data(), length * sizeof(value_type));
+                fs::path::operator = (std::move(str));
+                return *this;
+            }
+
+            virtual Object& assign(MemoryBuffer& mb)
+            {
+                Object::assign(mb);
+                return assign_without_object(mb);
+            }
+
+            inline virtual const Object& write_to(MemoryBuffer& mb) const noexcept
+            {
+                Object::write_to(mb);
+                INFO.write(mb);
+                const string_type& str = native();
+                const size_t length = str.size();
+                mb.write((BytePtr)&length, sizeof(length));
+                mb.write((BytePtr)str.data(), length * sizeof(value_type));
+                return *this;
+            }
+
+            inline virtual MemoryBuffer::Ptr bytes() const noexcept
+            {
+                MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(Object::SIZE + ClassInfo::SIZE + sizeof(size_t) + native().size() * sizeof(value_type), IndexMode::NO_INDEX);
+                write_to(*mb);
+                return mb;
+            }
+
             virtual std::istream& binary_read (std::istream& is, const std::endian& byte_order = std::endian::native)
             {
                 return is;
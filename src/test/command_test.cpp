@@ -45,11 +45,17 @@ namespace pensar_digital
 				inline void _run() { ++value; }
 				inline void _undo() const { --value; }
 
+				inline virtual const Object& write_to(MemoryBuffer& mb) const noexcept
+				{
+					Command::write_to(mb);
+					INFO.write(mb);
+					return *this;
+				}
+
 				inline virtual MemoryBuffer::Ptr bytes() const noexcept
 				{
-					MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(size());
-					mb->append(Command::bytes());
-					mb->append(INFO.bytes());
+					MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(Command::SIZE + ClassInfo::SIZE, IndexMode::NO_INDEX);
+					write_to(*mb);
 					return mb;
 				}
 
@@ -102,11 +108,17 @@ namespace pensar_digital
 
 				void _run() { --value; }
 				void _undo() const { ++value; }
+				inline virtual const Object& write_to(MemoryBuffer& mb) const noexcept
+				{
+					Command::write_to(mb);
+					INFO.write(mb);
+					return *this;
+				}
+
 				inline virtual MemoryBuffer::Ptr bytes() const noexcept
 				{
-					MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(size());
-					mb->append(Command::bytes());
-					mb->append(INFO.bytes());
+					MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(Command::SIZE + ClassInfo::SIZE, IndexMode::NO_INDEX);
+					write_to(*mb);
 					return mb;
 				}
 
@@ -157,11 +169,17 @@ namespace pensar_digital
 
 			void _run() { throw "IncFailCmd.run () error."; }
 			void _undo() const { --value; }
+			inline virtual const Object& write_to(MemoryBuffer& mb) const noexcept
+			{
+				Command::write_to(mb);
+				INFO.write(mb);
+				return *this;
+			}
+
 			inline virtual MemoryBuffer::Ptr bytes() const noexcept
 			{
-				MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(size());
-				mb->append(Command::bytes());
-				mb->append(INFO.bytes());
+				MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(Command::SIZE + ClassInfo::SIZE, IndexMode::NO_INDEX);
+				write_to(*mb);
 				return mb;
 			}
 
@@ -213,11 +231,17 @@ namespace pensar_digital
 				virtual Ptr clone() const noexcept { return pd::clone<DoubleCmd>(*this, id()); }
 				void _run() { value *= 2; }
 				void _undo() const { value /= 2; }
+				inline virtual const Object& write_to(MemoryBuffer& mb) const noexcept
+				{
+					Command::write_to(mb);
+					INFO.write(mb);
+					return *this;
+				}
+
 				inline virtual MemoryBuffer::Ptr bytes() const noexcept
 				{
-					MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(size());
-					mb->append(Command::bytes());
-					mb->append(INFO.bytes());
+					MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(Command::SIZE + ClassInfo::SIZE, IndexMode::NO_INDEX);
+					write_to(*mb);
 					return mb;
 				}
 
@@ -269,11 +293,17 @@ namespace pensar_digital
 				Ptr clone() const noexcept { return pd::clone<DoubleFailCmd>(*this, id()); }
 				void _run() { throw "Double errors."; }
 				void _undo() const { value /= 2; }
+				inline virtual const Object& write_to(MemoryBuffer& mb) const noexcept
+				{
+					Command::write_to(mb);
+					INFO.write(mb);
+					return *this;
+				}
+
 				inline virtual MemoryBuffer::Ptr bytes() const noexcept
 				{
-					MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(size());
-					mb->append(Command::bytes());
-					mb->append(INFO.bytes());
+					MemoryBuffer::Ptr mb = std::make_unique<MemoryBuffer>(Command::SIZE + ClassInfo::SIZE, IndexMode::NO_INDEX);
+					write_to(*mb);
 					return mb;
 				}
 
@@ -445,5 +475,24 @@ namespace pensar_digital
 			//CHECK_EQ(Cmd, *p4, *p3, "2");
 		TEST_END(CompositeCmdBinaryStreaming)
 
+		TEST(CompositeCommandWriteTo, true)
+			CompositeCommand cmd;
+			cmd.add(new IncCmd);
+			CompositeCommand* inner = new CompositeCommand;
+			inner->add(new DecCmd);
+			cmd.add(inner);
+
+			// The whole tree is written in one pass: every command contributes its own bytes exactly once.
+			const size_t COMPOSITE_SIZE = Command::SIZE + ClassInfo::SIZE + sizeof(size_t);
+			const size_t LEAF_SIZE      = Command::SIZE + ClassInfo::SIZE;
+			MemoryBuffer::Ptr mb_ptr = cmd.bytes();
+			CHECK_EQ(size_t, mb_ptr->data_size(), 2 * COMPOSITE_SIZE + 2 * LEAF_SIZE, W("0"));
+
+			MemoryBuffer mb(0, IndexMode::NO_INDEX);
+			cmd.write_to(mb);
+			CHECK_EQ(size_t, mb.data_size(), mb_ptr->data_size(), W("1"));
+			CHECK(memcmp(mb.data(), mb_ptr->data(), mb.data_size()) == 0, W("2. write_to and bytes() should produce the same bytes."));
+		TEST_END(CompositeCommandWriteTo)
+
 	}
 }
\ No newline at end of file
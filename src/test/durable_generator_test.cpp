@@ -0,0 +1,160 @@
+// author : Mauricio Gomes
+// license: MIT (https://opensource.org/licenses/MIT)
+
+#include "../../../unit_test/src/test.hpp"
+
+#include "../durable_generator.hpp"
+#include "../stop_watch.hpp"
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace pensar_digital
+{
+    namespace test = pensar_digital::unit_test;
+    using namespace pensar_digital::unit_test;
+    namespace cpplib
+    {
+        std::filesystem::path checkpoint_path (const std::string& name)
+        {
+            return std::filesystem::temp_directory_path() / ("cpplib_ids_" + name + ".ckp");
+        }
+
+        TEST(DurableGenerator, true)
+            using G = DurableGenerator<Object>;
+            const std::filesystem::path path = checkpoint_path("durable");
+            std::filesystem::remove(path);
+            {
+                G g(path, 100, 10, 2);
+                CHECK_EQ(size_t, g.checkpoints (), 1, W("0. a new file starts with a checkpoint"));
+                CHECK_EQ(Id, g.get_id (), 12, W("1"));
+                for (int i = 0; i < 149; ++i)
+                    g.get_id ();
+                CHECK_EQ(Id, g.current (), 310, W("2"));
+                CHECK_EQ(size_t, g.checkpoints (), 3, W("3. one checkpoint per 100 ids"));
+                CHECK_EQ(Id, g.limit (), 410, W("4"));
+            } // No save: as if the process crashed.
+            {
+                G g(path, 100, 0, 1);
+                CHECK_EQ(Id, g.get_id (), 412, W("5. must resume above the last checkpoint, with the file's step"));
+                CHECK_EQ(Id, g.initial_value (), 10, W("6"));
+            }
+
+            // A torn write of the newest slot falls back to the other one.
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            G::Checkpoint newest = {};
+            for (size_t slot = 0; slot < 2; ++slot)
+            {
+                G::Checkpoint c = {};
+                file.seekg(slot * G::SLOT_SIZE);
+                file.read((char*)&c, sizeof(c));
+                if (c.msequence > newest.msequence)
+                    newest = c;
+            }
+            file.seekp((newest.msequence % 2) * G::SLOT_SIZE + sizeof(uint64_t) * 4);
+            file.write("torn", 4);
+            file.close();
+            {
+                G g(path);
+                CHECK_EQ(Id, g.get_id (), 412, W("7. the intact slot must be used"));
+            }
+
+            std::filesystem::resize_file(path, 0);
+            {
+                G g(path, 10, 5);
+                CHECK_EQ(Id, g.get_id (), 6, W("8. an empty file is a new one"));
+            }
+
+            // Both slots torn: slot 0 was written, so ids may have been handed out.
+            file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+            for (size_t slot = 0; slot < 2; ++slot)
+            {
+                file.seekp(slot * G::SLOT_SIZE + sizeof(uint64_t) * 4);
+                file.write("torn", 4);
+            }
+            file.close();
+            bool thrown = false;
+            try
+            {
+                G g(path);
+            }
+            catch (...)
+            {
+                thrown = true;
+            }
+            CHECK(thrown, W("9. a file with no valid slot must not be reused"));
+
+            // The first checkpoint, sequence 1 in slot 1, torn before it completed: slot 0 was never written.
+            file.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+            const std::array<char, G::SLOT_SIZE> zeros = {};
+            file.write(zeros.data(), zeros.size());
+            file.write("torn", 4);
+            file.close();
+            {
+                G g(path, 10, 5);
+                CHECK_EQ(Id, g.get_id (), 6, W("10. a torn first checkpoint is a new file"));
+            }
+            std::filesystem::remove(path);
+        TEST_END(DurableGenerator)
+
+        TEST(DurableGeneratorConcurrent, true)
+            const std::filesystem::path path = checkpoint_path("concurrent");
+            std::filesystem::remove(path);
+            const size_t THREADS = 8;
+            const size_t N = 5000;
+            Id highest = 0;
+            {
+                DurableGenerator<Object> g(path, 1000);
+                g.set_block_size (16);
+                std::vector<std::vector<Id>> ids(THREADS);
+                std::vector<std::thread> threads;
+                for (size_t t = 0; t < THREADS; ++t)
+                    threads.emplace_back([&g, &ids, t, N]
+                    {
+                        for (size_t i = 0; i < N; ++i)
+                            ids[t].push_back(g.get_id ());
+                    });
+                for (std::thread& thread : threads)
+                    thread.join ();
+                std::vector<Id> all;
+                for (const std::vector<Id>& v : ids)
+                    all.insert(all.end(), v.begin(), v.end());
+                std::sort(all.begin(), all.end());
+                CHECK(std::adjacent_find(all.begin(), all.end()) == all.end(), W("0. ids must be unique"));
+                highest = all.back();
+                CHECK(highest <= g.limit (), W("1. every id must be covered by a checkpoint"));
+                CHECK(g.checkpoints () <= 1 + (THREADS * N + 16 * THREADS) / 1000 + 1, W("2. one checkpoint per range"));
+            }
+            {
+                DurableGenerator<Object> g(path, 1000);
+                CHECK(g.get_id () > highest, W("3. a reopened generator must not reissue ids"));
+            }
+            std::filesystem::remove(path);
+        TEST_END(DurableGeneratorConcurrent)
+
+        // Ids per second with a checkpoint (one fsync) per id and per 4096 ids. Disabled by default: it syncs to disk.
+        TEST(DurableGeneratorBenchmark, false)
+            const std::filesystem::path path = checkpoint_path("bench");
+            for (Id range : { 1, 4096 })
+            {
+                std::filesystem::remove(path);
+                const size_t N = range == 1 ? 200 : 200000;
+                DurableGenerator<Object> g(path, range);
+                StopWatch<> sw;
+                for (size_t i = 0; i < N; ++i)
+                    g.get_id ();
+                sw.stop();
+                const StopWatch<>::ELAPSED_TYPE elapsed = sw.elapsed();
+                std::cout << "DurableGenerator range " << range << ": " << (double)N * StopWatch<>::S / (elapsed > 0 ? elapsed : 1)
+                          << " ids/s, " << g.checkpoints () << " checkpoints." << std::endl;
+                CHECK_EQ(size_t, g.checkpoints (), 1 + (N + range - 1) / range, W("0"));
+            }
+            std::filesystem::remove(path);
+        TEST_END(DurableGeneratorBenchmark)
+    }
+}
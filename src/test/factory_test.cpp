@@ -6,9 +6,16 @@
 
 
 #include "../factory.hpp"
+#include "../command.hpp"
 #include "../s.hpp"
 #include "../object.hpp"
+#include "../stop_watch.hpp"
+
+#include <cstdlib>
+#include <iostream>
 #include <memory>
+#include <thread>
+#include <vector>
 
 namespace pensar_digital
 {
@@ -60,10 +67,10 @@ namespace pensar_digital
 			PoolFactory<Object, Object::DataType> factory (3, 10, {1});
             {
                 size_t count = factory.get_available_count();
-                Object::Ptr ptr;
+                std::vector<Object::Ptr> ptrs;
                 for (size_t i = 0; i < count; i++)
                 {
-                    ptr = factory.get({1});
+                    ptrs.push_back(factory.get({1}));
                     CHECK(factory.get_available_count () == factory.get_pool_size () - i - 1, W("0."));
                 }
                 CHECK(factory.get_available_count() == 0, W("0.1. available_count should be 0 but is ") + pd::to_string((int)factory.get_available_count()));
@@ -88,5 +95,163 @@ namespace pensar_digital
 			CHECK(o.get () == nullptr, W("10. managed object should have been deleted and assigned to nullptr."));
         }
         TEST_END(PoolFactory)
+
+        TEST(PoolFactoryRecycling, true)
+        {
+            PoolFactory<Object, Object::DataType> factory (2, 2, {0});
+            Object::Ptr o = factory.get({ 1 });
+            const Object* address = o.get();
+            CHECK(factory.get_available_count() == 1, W("0. available_count should be 1."));
+            o.reset();
+            CHECK(factory.get_available_count() == 2, W("1. released object should be back in the pool."));
+
+            Object::Ptr o1 = factory.get({ 2 });
+            Object::Ptr o2 = factory.get({ 3 });
+            CHECK(o1.get() == address || o2.get() == address, W("2. released object should be reused."));
+            CHECK(o1->id() == 2 && o2->id() == 3, W("3. reused objects must be initialized with the get arguments."));
+            CHECK(factory.get_pool_size() == 2, W("4. no refill expected."));
+
+            Object::Ptr kept;
+            {
+                PoolFactory<Object, Object::DataType> scoped (1, 1, {0});
+                kept = scoped.get({ 4 });
+            }
+            CHECK(kept->id() == 4, W("5. objects may outlive their factory."));
+        }
+        TEST_END(PoolFactoryRecycling)
+
+        struct CountedCommand : public Command
+        {
+            inline static int destroyed = 0;
+            ~CountedCommand () { ++destroyed; }
+        };
+
+        // A recycled composite must not keep the commands added by its previous owner.
+        TEST(PoolFactoryRecyclingComposite, true)
+        {
+            PoolFactory<CompositeCommand, Id> factory (1, 1, NULL_ID);
+            const size_t empty_size = CompositeCommand().size();
+            const CompositeCommand* address;
+            {
+                CompositeCommand::Ptr c = factory.get(1);
+                c->add(new CountedCommand);
+                c->add(new CountedCommand);
+                address = c.get();
+            }
+            CountedCommand::destroyed = 0;
+            CompositeCommand::Ptr c = factory.get(2);
+            CHECK(c.get() == address, W("0. the composite should be recycled."));
+            CHECK(CountedCommand::destroyed == 2, W("1. the previous commands must be freed."));
+            CHECK(c->size() == empty_size, W("2. a recycled composite must be empty."));
+            CHECK(c->id() == 2, W("3."));
+        }
+        TEST_END(PoolFactoryRecyclingComposite)
+
+        TEST(PoolFactorySlabs, true)
+        {
+            PoolFactory<Object, Object::DataType> factory (4, 4, {0});
+            std::vector<Object::Ptr> ptrs;
+            for (Id i = 0; i < 6; ++i)
+                ptrs.push_back(factory.get({ i }));
+            CHECK(factory.get_pool_size() == 8, W("0. pool_size should be 8 (two slabs)."));
+
+            // Objects of the same slab are contiguous.
+            const std::ptrdiff_t stride = (const char*)ptrs[1].get() - (const char*)ptrs[0].get();
+            CHECK(std::abs(stride) == std::abs((const char*)ptrs[2].get() - (const char*)ptrs[1].get()), W("1. same slab objects should be evenly spaced."));
+
+            ptrs[1].reset();
+            ptrs[4].reset();
+            size_t live = 0;
+            Id sum = 0;
+            factory.for_each_live([&live, &sum](Object& o) { ++live; sum += o.id(); });
+            CHECK(live == 4, W("2. live should be 4 but is ") + pd::to_string((int)live));
+            CHECK(sum == 0 + 2 + 3 + 5, W("3. for_each_live should visit only the objects in use."));
+
+            // f may release pooled pointers and call get: it runs outside the pool lock. The object it visits is not
+            // recycled before f returns, even if it is released meanwhile.
+            bool recycled = false;
+            factory.for_each_live([&ptrs, &factory, &recycled](Object& o)
+            {
+                if (&o != ptrs[0].get())
+                    return;
+                ptrs[0].reset();
+                Object::Ptr other = factory.get({ 99 });
+                recycled = (other.get() == &o) || (o.id() != 0);
+            });
+            CHECK(!recycled, W("4. an object visited by for_each_live must not be recycled."));
+            CHECK(factory.get_available_count() == 5, W("5. the released object must be back in the pool once f returns."));
+
+            ShardedPoolFactory<Object, Object::DataType> sharded (2, 4, 4, {0});
+            Object::Ptr o = sharded.get({ 9 });
+            live = 0;
+            sharded.for_each_live([&live](Object& o) { ++live; });
+            CHECK(live == 1, W("6. live should be 1."));
+        }
+        TEST_END(PoolFactorySlabs)
+
+        TEST(ShardedPoolFactory, true)
+        {
+            ShardedPoolFactory<Object, Object::DataType> factory (4, 8, 4, {0});
+            CHECK(factory.get_shard_count() == 4, W("0. shard_count should be 4."));
+            {
+                std::vector<Object::Ptr> ptrs;
+                for (Id i = 0; i < 8; ++i)
+                    ptrs.push_back(factory.get({ i }));
+                CHECK(factory.get_available_count() == 0, W("1. available_count should be 0."));
+                CHECK(ptrs[5]->id() == 5, W("2. objects must be initialized with the get arguments."));
+            }
+            CHECK(factory.get_available_count() == 8, W("3. released objects should be back in the pool."));
+
+            // Another thread is served from the free objects, stolen from another shard if its home shard is empty
+            // (thread indexes are shared by every factory, so which shard is home depends on the threads run before).
+            Id served = 0;
+            std::thread thread([&factory, &served] { served = factory.get({ 42 })->id(); });
+            thread.join();
+            CHECK(served == 42, W("4. the other thread must be served."));
+            CHECK(factory.get_steal_count() <= 1, W("5. at most one steal expected."));
+            CHECK(factory.get_pool_size() == 8, W("6. no refill expected."));
+
+            Factory<Object, Object::DataType> sharded (SHARDED_POOL, 2, 2, { 0 });
+            CHECK(sharded.get({ 7 })->id() == 7, W("7."));
+        }
+        TEST_END(ShardedPoolFactory)
+
+        // Each thread acquires and releases n objects, keeping a few alive. Returns elapsed time.
+        template <class PoolFactoryType>
+        StopWatch<>::ELAPSED_TYPE contention_benchmark (PoolFactoryType& factory, const size_t thread_count, const size_t n)
+        {
+            StopWatch<> sw;
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < thread_count; ++t)
+                threads.emplace_back([&factory, n]
+                {
+                    Object::Ptr kept[4];
+                    for (size_t i = 0; i < n; ++i)
+                        kept[i % 4] = factory.get({ (Id)i });
+                });
+            for (std::thread& thread : threads)
+                thread.join();
+            sw.stop();
+            return sw.elapsed();
+        }
+
+        // Compares PoolFactory (one free list) with ShardedPoolFactory for 1 to 64 threads. Disabled by default.
+        TEST(FactoryContentionBenchmark, false)
+        {
+            const size_t N = 20000;
+            for (size_t threads = 1; threads <= 64; threads *= 2)
+            {
+                PoolFactory       <Object, Object::DataType> pool    (64, 64, { 0 });
+                ShardedPoolFactory<Object, Object::DataType> sharded (64, 64, { 0 });
+                StopWatch<>::ELAPSED_TYPE single = contention_benchmark(pool   , threads, N);
+                StopWatch<>::ELAPSED_TYPE shards = contention_benchmark(sharded, threads, N);
+                std::cout << "Factory contention, " << threads << " threads x " << N << " get/release: pool = "
+                          << (double)threads * N * StopWatch<>::S / single << " ops/s, sharded = "
+                          << (double)threads * N * StopWatch<>::S / shards << " ops/s." << std::endl;
+                CHECK(pool.get_available_count() == pool.get_pool_size(), W("0. every object should be back in the pool."));
+                CHECK(sharded.get_available_count() == sharded.get_pool_size(), W("1. every object should be back in the sharded pool."));
+            }
+        }
+        TEST_END(FactoryContentionBenchmark)
     }
 }
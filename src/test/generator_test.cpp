@@ -8,6 +8,9 @@
 #include "../concept.hpp"
 
 #include <sstream>
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 namespace pensar_digital
 {
@@ -71,6 +74,50 @@ namespace pensar_digital
             CHECK_EQ(Id, g.get_id ()        ,          4, W("2"));
         TEST_END(SetStep)
 
+        TEST(GeneratorConcurrent, true)
+            const size_t THREADS = 8;
+            const size_t N = 10000;
+            for (Id block_size : { 1, 64 })
+            {
+                Generator<Object> g(1, 5, 3);
+                g.set_block_size (block_size);
+                std::vector<std::vector<Id>> ids(THREADS);
+                std::vector<std::thread> threads;
+                for (size_t t = 0; t < THREADS; ++t)
+                    threads.emplace_back([&g, &ids, t, N]
+                    {
+                        for (size_t i = 0; i < N; ++i)
+                            ids[t].push_back(g.get_id ());
+                    });
+                for (std::thread& thread : threads)
+                    thread.join ();
+
+                std::vector<Id> all;
+                for (const std::vector<Id>& v : ids)
+                {
+                    CHECK(std::is_sorted(v.begin(), v.end()), W("0. ids of one thread must increase"));
+                    all.insert(all.end(), v.begin(), v.end());
+                }
+                std::sort(all.begin(), all.end());
+                CHECK(std::adjacent_find(all.begin(), all.end()) == all.end(), W("1. ids must be unique"));
+                CHECK(std::all_of(all.begin(), all.end(), [](Id id) { return id > 5 && (id - 5) % 3 == 0; }), W("2. ids must follow initial_value and step"));
+                CHECK(g.current () >= all.back(), W("3"));
+                if (block_size == 1)
+                    CHECK_EQ(Id, all.back(), 5 + 3 * (Id)(THREADS * N), W("4. without blocks no id is skipped"));
+            }
+
+            // Blocks reserved before a reload are never handed out again.
+            Generator<Object> g;
+            g.set_block_size (100);
+            const Id first = g.get_id ();
+            MemoryBuffer::Ptr mb = g.bytes ();
+            Generator<Object> g2;
+            g2.assign (*mb);
+            CHECK_EQ(Id, first, 1, W("5"));
+            CHECK_EQ(Id, g2.get_id (), 101, W("6"));
+            CHECK_EQ(Id, g.get_id (), 2, W("7"));
+        TEST_END(GeneratorConcurrent)
+
 	    TEST(GeneratorSerialization, true)
 			using G = Generator<int>;
             G g;
@@ -5,6 +5,11 @@
 
 
 #include "../memory_buffer.hpp"
+#include "../object.hpp"
+#include "../generator.hpp"
+#include "../stop_watch.hpp"
+
+#include <iostream>
 
 namespace pensar_digital
 {
@@ -46,5 +51,134 @@ namespace pensar_digital
 			CHECK(mb.size() == 1024, W("11. Buffer size should be 1024 bytes."));
 
         TEST_END(MemoryBuffer)
+
+        TEST(MemoryBufferGrowth, true)
+			MemoryBuffer mb(16);
+			std::byte data[100];
+			for (size_t i = 0; i < sizeof(data); ++i)
+				data[i] = std::byte(i);
+
+			mb.write(data, sizeof(data));
+			CHECK(mb.data_size() == sizeof(data), W("0. Data size should be 100 bytes."));
+			CHECK(mb.size() >= sizeof(data), W("1. Buffer should have grown to at least 100 bytes."));
+
+			mb.shrink_to_fit();
+			CHECK(mb.size() == sizeof(data), W("2. shrink_to_fit should leave size() == data_size()."));
+
+			mb.reserve(1000);
+			CHECK(mb.size() == 1000, W("3. reserve(1000) should grow the buffer to 1000 bytes."));
+			CHECK(mb.data_size() == sizeof(data), W("4. reserve should not change the data size."));
+
+			// append copies only the written data, not the whole capacity.
+			MemoryBuffer mb2(0);
+			mb2.append(mb);
+			CHECK(mb2.data_size() == sizeof(data), W("5. append should copy data_size() bytes."));
+
+			std::byte read[100];
+			mb2.read(read, 0);
+			CHECK(memcmp(read, data, sizeof(data)) == 0, W("6. Appended data should match written data."));
+
+			BasicMemoryBuffer<std::allocator<std::byte>, ExactGrowth> exact(0);
+			exact.write(data, 10);
+			CHECK(exact.size() == 10, W("7. ExactGrowth should allocate exactly the required size."));
+			exact.write(data, 10);
+			CHECK(exact.size() == 20, W("8. ExactGrowth should allocate exactly the required size."));
+        TEST_END(MemoryBufferGrowth)
+
+        TEST(MemoryBufferIndexModes, true)
+			std::byte data[100];
+			for (size_t i = 0; i < sizeof(data); ++i)
+				data[i] = std::byte(i);
+
+			for (IndexMode mode : { IndexMode::NO_INDEX, IndexMode::COMPACT_INDEX, IndexMode::HASH_INDEX })
+			{
+				MemoryBuffer mb(8, mode);
+				CHECK(mb.index_mode() == mode, W("0. index_mode() should return the mode given at construction."));
+				mb.write(data, 10);
+				MemoryBuffer::Offset offset = mb.write(data + 10, 20);
+				mb.write(data + 30, 5);
+				CHECK(mb.count() == 3, W("1. count() should be 3 in every index mode."));
+
+				std::byte read[100] = {};
+				if (mode == IndexMode::NO_INDEX)
+				{
+					bool thrown = false;
+					try { mb.read(read, offset); } catch (const std::runtime_error&) { thrown = true; }
+					CHECK(thrown, W("2. read(dest, offset) should throw when the buffer has no index."));
+					mb.read_known_size(read, 10);
+					CHECK(memcmp(read, data, 10) == 0, W("3. read_known_size should work without an index."));
+				}
+				else
+				{
+					mb.read(read, offset);
+					CHECK(memcmp(read, data + 10, 20) == 0, W("4. read(dest, offset) should find the element size in the index."));
+				}
+			}
+        TEST_END(MemoryBufferIndexModes)
+
+        TEST(MemoryBufferExactSize, true)
+			std::byte data[100] = {};
+			MemoryBuffer mb(data, sizeof(data));
+			CHECK(mb.size() == sizeof(data), W("0. BytePtr constructor should size the buffer exactly."));
+
+			MemoryBuffer copy(mb);
+			CHECK(copy.size() == sizeof(data), W("1. Copy constructor should size the buffer exactly."));
+			CHECK(copy.data_size() == sizeof(data), W("2. Copy constructor should copy all the data."));
+        TEST_END(MemoryBufferExactSize)
+
+        // Serializing objects must not hit the heap once the thread-local SizeClassPool is warm. Each bytes() call
+        // takes two blocks from the pool, one for the MemoryBuffer and one for its storage, so a warm run is all
+        // hits and no misses.
+        TEST(ObjectBytesAllocations, true)
+			const size_t N = 10000;
+			Object o(42);
+			Generator<Object> g(1, 0, 1);
+
+			// Warms up the pool.
+			for (size_t i = 0; i < 100; ++i)
+			{
+				MemoryBuffer::Ptr mb = o.bytes();
+				MemoryBuffer::Ptr gmb = g.bytes();
+			}
+
+			const SizeClassPool& pool = SizeClassPool::instance();
+			size_t hits   = pool.hits();
+			size_t misses = pool.misses();
+			size_t bytes  = 0;
+			for (size_t i = 0; i < N; ++i)
+			{
+				MemoryBuffer::Ptr mb = o.bytes();
+				MemoryBuffer::Ptr gmb = g.bytes();
+				bytes += mb->data_size() + gmb->data_size();
+			}
+			size_t allocations = pool.misses() - misses;
+			CHECK(bytes == N * (Object::SIZE + Generator<Object>::SIZE), W("0. Unexpected serialized size."));
+			CHECK(allocations == 0, W("1. Serializing ") + pd::to_string((int)N) + W(" objects made ") + pd::to_string((int)allocations) + W(" heap allocations."));
+			CHECK(pool.hits() - hits == 4 * N, W("2. Buffers and their storage should be served by the pool."));
+        TEST_END(ObjectBytesAllocations)
+
+        template <class Buffer>
+        StopWatch<>::ELAPSED_TYPE append_benchmark(const size_t n)
+        {
+            std::byte record[16] = {};
+            StopWatch<> sw;
+            Buffer mb(1024);
+            for (size_t i = 0; i < n; ++i)
+                mb.write(record, sizeof(record));
+            sw.stop();
+            return sw.elapsed();
+        }
+
+        // Compares append throughput for 10^6 16-byte writes with ExactGrowth (the old reallocation strategy) and
+        // GeometricGrowth. Disabled by default because ExactGrowth is O(N^2) and takes minutes at this size.
+        TEST(MemoryBufferAppendBenchmark, false)
+            const size_t N = 1000000;
+            StopWatch<>::ELAPSED_TYPE exact     = append_benchmark<BasicMemoryBuffer<std::allocator<std::byte>, ExactGrowth>>(N);
+            StopWatch<>::ELAPSED_TYPE geometric = append_benchmark<MemoryBuffer>(N);
+            std::cout << "MemoryBuffer append " << N << " x 16 bytes: exact = " << exact / StopWatch<>::MS << " ms (" 
+                      << (double)N * StopWatch<>::S / exact << " writes/s), geometric = " << geometric / StopWatch<>::MS << " ms ("
+                      << (double)N * StopWatch<>::S / geometric << " writes/s)." << std::endl;
+            CHECK(geometric < exact, W("0. Geometric growth should be faster than exact growth."));
+        TEST_END(MemoryBufferAppendBenchmark)
     }
 }
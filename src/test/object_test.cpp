@@ -110,5 +110,58 @@ namespace pensar_digital
                     CHECK_EQ(Object, o, *o1, pd::to_string(i));
                 }
             TEST_END(ObjectBinaryFileStreaming2)
+
+            TEST(ClassInfoFingerprint, true)
+                static_assert(ClassInfo::fingerprint(W("ns"), W("A"), 1, 1, 1) != ClassInfo::fingerprint(W("ns"), W("A"), 1, 1, 2));
+                static_assert(Object::SIZE == Object::DATA_SIZE + sizeof(Fingerprint));
+
+                MemoryBuffer::Ptr tag = Object::INFO.bytes();
+                CHECK_EQ(size_t, tag->data_size(), ClassInfo::SIZE, W("0"));
+                CHECK(ClassInfo::is_compact(tag->data()[0]), W("1. compact tag must start with the marker"));
+                CHECK_EQ(Fingerprint, ClassInfo::read_fingerprint(*tag), Object::INFO.mfingerprint, W("2"));
+
+                // Streams written with the full ClassInfo (legacy format) are still readable.
+                auto o = pd::Object::get(42);
+                MemoryBuffer legacy(ClassInfo::legacy_size() + Object::DATA_SIZE, IndexMode::NO_INDEX);
+                Object::INFO.write_full(legacy);
+                legacy.write(o->data_bytes(), Object::DATA_SIZE);
+                CHECK(!ClassInfo::is_compact(legacy.data()[0]), W("3. legacy format must not look compact"));
+                Object o1(legacy);
+                CHECK_EQ(Object, o1, *o, W("4"));
+
+                // A different version does not match.
+                const ClassInfo other = { CPPLIB_NAMESPACE, W("Object"), 1, 1, 2 };
+                CHECK(other != Object::INFO, W("5"));
+                MemoryBuffer::Ptr other_tag = other.bytes();
+                bool thrown = false;
+                try
+                {
+                    Object::INFO.test_class_name_and_version(*other_tag);
+                }
+                catch (...)
+                {
+                    thrown = true;
+                }
+                CHECK(thrown, W("6. version mismatch must throw"));
+            TEST_END(ClassInfoFingerprint)
+
+            TEST(ClassDictionary, true)
+                ClassDictionary dictionary;
+                CHECK(dictionary.add(Object::INFO), W("0"));
+                CHECK(!dictionary.add(Object::INFO), W("1. duplicate add"));
+
+                MemoryBuffer mb(dictionary.header_size() + Object::SIZE, IndexMode::NO_INDEX);
+                dictionary.write(mb);
+                CHECK_EQ(size_t, mb.data_size(), dictionary.header_size(), W("2"));
+                pd::Object::get(7)->write_to(mb);
+
+                ClassDictionary read_dictionary;
+                CHECK(read_dictionary.read(mb), W("3"));
+                CHECK(!read_dictionary.read(mb), W("4. no second header"));
+                const ClassInfo* info = read_dictionary.find(ClassInfo::read_fingerprint(mb));
+                CHECK(info != nullptr, W("5"));
+                CHECK_EQ(S, info->to_s(), Object::INFO.to_s(), W("6"));
+                CHECK(read_dictionary.find(0) == nullptr, W("7"));
+            TEST_END(ClassDictionary)
     }
 }
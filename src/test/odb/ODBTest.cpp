@@ -1,6 +1,19 @@
 // $Id
 
 #include <string>
+#include <vector>
+#include <iterator>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <functional>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <cstddef>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include <boost/test/unit_test.hpp>
 
@@ -8,6 +21,9 @@
 #include "io_util.h"
 #include "my_boost.hpp"
 #include "ODB.hpp"
+#include "odb_snapshot.hpp"
+#include "concurrent_odb.hpp"
+#include "prefix_odb.hpp"
 #include "string_util.hpp"
 
 using namespace boost::unit_test_framework;
@@ -25,6 +41,7 @@ class OdbDummy
     std::string other;
 };
 
+// The *_benchmark cases print timings and are disabled: run one with --run_test=odb_suite/<name>.
 BOOST_AUTO_TEST_SUITE(odb_suite)
 
 BOOST_AUTO_TEST_CASE(constructor_test)
@@ -95,7 +112,7 @@ BOOST_AUTO_TEST_CASE(contains_test)
 
 BOOST_AUTO_TEST_CASE(case_insensitive_test)
 {
-  typedef odb::ODB<OdbDummy, std::string, odb::case_insensitive_hash<>, odb::case_insensitive_equal_to<>> DB;
+  typedef odb::ODB<OdbDummy, std::string, odb::case_insensitive_normalizer<>> DB;
   DB db;
   OdbDummy d2 (2, "a rather long name for this object", "");
   db.add (d2.search_string(), &d2);
@@ -108,7 +125,7 @@ BOOST_AUTO_TEST_CASE(case_insensitive_test)
 
 BOOST_AUTO_TEST_CASE(no_accents_test)
 {
-  typedef odb::ODB<OdbDummy, std::string, odb::no_accents_hash<>, odb::no_accents_equal_to<>> DB;
+  typedef odb::ODB<OdbDummy, std::string, odb::no_accents_normalizer<>> DB;
   DB db;
   OdbDummy d2 (2, "a rather long name for this object", "");
   db.add (d2.search_string(), &d2);
@@ -121,7 +138,7 @@ BOOST_AUTO_TEST_CASE(no_accents_test)
 
 BOOST_AUTO_TEST_CASE(case_insensitive_no_accents_test)
 {
-  typedef odb::ODB<OdbDummy, std::string, odb::case_insensitive_no_accents_hash<std::string>, odb::case_insensitive_no_accents_equal_to<std::string>> DB;
+  typedef odb::ODB<OdbDummy, std::string, odb::case_insensitive_no_accents_normalizer<std::string>> DB;
   DB db;
   OdbDummy d2 (2, "a rather long name for this object", "");
   db.add (d2.search_string(), &d2);
@@ -147,7 +164,7 @@ BOOST_AUTO_TEST_CASE(default_hash_test) // It should be equivalent to the case i
 
 BOOST_AUTO_TEST_CASE(case_sensitive_accents_test)
 {
-  typedef odb::ODB<OdbDummy, std::string, std::hash<std::string>, std::equal_to<std::string>> DB;
+  typedef odb::ODB<OdbDummy, std::string, odb::identity_normalizer<std::string>> DB;
   DB db;
   OdbDummy d2 (2, "a rather long name for this object", "");
   db.add (d2.search_string(), &d2);
@@ -160,4 +177,553 @@ BOOST_AUTO_TEST_CASE(case_sensitive_accents_test)
   BOOST_CHECK_EQUAL(unsigned(0), r.size());
 }
 
+BOOST_AUTO_TEST_CASE(gram_index_test) // Every gram size must give the answer of a plain substring search.
+{
+  const char* names[] = {"Maria da Silva", "Jos Paulo Silva", "Paula Souza", "Joo Silveira", "Ana Maria Paulino", "silvana", "Z"};
+  const char* queries[] = {"silva", "SILV", "paul", "jose", "a", "z", "ze", "ria da", "maria", "xyz", "aaa", "souza", "paulino x"};
+  typedef odb::ODB<std::string> DB;
+  odb::case_insensitive_no_accents_equal_to<std::string> equal;
+  std::vector<std::string> keys (std::begin (names), std::end (names));
+  for (size_t gram_size = 1; gram_size <= 5; ++gram_size)
+  {
+    DB db (gram_size);
+    for (std::string& k : keys)
+      db.add (k, &k);
+    BOOST_CHECK_EQUAL(keys.size (), db.size ());
+    for (const char* q : queries)
+    {
+      const std::string query = q;
+      DB::ResultSet expected;
+      for (std::string& k : keys)
+        for (size_t i = 0; i + query.size () <= k.size (); ++i)
+          if (equal (k.substr (i, query.size ()), query))
+            expected.insert (&k);
+      DB::ResultSet r;
+      BOOST_CHECK_EQUAL(! expected.empty (), db.contains (query, r));
+      BOOST_CHECK(expected == r);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(gram_index_memory_test) // Linear in the key length, where all substrings were quadratic.
+{
+  odb::ODB<std::string> db;
+  std::string key = "a rather long name for this object here"; // 40 characters.
+  db.add (key, &key);
+  BOOST_CHECK(db.posting_count () <= 3 * key.size ());
+  BOOST_CHECK(db.posting_count () < key.size () * (key.size () + 1) / 2 / 5);
+}
+
+BOOST_AUTO_TEST_CASE(normalized_key_test) // Keys are stored normalized, queries are normalized once.
+{
+  typedef odb::ODB<std::string, std::string, odb::case_insensitive_no_accents_normalizer<>> DB;
+  odb::case_insensitive_no_accents_equal_to<std::string> equal;
+  BOOST_CHECK(equal ("CONCEIO", "conceicao"));
+  BOOST_CHECK(! equal ("Conceio", "Conceicoa"));
+  DB db;
+  std::string name = "Maria da CONCEIO";
+  db.add (name, &name);
+  DB::ResultSet r;
+  BOOST_CHECK(db.contains ("Conceio", r));
+  BOOST_CHECK(db.contains ("a conceic", r));
+  BOOST_CHECK(! db.contains ("conceioa", r));
+}
+
+BOOST_AUTO_TEST_CASE(query_test) // Boolean queries must give the answer of plain substring searches, in add order.
+{
+  typedef odb::ODB<std::string> DB;
+  typedef DB::Query Q;
+  const char* names[] = {"Maria da Silva", "Jos Paulo Silva", "Paula Souza", "Joo Silveira", "Ana Maria Paulino", "silvana",
+    "Paulo Maria", "Z", "Paulo Souza Silva"};
+  std::vector<std::string> keys (std::begin (names), std::end (names));
+  odb::case_insensitive_no_accents_normalizer<> normalize;
+  std::function<bool (const Q&, const std::string&)> matches = [&] (const Q& q, const std::string& key) -> bool
+  {
+    switch (q.get_kind ())
+    {
+      case Q::TERM: return ! q.get_term ().empty () && normalize (key).find (normalize (q.get_term ())) != std::string::npos;
+      case Q::NOT: return ! matches (q.get_operands ()[0], key);
+      case Q::AND:
+        for (const Q& o : q.get_operands ())
+          if (! matches (o, key))
+            return false;
+        return true;
+      case Q::OR:
+        for (const Q& o : q.get_operands ())
+          if (matches (o, key))
+            return true;
+        return false;
+    }
+    return false;
+  };
+  const Q queries[] = {Q ("silva") && "paulo" && !Q ("maria"), Q ("SILV") || "souza", !Q ("a"), !Q ("xyz"), Q ("maria") && !Q ("xyz"),
+    (Q ("paul") || "jose") && !(Q ("souza") || "silveira"), Q ("xyz") || "z", Q ("silva") && "xyz", !Q ("silva") && !Q ("paul"),
+    Q ("ana") || (Q ("maria") && "da"), Q (""), !Q ("")};
+  BOOST_CHECK_EQUAL(unsigned(3), (Q ("a") && "b" && "c").get_operands ().size ()); // Flattened.
+  for (size_t gram_size = 1; gram_size <= 4; ++gram_size)
+  {
+    DB db (gram_size);
+    for (std::string& k : keys)
+      db.add (k, &k);
+    for (const Q& q : queries)
+    {
+      std::vector<std::string*> expected;
+      for (std::string& k : keys)
+        if (matches (q, k))
+          expected.push_back (&k);
+      std::vector<std::string*> result;
+      for (std::string* k : db.query (q))
+        result.push_back (k);
+      BOOST_CHECK(expected == result);
+    }
+  }
+
+  DB db;
+  for (std::string& k : keys)
+    db.add (k, &k);
+  DB::Results results = db.query (Q ("silva"));
+  DB::Results::iterator it = results.begin ();
+  BOOST_CHECK(it != results.end ());
+  BOOST_CHECK_EQUAL(unsigned(0), it.id ());
+  ++it;
+  BOOST_CHECK_EQUAL(unsigned(1), it.id ());
+  BOOST_CHECK_EQUAL(&keys[1], *it);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_test) // A snapshot answers queries as the ODB it was written from.
+{
+  typedef odb::ODB<std::string> DB;
+  typedef DB::Query Q;
+  typedef odb::Snapshot<> Snapshot;
+  const char* names[] = {"Maria da Silva", "Jos Paulo Silva", "Paula Souza", "Joo Silveira", "Ana Maria Paulino", "silvana",
+    "Paulo Maria", "Z", "Paulo Souza Silva"};
+  std::vector<std::string> keys (std::begin (names), std::end (names));
+  const std::filesystem::path path = std::filesystem::temp_directory_path () / "odb_snapshot_test.odb";
+  DB db;
+  Snapshot::Entries entries;
+  for (size_t i = 0; i < keys.size (); ++i)
+  {
+    db.add (keys[i], &keys[i]);
+    entries.push_back (std::make_pair (db.key (static_cast<DB::ObjectId> (i)), 1000 + i));
+  }
+  Snapshot::write (path, db.get_gram_size (), entries);
+  BOOST_CHECK(! std::filesystem::exists (path.string () + ".tmp"));
+  {
+    Snapshot snapshot (path);
+    BOOST_CHECK_EQUAL(keys.size (), snapshot.size ());
+    BOOST_CHECK_EQUAL(db.posting_count (), snapshot.posting_count ());
+    BOOST_CHECK(snapshot.key (1) == "jose paulo silva");
+    const Q queries[] = {Q ("silva") && "paulo" && !Q ("maria"), Q ("SILV") || "souza", !Q ("a"), Q ("xyz"), Q ("z")};
+    odb::case_insensitive_no_accents_normalizer<> normalize;
+    for (const Q& q : queries)
+    {
+      std::vector<DB::ObjectId> expected, result;
+      DB::Results results = db.query (q);
+      for (DB::Results::iterator it = results.begin (); it != results.end (); ++it)
+        expected.push_back (it.id ());
+      odb::cursor::NodePtr cursor = odb::cursor::compile (snapshot, q, normalize);
+      for (DB::ObjectId id = cursor->seek (0); id != odb::cursor::END; id = cursor->seek (id + 1))
+        result.push_back (id);
+      BOOST_CHECK(expected == result);
+    }
+    BOOST_CHECK_EQUAL(1001u, snapshot.record_id (1));
+  }
+  // Corrupt copies must not open: a gram past the postings, an id past the keys, key offsets going backwards.
+  std::string bytes;
+  {
+    std::ifstream in (path, std::ios::binary);
+    bytes.assign (std::istreambuf_iterator<char> (in), std::istreambuf_iterator<char> ());
+  }
+  odb::SnapshotHeader h;
+  std::memcpy (&h, bytes.data (), sizeof (h));
+  const size_t grams_at = sizeof (odb::SnapshotHeader);
+  const size_t postings_at = grams_at + h.gram_count * sizeof (odb::SnapshotGram);
+  const size_t offsets_at = postings_at + (h.posting_count * sizeof (odb::ObjectId) + 7) / 8 * 8;
+  const std::filesystem::path corrupt_path = path.string () + ".corrupt";
+  auto corrupt = [&] (size_t at, const void* value, size_t size)
+  {
+    std::string copy = bytes;
+    std::memcpy (&copy[at], value, size);
+    std::ofstream out (corrupt_path, std::ios::binary | std::ios::trunc);
+    out.write (copy.data (), copy.size ());
+  };
+  const uint64_t too_many = h.posting_count + 1;
+  corrupt (grams_at + offsetof (odb::SnapshotGram, count), &too_many, sizeof (too_many));
+  BOOST_CHECK_THROW(Snapshot snapshot (corrupt_path), std::runtime_error);
+  const odb::ObjectId bad_id = static_cast<odb::ObjectId> (h.entry_count);
+  corrupt (postings_at, &bad_id, sizeof (bad_id));
+  BOOST_CHECK_THROW(Snapshot snapshot (corrupt_path), std::runtime_error);
+  const uint64_t backwards = h.key_char_count;
+  corrupt (offsets_at + sizeof (uint64_t), &backwards, sizeof (backwards));
+  BOOST_CHECK_THROW(Snapshot snapshot (corrupt_path), std::runtime_error);
+  corrupt (0, &h, sizeof (h));
+  BOOST_CHECK_NO_THROW(Snapshot snapshot (corrupt_path));
+  std::filesystem::remove (corrupt_path);
+  std::filesystem::resize_file (path, 100);
+  BOOST_CHECK_THROW(Snapshot snapshot (path), std::runtime_error);
+  std::filesystem::remove (path);
+}
+
+BOOST_AUTO_TEST_CASE(persistent_odb_test) // Adds go to the delta, merges to a new snapshot generation.
+{
+  typedef odb::PersistentODB<> DB;
+  typedef DB::Query Q;
+  const std::filesystem::path path = std::filesystem::temp_directory_path () / "odb_persistent_test.odb";
+  for (uint64_t g = 1; g <= 4; ++g)
+    std::filesystem::remove (path.string () + "." + std::to_string (g));
+  std::vector<odb::RecordId> r;
+  {
+    DB db (path);
+    BOOST_CHECK_EQUAL(1u, db.get_generation ());
+    BOOST_CHECK(std::filesystem::exists (db.generation_path (1)));
+    db.add ("Maria da Silva", 1);
+    db.add ("Jos Paulo Silva", 2);
+    db.add ("Paula Souza", 3);
+    db.merge_async ();
+    db.add ("Paulo Silveira", 4); // During the merge.
+    db.wait_merge ();
+    BOOST_CHECK(! db.is_merging ());
+    BOOST_CHECK_EQUAL(2u, db.get_generation ());
+    BOOST_CHECK_EQUAL(3u, db.get_snapshot ().size ());
+    BOOST_CHECK_EQUAL(1u, db.delta_size ());
+    BOOST_CHECK(! std::filesystem::exists (db.generation_path (1)));
+    for (odb::RecordId id : db.query (Q ("silv") && !Q ("maria")))
+      r.push_back (id);
+    BOOST_CHECK((r == std::vector<odb::RecordId> {2, 4}));
+    r.clear ();
+    for (odb::RecordId id : db.query (Q ("paul")))
+      r.push_back (id);
+    BOOST_CHECK((r == std::vector<odb::RecordId> {2, 3, 4}));
+    db.merge ();
+    BOOST_CHECK_EQUAL(4u, db.get_snapshot ().size ());
+    BOOST_CHECK_EQUAL(0u, db.delta_size ());
+    db.add ("Not merged", 5); // Lost, only merged keys are on disk.
+  }
+  {
+    DB db (path);
+    BOOST_CHECK_EQUAL(3u, db.get_generation ());
+    BOOST_CHECK_EQUAL(4u, db.size ());
+    r.clear ();
+    for (odb::RecordId id : db.query (Q ("SILVA") || "souza"))
+      r.push_back (id);
+    BOOST_CHECK((r == std::vector<odb::RecordId> {1, 2, 3}));
+  }
+  std::filesystem::remove (path.string () + ".3");
+}
+
+BOOST_AUTO_TEST_CASE(remove_test)
+{
+  typedef odb::ODB<std::string> DB;
+  std::string a = "Maria da Silva", b = "Maria Souza";
+  DB db;
+  db.add (a, &a);
+  db.add (b, &b);
+  BOOST_CHECK(! db.remove ("Maria Souza", &a)); // Not a's key.
+  BOOST_CHECK(db.remove ("MARIA da silva", &a));
+  DB::ResultSet r;
+  BOOST_CHECK(db.contains ("maria", r));
+  BOOST_CHECK_EQUAL(unsigned(1), r.size ());
+  BOOST_CHECK(*r.begin () == &b);
+  BOOST_CHECK(! db.contains ("silva", r));
+  size_t count = 0;
+  for (std::string* s : db.query (! DB::Query ("xyz")))
+    count += (s == &b);
+  BOOST_CHECK_EQUAL(unsigned(1), count);
+
+  // Once removed entries are more than half of the index, it is compacted.
+  std::vector<std::string> names;
+  for (size_t i = 0; i < 100; ++i)
+    names.push_back ("Name " + std::to_string (i));
+  for (std::string& n : names)
+    db.add (n, &n);
+  for (size_t i = 0; i < names.size (); i += 2)
+    db.remove (names[i], &names[i]);
+  BOOST_CHECK_EQUAL(51u, db.removed_count ()); // With a's, half of 102.
+  BOOST_CHECK_EQUAL(102u, db.size ());
+  db.remove (names[1], &names[1]);
+  BOOST_CHECK_EQUAL(0u, db.removed_count ());
+  BOOST_CHECK_EQUAL(50u, db.size ());
+  BOOST_CHECK(db.contains ("name 99", r));
+  BOOST_CHECK(*r.begin () == &names[99]);
+  BOOST_CHECK(! db.contains ("name 98", r));
+  std::vector<std::string*> in_order;
+  for (std::string* s : db.query (DB::Query ("name 9")))
+    in_order.push_back (s);
+  BOOST_CHECK_EQUAL(unsigned(6), in_order.size ()); // 9, 91, 93, 95, 97 and 99, in add order.
+  BOOST_CHECK(in_order.front () == &names[9] && in_order.back () == &names[99]);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_odb_test) // Readers always see a whole version: the names added so far, in order.
+{
+  typedef odb::ConcurrentODB<const size_t> DB;
+  const size_t N = 200;
+  const size_t READERS = 4;
+  std::vector<size_t> numbers (N);
+  DB db;
+  std::atomic<bool> done (false);
+  std::vector<size_t> errors (READERS, 0), reads (READERS, 0);
+  std::vector<std::thread> readers;
+  for (size_t t = 0; t < READERS; ++t)
+    readers.emplace_back ([&, t]
+    {
+      while (! done.load ())
+      {
+        db.read ([&] (const DB::Index& index)
+        {
+          size_t count = 0;
+          for (const size_t* n : index.query (DB::Query ("name ")))
+            if (n != &numbers[count++])
+              ++errors[t];
+          size_t live = 0; // Added then removed at once: at most one in any version.
+          for (const size_t* n : index.query (DB::Query ("removed")))
+            live += (n != nullptr);
+          if (live > 1)
+            ++errors[t];
+        });
+        ++reads[t];
+      }
+    });
+  std::string removed = "removed";
+  for (size_t i = 0; i < N; ++i)
+  {
+    numbers[i] = i;
+    db.add ("Name " + std::to_string (i), &numbers[i]);
+    db.add (removed, &numbers[0]);
+    db.remove (removed, &numbers[0]);
+  }
+  done = true;
+  for (std::thread& t : readers)
+    t.join ();
+  for (size_t t = 0; t < READERS; ++t)
+    BOOST_CHECK_EQUAL(0u, errors[t]);
+  BOOST_CHECK_EQUAL(3 * N, db.version ());
+  DB::ResultSet r;
+  BOOST_CHECK(db.contains ("name 199", r));
+  BOOST_CHECK_EQUAL(unsigned(1), r.size ());
+  BOOST_CHECK(db.read ([] (const DB::Index& index) {return index.size ();}) <= 2 * (N + 1)); // Removed entries are compacted.
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_odb_benchmark, *boost::unit_test::disabled ()) // 32 readers against one writer, lock free against a global mutex.
+{
+  const size_t READERS = 32;
+  const size_t NAMES = 100000;
+  const std::chrono::milliseconds duration (1000);
+  const char* first[] = {"Maria", "Jos", "Ana", "Joo", "Antnio", "Francisco", "Carlos", "Paulo", "Luza", "Conceio"};
+  const char* surnames[] = {"Silva", "Santos", "Oliveira", "Souza", "Arajo", "Magalhes", "Falco", "Gonalves", "Simes", "Lima"};
+  const char* queries[] = {"silva", "joao sou", "conceicao", "goncalves", "xyz", "ze lima", "luiza"};
+  std::vector<std::string> names;
+  for (size_t i = 0; names.size () < 2 * NAMES; ++i)
+    names.push_back (std::string (first[i % 10]) + " " + surnames[(i / 10) % 10] + " " + surnames[(i / 100) % 10] + " " + std::to_string (i));
+
+  typedef odb::ConcurrentODB<std::string> Concurrent;
+  typedef odb::ODB<std::string> Plain;
+  Concurrent concurrent;
+  Plain plain;
+  std::mutex plain_mutex;
+  for (size_t i = 0; i < NAMES; ++i)
+  {
+    concurrent.add (names[i], &names[i]);
+    plain.add (names[i], &names[i]);
+  }
+
+  for (bool lock_free : {false, true})
+  {
+    std::atomic<bool> done (false);
+    std::atomic<size_t> reads (0);
+    size_t writes = 0;
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < READERS; ++t)
+      readers.emplace_back ([&, t]
+      {
+        Plain::ResultSet r;
+        size_t n = 0;
+        for (size_t q = t; ! done.load (std::memory_order_relaxed); ++q, ++n)
+          if (lock_free)
+            concurrent.contains (queries[q % std::size (queries)], r);
+          else
+          {
+            std::lock_guard<std::mutex> lock (plain_mutex);
+            plain.contains (queries[q % std::size (queries)], r);
+          }
+        reads += n;
+      });
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+    for (size_t i = NAMES; std::chrono::steady_clock::now () - start < duration && i < names.size (); ++i, ++writes)
+      if (lock_free)
+        concurrent.add (names[i], &names[i]);
+      else
+      {
+        std::lock_guard<std::mutex> lock (plain_mutex);
+        plain.add (names[i], &names[i]);
+      }
+    while (std::chrono::steady_clock::now () - start < duration)
+      std::this_thread::sleep_for (std::chrono::milliseconds (1));
+    done = true;
+    for (std::thread& t : readers)
+      t.join ();
+    const double s = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    std::cout << (lock_free ? "ConcurrentODB" : "ODB with a mutex") << ", " << READERS << " readers, 1 writer: "
+              << reads.load () / s << " contains/s, " << writes / s << " adds/s, " << std::thread::hardware_concurrency ()
+              << " hardware threads." << std::endl;
+    BOOST_CHECK(reads.load () > 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(prefix_odb_test) // Completions must be the best scored keys with the prefix, as a full scan finds them.
+{
+  typedef odb::PrefixODB<const std::string> DB;
+  const char* first[] = {"Maria", "Jos", "Ana", "Joo", "Mariana", "Mrio", "Marcos", "Ana Maria", "Joana", "Jo"};
+  const char* surnames[] = {"Silva", "Souza", "Silveira", "Santos", "Simes", ""};
+  std::vector<std::string> keys;
+  for (const char* f : first)
+    for (const char* s : surnames)
+      keys.push_back (std::string (f) + (*s ? " " : "") + s);
+  keys.push_back ("Maria Silva"); // Twice.
+  std::vector<double> scores;
+  std::mt19937 random (7);
+  for (size_t i = 0; i < keys.size (); ++i)
+    scores.push_back (static_cast<double> (random () % 20)); // Ties too.
+  const char* prefixes[] = {"", "m", "MAR", "mari", "maria", "maria s", "maria silva", "maria silvax", "jo", "joa", "joo s", "x", "ana maria si"};
+
+  odb::case_insensitive_no_accents_normalizer<> normalize;
+  for (size_t max_k : {1, 3, 10})
+  {
+    DB db (max_k);
+    for (size_t i = 0; i < keys.size (); ++i)
+      db.add (keys[i], &keys[i], scores[i]);
+    BOOST_CHECK_EQUAL(keys.size (), db.size ());
+    for (const char* p : prefixes)
+      for (size_t k : {size_t (0), size_t (1), size_t (3), size_t (10), size_t (100)})
+      {
+        std::vector<size_t> ids;
+        for (size_t i = 0; i < keys.size (); ++i)
+          if (normalize (keys[i]).compare (0, normalize (p).size (), normalize (p)) == 0)
+            ids.push_back (i);
+        std::stable_sort (ids.begin (), ids.end (), [&] (size_t a, size_t b) {return scores[a] > scores[b];});
+        std::vector<const std::string*> expected;
+        for (size_t i = 0; i < std::min (k, ids.size ()); ++i)
+          expected.push_back (&keys[ids[i]]);
+        std::vector<const std::string*> result;
+        BOOST_CHECK_EQUAL(expected.size (), db.complete (p, k, result));
+        BOOST_CHECK(expected == result);
+      }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(prefix_odb_benchmark, *boost::unit_test::disabled ()) // Type-ahead over one million names, one keystroke at a time.
+{
+  const char* first[] = {"Maria", "Jos", "Ana", "Joo", "Antnio", "Francisco", "Carlos", "Paulo", "Pedro", "Lucas",
+    "Luza", "Mnica", "Mrcia", "Fbio", "Srgio", "Cludia", "Letcia", "Vitria", "Jlia", "Lus", "Gabriel", "Rafael",
+    "Conceio", "Sebastio", "Ins", "Helena", "Raimundo", "Otvio", "Flvia", "Patrcia"};
+  const char* surnames[] = {"Silva", "Santos", "Oliveira", "Souza", "Rodrigues", "Ferreira", "Alves", "Pereira", "Lima",
+    "Gomes", "Ribeiro", "Carvalho", "Arajo", "Magalhes", "Conceio", "Assuno", "Brando", "Falco", "Gonalves",
+    "Guimares", "Simes", "Calixto", "Antunes", "Lopes", "Peixoto", "Teixeira", "Barbosa", "Monteiro", "Cardoso", "Loureno"};
+  const size_t N = 1000000;
+  std::mt19937 random (42);
+  std::vector<std::string> names;
+  names.reserve (N);
+  for (size_t i = 0; i < N; ++i)
+    names.push_back (std::string (first[random () % std::size (first)]) + " " + surnames[random () % std::size (surnames)] + " " +
+                     surnames[random () % std::size (surnames)] + " " + std::to_string (i));
+
+  typedef odb::PrefixODB<std::string> DB;
+  DB db;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  for (size_t i = 0; i < N; ++i)
+    db.add (names[i], &names[i], static_cast<double> (random () % 1000000));
+  const double add_s = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+  std::cout << "PrefixODB add: " << N << " names in " << add_s << " s, " << db.node_count () << " nodes." << std::endl;
+
+  const std::string typed = "Maria Conceio Gonalves 12";
+  std::vector<std::string*> result;
+  const size_t ROUNDS = 1000;
+  size_t found = 0;
+  start = std::chrono::steady_clock::now ();
+  for (size_t r = 0; r < ROUNDS; ++r)
+    for (size_t n = 1; n <= typed.size (); ++n)
+      found += db.complete (typed.substr (0, n), 10, result);
+  const double keystroke_s = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count () / (ROUNDS * typed.size ());
+  std::cout << "PrefixODB complete, k = 10: " << keystroke_s * 1e6 << " us per keystroke." << std::endl;
+  BOOST_CHECK(found > 0);
+  BOOST_CHECK_EQUAL(10u, db.complete ("conceicao", 10, result));
+}
+
+BOOST_AUTO_TEST_CASE(brazilian_names_benchmark, *boost::unit_test::disabled ()) // add and contains on one million names.
+{
+  const char* first[] = {"Maria", "Jos", "Ana", "Joo", "Antnio", "Francisco", "Carlos", "Paulo", "Pedro", "Lucas",
+    "Luza", "Mnica", "Mrcia", "Fbio", "Srgio", "Cludia", "Letcia", "Vitria", "Jlia", "Lus", "Gabriel", "Rafael",
+    "Conceio", "Sebastio", "Ins", "Helena", "Raimundo", "Otvio", "Flvia", "Patrcia"};
+  const char* surnames[] = {"Silva", "Santos", "Oliveira", "Souza", "Rodrigues", "Ferreira", "Alves", "Pereira", "Lima",
+    "Gomes", "Ribeiro", "Carvalho", "Arajo", "Magalhes", "Conceio", "Assuno", "Brando", "Falco", "Gonalves",
+    "Guimares", "Simes", "Calixto", "Antunes", "Lopes", "Peixoto", "Teixeira", "Barbosa", "Monteiro", "Cardoso", "Loureno"};
+  const char* queries[] = {"silva", "JOS", "conceicao", "goncalves sim", "o", "a", "luiza mag", "xyz"};
+  const size_t N = 1000000;
+
+  std::mt19937 random (42);
+  std::uniform_int_distribution<size_t> pick_first (0, std::size (first) - 1);
+  std::uniform_int_distribution<size_t> pick_surname (0, std::size (surnames) - 1);
+  std::vector<std::string> names;
+  names.reserve (N);
+  for (size_t i = 0; i < N; ++i)
+    names.push_back (std::string (first[pick_first (random)]) + " " + surnames[pick_surname (random)] + " " + surnames[pick_surname (random)]);
+
+  typedef odb::ODB<std::string> DB;
+  DB db;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  for (std::string& name : names)
+    db.add (name, &name);
+  const double add_s = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+  std::cout << "ODB add: " << N << " names in " << add_s << " s, " << N / add_s << " names/s, "
+            << db.posting_count () << " postings." << std::endl;
+  BOOST_CHECK_EQUAL(N, db.size ());
+
+  for (const char* q : queries)
+  {
+    DB::ResultSet r;
+    start = std::chrono::steady_clock::now ();
+    db.contains (q, r);
+    const double contains_s = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    std::cout << "ODB contains (\"" << q << "\"): " << r.size () << " names in " << contains_s * 1000 << " ms." << std::endl;
+  }
+  typedef DB::Query Q;
+  start = std::chrono::steady_clock::now ();
+  size_t count = 0;
+  for (std::string* name : db.query (Q ("silva") && "luiz" && !Q ("maria")))
+    count += (name != nullptr);
+  const double query_s = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+  std::cout << "ODB query (silva AND luiz AND NOT maria): " << count << " names in " << query_s * 1000 << " ms." << std::endl;
+
+  // Startup: rebuilding with add above, against opening a snapshot.
+  typedef odb::Snapshot<> Snapshot;
+  const std::filesystem::path path = std::filesystem::temp_directory_path () / "odb_benchmark.odb";
+  {
+    Snapshot::Entries entries;
+    entries.reserve (N);
+    for (DB::ObjectId id = 0; id < N; ++id)
+      entries.push_back (std::make_pair (db.key (id), id));
+    start = std::chrono::steady_clock::now ();
+    Snapshot::write (path, db.get_gram_size (), entries);
+    const double write_s = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    std::cout << "ODB snapshot write: " << write_s << " s, " << std::filesystem::file_size (path) / (1024 * 1024) << " MiB." << std::endl;
+  }
+  {
+    start = std::chrono::steady_clock::now ();
+    Snapshot snapshot (path);
+    odb::case_insensitive_no_accents_normalizer<> normalize;
+    odb::cursor::NodePtr cursor = odb::cursor::compile (snapshot, Q ("silva") && "luiz" && !Q ("maria"), normalize);
+    size_t snapshot_count = 0;
+    for (DB::ObjectId id = cursor->seek (0); id != odb::cursor::END; id = cursor->seek (id + 1))
+      ++snapshot_count;
+    const double open_s = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    std::cout << "ODB snapshot open and first query: " << open_s * 1000 << " ms." << std::endl;
+    BOOST_CHECK_EQUAL(count, snapshot_count);
+  }
+  std::filesystem::remove (path);
+
+  DB::ResultSet r;
+  BOOST_CHECK(! db.contains ("xyz", r));
+  BOOST_CHECK(db.contains (" ", r)); // Every name.
+  BOOST_CHECK_EQUAL(N, r.size ());
+}
+
 BOOST_AUTO_TEST_SUITE_END ()
@@ -0,0 +1,120 @@
+// author : Mauricio Gomes
+// license: MIT (https://opensource.org/licenses/MIT)
+
+#include "../../../unit_test/src/test.hpp"
+
+#include "../offset_ptr.hpp"
+#include "../thread_block_alllocator.hpp"
+#include "../string_def.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pensar_digital
+{
+    namespace test = pensar_digital::unit_test;
+    using namespace pensar_digital::unit_test;
+    namespace cpplib
+    {
+        struct PersonRecord
+        {
+            OffsetString mname;
+            int mage;
+
+            PersonRecord (OffsetHeap& heap, const std::string_view name, const int age) : mname(heap, name), mage(age) {}
+            PersonRecord (PersonRecord&&) noexcept = default;
+        };
+
+        struct PeopleRoot
+        {
+            OffsetVector<PersonRecord> mpeople;
+            OffsetHashMap<OffsetString, uint32_t> mby_name;
+
+            explicit PeopleRoot (OffsetHeap& heap) : mpeople(heap), mby_name(heap) {}
+        };
+
+        void add_people (OffsetHeap& heap, const size_t count)
+        {
+            PeopleRoot* root = heap.construct<PeopleRoot>();
+            heap.set_root(root);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const std::string name = "person " + std::to_string(i);
+                root->mpeople.emplace_back(name, (int)i);
+                root->mby_name.insert_or_assign(std::string_view(name), (uint32_t)i);
+            }
+        }
+
+        TEST(OffsetPtr, true)
+            const size_t PAGES = 64;
+            std::vector<OffsetHeap::Page> a(PAGES);
+            OffsetHeap* heap = OffsetHeap::create(std::span(a));
+            add_people(*heap, 500);
+
+            // Move the whole region somewhere else and wipe the original.
+            std::vector<OffsetHeap::Page> b(PAGES);
+            std::memcpy(b.data(), a.data(), PAGES * sizeof(OffsetHeap::Page));
+            std::memset(a.data(), 0, PAGES * sizeof(OffsetHeap::Page));
+
+            OffsetHeap* moved = OffsetHeap::open(std::span(b));
+            PeopleRoot* root = moved->root<PeopleRoot>();
+            CHECK(moved->contains(root), W("0"));
+            CHECK_EQ(size_t, root->mpeople.size(), 500, W("1"));
+            CHECK(root->mpeople[123].mname == "person 123", W("2"));
+            const uint32_t* index = root->mby_name.find(std::string_view("person 321"));
+            CHECK(index != nullptr && *index == 321, W("3"));
+            CHECK(root->mpeople[*index].mage == 321, W("4"));
+            CHECK(!root->mby_name.contains(std::string_view("nobody")), W("5"));
+            CHECK(root->mby_name.erase(std::string_view("person 0")), W("6"));
+            CHECK_EQ(size_t, root->mby_name.size(), 499, W("7"));
+
+            // Freed blocks are reused: churn does not grow the heap.
+            const std::string_view TEXT = "a string long enough to need its own block";
+            moved->destroy(moved->construct<OffsetString>(TEXT));
+            const size_t used = moved->used();
+            for (int i = 0; i < 1000; ++i)
+                moved->destroy(moved->construct<OffsetString>(TEXT));
+            CHECK_EQ(size_t, moved->used(), used, W("8"));
+
+            bool thrown = false;
+            try
+            {
+                OffsetHeap::open(std::span(a));
+            }
+            catch (const std::runtime_error&)
+            {
+                thrown = true;
+            }
+            CHECK(thrown, W("9. a region without a heap must be rejected"));
+        TEST_END(OffsetPtr)
+
+        TEST(OffsetHeapPersistence, true)
+            const std::filesystem::path path = std::filesystem::temp_directory_path() / "cpplib_offset_heap.dat";
+            const size_t PAGES = 256;
+            {
+                ThreadBlockAllocator<OffsetHeap::Page> pages;
+                pages.add_thread_block(PAGES * sizeof(OffsetHeap::Page), path);
+                OffsetHeap* heap = OffsetHeap::create(std::span(pages.allocate(PAGES), PAGES));
+                add_people(*heap, 2000);
+                pages.mark_dirty(pages.block_objects(0).data(), PAGES);
+                pages.save().get();
+            }
+            {
+                ThreadBlockAllocator<OffsetHeap::Page> pages;
+                pages.load_block(path);
+                PeopleRoot* root = OffsetHeap::open(pages.block_objects(0))->root<PeopleRoot>();
+                CHECK_EQ(size_t, root->mpeople.size(), 2000, W("0"));
+                const uint32_t* index = root->mby_name.find(std::string_view("person 1999"));
+                CHECK(index != nullptr && root->mpeople[*index].mname.view() == "person 1999", W("1"));
+            }
+            std::filesystem::remove(path);
+            std::filesystem::path chain = path;
+            std::filesystem::remove(chain.replace_extension(".crc"));
+            std::filesystem::remove(chain.replace_extension(".chain"));
+        TEST_END(OffsetHeapPersistence)
+    }
+}
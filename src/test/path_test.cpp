@@ -49,5 +49,18 @@ namespace pensar_digital
 
             path2.remove ();
         TEST_END(Path)
+
+        TEST(PathSerialization, true)
+            Path path(W("c:\\tmp\\test\\path_test\\path_test.txt"), 7);
+            MemoryBuffer::Ptr mb = path.bytes();
+            Path path2(*mb);
+            CHECK_EQ(Path, path2, path, W("0"));
+            CHECK_EQ(Id, path2.id(), 7, W("1"));
+
+            Path path3;
+            mb->reset_read_offset();
+            path3.assign(*mb);
+            CHECK_EQ(Path, path3, path, W("2"));
+        TEST_END(PathSerialization)
     }
 }
\ No newline at end of file
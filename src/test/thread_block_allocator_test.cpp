@@ -0,0 +1,547 @@
+// author : Mauricio Gomes
+// license: MIT (https://opensource.org/licenses/MIT)
+
+#include "../../../unit_test/src/test.hpp"
+
+#include "../thread_block_alllocator.hpp"
+#include "../stop_watch.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN64)
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+namespace pensar_digital
+{
+    namespace test = pensar_digital::unit_test;
+    using namespace pensar_digital::unit_test;
+    namespace cpplib
+    {
+        struct BlockRecord
+        {
+            uint64_t id;
+            int data;
+        };
+
+        std::filesystem::path block_path (const std::string& name)
+        {
+            return std::filesystem::temp_directory_path() / ("cpplib_tba_" + name + ".dat");
+        }
+
+        void remove_chain (const std::filesystem::path& first, const size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                std::filesystem::path block = ThreadBlockAllocator<BlockRecord>::chain_block_path(first, i);
+                std::filesystem::remove(block);
+                std::filesystem::remove(block.replace_extension(".md5"));
+                std::filesystem::remove(block.replace_extension(".crc"));
+            }
+            std::filesystem::path chain = first;
+            std::filesystem::remove(chain.replace_extension(".chain"));
+        }
+
+        bool load_throws (const std::filesystem::path& first)
+        {
+            try
+            {
+                ThreadBlockAllocator<BlockRecord> alloc;
+                alloc.load_block(first);
+            }
+            catch (const std::runtime_error&)
+            {
+                return true;
+            }
+            return false;
+        }
+
+        // Page faults of the whole process so far.
+        size_t page_faults ()
+        {
+#if defined(_WIN64)
+            PROCESS_MEMORY_COUNTERS counters = {};
+            GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+            return counters.PageFaultCount;
+#else
+            rusage usage = {};
+            getrusage(RUSAGE_SELF, &usage);
+            return usage.ru_minflt + usage.ru_majflt;
+#endif
+        }
+
+        TEST(ThreadBlockAllocator, true)
+            const std::filesystem::path first = block_path("first");
+            {
+                ThreadBlockAllocator<BlockRecord> alloc;
+                alloc.add_thread_block(4 * sizeof(BlockRecord), first);
+                BlockRecord* a = alloc.allocate(2);
+                BlockRecord* b = alloc.allocate(2);
+                CHECK(b == a + 2, W("0. consecutive allocations must be contiguous in the cached block"));
+                CHECK_EQ(uint64_t, b[1].id, 3, W("1"));
+
+                BlockRecord* c = alloc.allocate(1);
+                CHECK(c != nullptr, W("2. allocation must move to a new block chained to the full one"));
+                CHECK_EQ(size_t, alloc.block_count(), 2, W("3"));
+
+                // Another thread has no block in this allocator, the cache of this thread must not leak to it.
+                bool other_thrown = false;
+                std::thread t([&alloc, &other_thrown]
+                {
+                    try
+                    {
+                        alloc.allocate(1);
+                    }
+                    catch (const std::bad_alloc&)
+                    {
+                        other_thrown = true;
+                    }
+                });
+                t.join();
+                CHECK(other_thrown, W("4. a thread without a block must not allocate"));
+
+                // A second allocator on the same thread must not use the block cached for the first one.
+                ThreadBlockAllocator<BlockRecord> other;
+                bool thrown = false;
+                try
+                {
+                    other.allocate(1);
+                }
+                catch (const std::bad_alloc&)
+                {
+                    thrown = true;
+                }
+                CHECK(thrown, W("5. the thread cache must be per allocator"));
+            }
+            remove_chain(first, 2);
+
+            const size_t THREADS = 4;
+            const size_t N = 1000;
+            std::vector<std::filesystem::path> paths;
+            for (size_t t = 0; t < THREADS; ++t)
+                paths.push_back(block_path("ids_" + std::to_string(t)));
+            std::vector<std::vector<uint64_t>> ids(THREADS);
+            {
+                ThreadBlockAllocator<BlockRecord> alloc;
+                std::vector<std::thread> threads;
+                for (size_t t = 0; t < THREADS; ++t)
+                    threads.emplace_back([&alloc, &ids, &paths, t, N]
+                    {
+                        alloc.add_thread_block(N * sizeof(BlockRecord), paths[t]);
+                        for (size_t i = 0; i < N; ++i)
+                            ids[t].push_back(alloc.allocate(1)->id);
+                    });
+                for (std::thread& thread : threads)
+                    thread.join();
+            }
+            std::set<uint64_t> unique;
+            for (const std::vector<uint64_t>& v : ids)
+                unique.insert(v.begin(), v.end());
+            CHECK_EQ(size_t, unique.size(), THREADS * N, W("6. ids must be unique across threads"));
+            for (const std::filesystem::path& p : paths)
+                std::filesystem::remove(p);
+        TEST_END(ThreadBlockAllocator)
+
+        TEST(ThreadBlockAllocatorChain, true)
+            const std::filesystem::path first = block_path("chain");
+            const size_t CAP = 8 * sizeof(BlockRecord);
+            {
+                ThreadBlockAllocator<BlockRecord> alloc(CAP);
+                alloc.add_thread_block(2 * sizeof(BlockRecord), first);
+                for (int i = 0; i < 15; ++i)
+                    alloc.allocate(1)->data = i;
+                // Blocks of 2, 4, 8 and 8 (capped) records.
+                CHECK_EQ(size_t, alloc.block_count(), 4, W("0"));
+                CHECK_EQ(size_t, alloc.block_objects(1).size(), 4, W("1"));
+                CHECK_EQ(size_t, alloc.block_objects(3).size(), 1, W("2"));
+                CHECK(std::filesystem::exists(block_path("chain.2")), W("3. chained blocks must use deterministic names"));
+                CHECK_EQ(size_t, std::filesystem::file_size(block_path("chain.3")), CAP, W("4"));
+
+                bool thrown = false;
+                try
+                {
+                    alloc.allocate(9);
+                }
+                catch (const std::bad_alloc&)
+                {
+                    thrown = true;
+                }
+                CHECK(thrown, W("5. a request above the block size cap must throw bad_alloc"));
+                alloc.save().get();
+            }
+            {
+                ThreadBlockAllocator<BlockRecord> alloc(CAP);
+                alloc.load_block(first);
+                CHECK_EQ(size_t, alloc.block_count(), 4, W("6. the whole chain must be reopened"));
+                CHECK_EQ(int, alloc.block_objects(0)[1].data, 1, W("7"));
+                CHECK_EQ(int, alloc.block_objects(2)[7].data, 13, W("8"));
+                CHECK_EQ(uint64_t, alloc.block_objects(2)[7].id, 13, W("9"));
+                alloc.allocate(1)->data = 15;
+                CHECK_EQ(int, alloc.block_objects(3)[1].data, 15, W("10. allocation must continue after the saved used bytes"));
+            }
+            remove_chain(first, 4);
+        TEST_END(ThreadBlockAllocatorChain)
+
+        TEST(ThreadBlockAllocatorReuse, true)
+            const std::filesystem::path first = block_path("reuse");
+            const std::filesystem::path other = block_path("reuse_other");
+            {
+                ThreadBlockAllocator<BlockRecord> alloc;
+                alloc.add_thread_block(16 * sizeof(BlockRecord), first);
+                BlockRecord* a = alloc.allocate(4);
+                alloc.deallocate(a, 4);
+                BlockRecord* b = alloc.allocate(2);
+                BlockRecord* c = alloc.allocate(2);
+                CHECK(b == a, W("0. a freed range must be reused"));
+                CHECK(c == a + 2, W("1. the rest of a split range must be reused"));
+                auto stats = alloc.stats();
+                CHECK_EQ(size_t, stats.reused, 2, W("2"));
+                CHECK_EQ(size_t, stats.local_frees, 1, W("3"));
+                CHECK_EQ(size_t, stats.free_bytes, 0, W("4"));
+
+                // Churn must not grow the mapped files.
+                for (int i = 0; i < 10000; ++i)
+                    alloc.deallocate(alloc.allocate(1 + i % 3), 1 + i % 3);
+                stats = alloc.stats();
+                CHECK_EQ(size_t, stats.mapped_bytes, 16 * sizeof(BlockRecord), W("5"));
+                CHECK(stats.reuse_ratio() > 0.99, W("6. churn must be served from the free lists"));
+
+                alloc.deallocate(b, 1);
+                CHECK(alloc.stats().fragmentation() > 0, W("7. a hole must count as fragmentation"));
+
+                // A range freed by another thread goes back to the owner through its return queue.
+                std::promise<BlockRecord*> allocated;
+                std::promise<void> freed;
+                std::promise<BlockRecord*> reallocated;
+                std::thread owner([&]
+                {
+                    alloc.add_thread_block(16 * sizeof(BlockRecord), other);
+                    allocated.set_value(alloc.allocate(3));
+                    freed.get_future().wait();
+                    reallocated.set_value(alloc.allocate(3));
+                });
+                BlockRecord* x = allocated.get_future().get();
+                alloc.deallocate(x, 3);
+                freed.set_value();
+                CHECK(reallocated.get_future().get() == x, W("8. a cross thread free must be reused by the owner"));
+                owner.join();
+                CHECK_EQ(size_t, alloc.stats().remote_frees, 1, W("9"));
+
+                alloc.set_cross_thread_frees(false);
+                std::thread dropper([&alloc, c] { alloc.deallocate(c, 2); });
+                dropper.join();
+                CHECK_EQ(size_t, alloc.stats().dropped_frees, 1, W("10"));
+            }
+            remove_chain(first, 1);
+            remove_chain(other, 1);
+        TEST_END(ThreadBlockAllocatorReuse)
+
+        TEST(ThreadBlockAllocatorChecksum, true)
+            const char* DIGITS = "123456789";
+            CHECK_EQ(uint32_t, crc32c::compute(DIGITS, 9), 0xE3069283u, W("0"));
+            CHECK_EQ(uint32_t, ~crc32c::update_software(~0u, reinterpret_cast<const uint8_t*>(DIGITS), 9), 0xE3069283u, W("1"));
+            CHECK_EQ(uint32_t, crc32c::compute(DIGITS + 4, 5, crc32c::compute(DIGITS, 4)), 0xE3069283u, W("2. crc32c must be incremental"));
+            const md5::MD5Digest ABC = { 0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0, 0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72 };
+            CHECK(md5::compute("abc", 3) == ABC, W("3. md5"));
+
+            const std::filesystem::path first = block_path("checksum");
+            const size_t N = 4096;
+            BlockRecord* records = nullptr;
+            {
+                ThreadBlockAllocator<BlockRecord> alloc;
+                alloc.add_thread_block(N * sizeof(BlockRecord), first);
+                records = alloc.allocate(N);
+                for (size_t i = 0; i < N; ++i)
+                    records[i].data = (int)i;
+                alloc.save().get();
+
+                // By default a save hashes every page again: an unflagged write is covered.
+                records[N / 4].data = -1;
+                alloc.save().get();
+
+                // With dirty tracking, a write flagged with mark_dirty is hashed again by the next save.
+                alloc.set_dirty_tracking(true);
+                records[N / 2].data = -1;
+                alloc.mark_dirty(&records[N / 2]);
+                alloc.save().get();
+            }
+            {
+                ThreadBlockAllocator<BlockRecord> alloc;
+                alloc.load_block(first);
+                CHECK_EQ(int, alloc.block_objects(0)[N / 4].data, -1, W("4. an unflagged write must not break loading"));
+                CHECK_EQ(int, alloc.block_objects(0)[N / 2].data, -1, W("5"));
+            }
+
+            // A .crc file cut short or damaged after a save must be refused, not taken for a partial update. A
+            // leftover temporary file from an interrupted save is ignored.
+            std::filesystem::path crc = first;
+            crc.replace_extension(".crc");
+            CHECK(!std::filesystem::exists(crc.string() + ".tmp"), W("6. the .crc file must be renamed into place"));
+            const std::uintmax_t crc_size = std::filesystem::file_size(crc);
+            std::filesystem::copy_file(crc, crc.string() + ".bak");
+            std::filesystem::resize_file(crc, crc_size - sizeof(uint32_t));
+            CHECK(load_throws(first), W("7. a truncated .crc file must fail verification"));
+            std::filesystem::copy_file(crc.string() + ".bak", crc, std::filesystem::copy_options::overwrite_existing);
+            {
+                std::fstream f(crc, std::ios::binary | std::ios::in | std::ios::out);
+                f.seekp(crc_size - 1);
+                f.put('X');
+            }
+            CHECK(load_throws(first), W("8. a corrupted .crc file must fail verification"));
+            std::filesystem::rename(crc.string() + ".bak", crc);
+            std::ofstream(crc.string() + ".tmp", std::ios::binary) << "torn";
+            CHECK(!load_throws(first), W("9. a leftover .crc.tmp must not affect loading"));
+            std::filesystem::remove(crc.string() + ".tmp");
+
+            // Corrupt one byte of the block file: load_block must refuse it.
+            {
+                std::fstream f(first, std::ios::binary | std::ios::in | std::ios::out);
+                f.seekp(N / 3 * sizeof(BlockRecord) + offsetof(BlockRecord, data));
+                f.put('X');
+            }
+            CHECK(load_throws(first), W("10. a corrupted block must fail verification"));
+
+            {
+                ThreadBlockAllocator<BlockRecord> alloc;
+                alloc.set_checksum(BlockChecksum::MD5);
+                alloc.add_thread_block(N * sizeof(BlockRecord), first);
+                alloc.allocate(N)[7].data = 7;
+                alloc.save().get();
+            }
+            {
+                ThreadBlockAllocator<BlockRecord> alloc;
+                alloc.load_block(first);
+                CHECK_EQ(int, alloc.block_objects(0)[7].data, 7, W("11. md5 checksums must still be supported"));
+            }
+            remove_chain(first, 1);
+        TEST_END(ThreadBlockAllocatorChecksum)
+
+        TEST(ThreadBlockAllocatorFlush, true)
+            const std::filesystem::path first = block_path("flush");
+            const size_t N = 100000;
+            {
+                ThreadBlockAllocator<BlockRecord> alloc(N * sizeof(BlockRecord));
+                alloc.add_thread_block(1024 * sizeof(BlockRecord), first);
+
+                // Allocation goes on, chaining new blocks, while saves are in progress. Writes that may race with a
+                // flush are flagged once done.
+                std::vector<std::future<void>> saves;
+                for (size_t i = 0; i < N; ++i)
+                {
+                    BlockRecord* r = alloc.allocate(1);
+                    r->data = (int)i;
+                    alloc.mark_dirty(r);
+                    if (i % 10000 == 0)
+                        saves.push_back(alloc.save());
+                }
+                for (std::future<void>& f : saves)
+                    f.get();
+                alloc.save().get();
+                CHECK(alloc.stats().flushes >= 1, W("0"));
+
+                // The periodic flush runs without any save() call.
+                const size_t flushes = alloc.stats().flushes;
+                alloc.set_flush_interval(std::chrono::milliseconds(5));
+                for (int i = 0; i < 1000 && alloc.stats().flushes < flushes + 2; ++i)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                CHECK(alloc.stats().flushes >= flushes + 2, W("1. the background flusher must run on its schedule"));
+            }
+            {
+                ThreadBlockAllocator<BlockRecord> alloc;
+                alloc.load_block(first);
+                size_t count = 0;
+                int last = -1;
+                for (size_t b = 0; b < alloc.block_count(); ++b)
+                    for (const BlockRecord& r : alloc.block_objects(b))
+                    {
+                        last = r.data;
+                        ++count;
+                    }
+                CHECK_EQ(size_t, count, N, W("2"));
+                CHECK_EQ(int, last, (int)N - 1, W("3"));
+                std::filesystem::path chain = first;
+                chain.replace_extension(".chain");
+                CHECK(!std::filesystem::exists(chain.string() + ".tmp"), W("4. the chain file must be renamed into place"));
+                remove_chain(first, alloc.block_count());
+            }
+        TEST_END(ThreadBlockAllocatorFlush)
+
+        // Anonymous blocks chain like file blocks but are never written by save().
+        TEST(ThreadBlockAllocatorAnonymous, true)
+            ThreadBlockAllocator<BlockRecord> alloc;
+            alloc.add_anonymous_block(2 * sizeof(BlockRecord), { true, HugePages::NONE, PageAdvice::RANDOM });
+            BlockRecord* a = alloc.allocate(2);
+            BlockRecord* b = alloc.allocate(3);
+            CHECK_EQ(size_t, alloc.block_count(), 2, W("0. a full anonymous block must chain a new one"));
+            CHECK_EQ(uint64_t, b[2].id, 4, W("1"));
+            a[1].data = 7;
+            alloc.save().get();
+            CHECK_EQ(int, alloc.block_objects(0)[1].data, 7, W("2"));
+            CHECK_EQ(size_t, alloc.stats().flushes, 1, W("3"));
+
+            bool thrown = false;
+            try
+            {
+                alloc.add_thread_block(16, std::filesystem::path());
+            }
+            catch (const std::invalid_argument&)
+            {
+                thrown = true;
+            }
+            CHECK(thrown, W("4. a file block needs a path"));
+        TEST_END(ThreadBlockAllocatorAnonymous)
+
+        // Time of save() for a 64 MiB block, first in full then after changing one object. Disabled by default, like
+        // the other benchmarks below: they print timings and write or map 64 MiB blocks.
+        TEST(ThreadBlockAllocatorChecksumBenchmark, false)
+            const std::filesystem::path first = block_path("checksum_bench");
+            const size_t N = (64 << 20) / sizeof(BlockRecord);
+            {
+                ThreadBlockAllocator<BlockRecord> alloc;
+                alloc.set_dirty_tracking(true);
+                alloc.add_thread_block(N * sizeof(BlockRecord), first);
+                BlockRecord* records = alloc.allocate(N);
+                for (size_t i = 0; i < N; ++i)
+                    records[i].data = (int)i;
+                StopWatch<> sw;
+                alloc.save().get();
+                sw.stop();
+                const StopWatch<>::ELAPSED_TYPE full = sw.elapsed();
+
+                records[N / 2].data = -1;
+                alloc.mark_dirty(&records[N / 2]);
+                sw.reset();
+                alloc.save().get();
+                sw.stop();
+                const StopWatch<>::ELAPSED_TYPE incremental = sw.elapsed();
+                std::cout << "ThreadBlockAllocator save of 64 MiB: full = " << full / StopWatch<>::MS << " ms, after one change = "
+                          << incremental / StopWatch<>::MS << " ms." << std::endl;
+                CHECK(incremental < full, W("0. an incremental save must be cheaper than a full one"));
+            }
+            remove_chain(first, 1);
+        TEST_END(ThreadBlockAllocatorChecksumBenchmark)
+
+        // Allocation throughput for 1 to 64 threads, each one bumping its own block.
+        TEST(ThreadBlockAllocatorScalingBenchmark, false)
+            const size_t N = 100000;
+            for (size_t thread_count = 1; thread_count <= 64; thread_count *= 2)
+            {
+                std::vector<std::filesystem::path> paths;
+                for (size_t t = 0; t < thread_count; ++t)
+                    paths.push_back(block_path("bench_" + std::to_string(t)));
+                size_t allocated = 0;
+                StopWatch<>::ELAPSED_TYPE elapsed;
+                {
+                    ThreadBlockAllocator<BlockRecord> alloc;
+                    std::atomic<size_t> count = 0;
+                    StopWatch<> sw;
+                    std::vector<std::thread> threads;
+                    for (size_t t = 0; t < thread_count; ++t)
+                        threads.emplace_back([&alloc, &paths, &count, t, N]
+                        {
+                            alloc.add_thread_block(N * sizeof(BlockRecord), paths[t]);
+                            size_t local = 0;
+                            for (size_t i = 0; i < N; ++i)
+                                local += (alloc.allocate(1) != nullptr);
+                            count += local;
+                        });
+                    for (std::thread& thread : threads)
+                        thread.join();
+                    sw.stop();
+                    elapsed = sw.elapsed();
+                    allocated = count;
+                }
+                std::cout << "ThreadBlockAllocator, " << thread_count << " threads x " << N << " allocations: "
+                          << (double)thread_count * N * StopWatch<>::S / (elapsed > 0 ? elapsed : 1) << " allocations/s." << std::endl;
+                CHECK_EQ(size_t, allocated, thread_count * N, W("0"));
+                for (const std::filesystem::path& p : paths)
+                    std::filesystem::remove(p);
+            }
+        TEST_END(ThreadBlockAllocatorScalingBenchmark)
+
+        // Page faults and allocation throughput of a 64 MiB block for each mapping policy. A policy the system cannot
+        // map, such as explicit huge pages when none are reserved, is reported and skipped.
+        TEST(ThreadBlockAllocatorMappingBenchmark, false)
+            struct Policy
+            {
+                const char* name;
+                bool anonymous;
+                BlockMapping mapping;
+            };
+            const Policy policies[] =
+            {
+                { "file",                                  false, {} },
+                { "file, populate",                        false, { true } },
+                { "file, sequential",                      false, { false, HugePages::NONE, PageAdvice::SEQUENTIAL } },
+                { "file, random",                          false, { false, HugePages::NONE, PageAdvice::RANDOM } },
+                { "anonymous",                             true,  {} },
+                { "anonymous, populate",                   true,  { true } },
+                { "anonymous, transparent huge pages",     true,  { false, HugePages::TRANSPARENT } },
+                { "anonymous, transparent huge, populate", true,  { true, HugePages::TRANSPARENT } },
+                { "anonymous, explicit huge pages",        true,  { true, HugePages::EXPLICIT } }
+            };
+            const std::filesystem::path first = block_path("mapping_bench");
+            const size_t N = (64 << 20) / sizeof(BlockRecord);
+            size_t anonymous_faults = 0;
+            size_t populated_faults = 0;
+            for (const Policy& policy : policies)
+            {
+                remove_chain(first, 1);
+                ThreadBlockAllocator<BlockRecord> alloc;
+                size_t faults = page_faults();
+                StopWatch<> sw;
+                try
+                {
+                    if (policy.anonymous)
+                        alloc.add_anonymous_block(N * sizeof(BlockRecord), policy.mapping);
+                    else
+                        alloc.add_thread_block(N * sizeof(BlockRecord), first, policy.mapping);
+                }
+                catch (const std::exception& e)
+                {
+                    std::cout << "ThreadBlockAllocator mapping " << policy.name << ": unavailable (" << e.what() << ")." << std::endl;
+                    continue;
+                }
+                sw.stop();
+                const StopWatch<>::ELAPSED_TYPE map = sw.elapsed();
+                const size_t map_faults = page_faults() - faults;
+
+                faults = page_faults();
+                sw.reset();
+                BlockRecord* last = nullptr;
+                for (size_t i = 0; i < N; ++i)
+                {
+                    last = alloc.allocate(1);
+                    last->data = (int)i;
+                }
+                sw.stop();
+                const StopWatch<>::ELAPSED_TYPE elapsed = sw.elapsed();
+                const size_t allocate_faults = page_faults() - faults;
+                std::cout << "ThreadBlockAllocator mapping " << policy.name << ": map = " << map / StopWatch<>::MS << " ms, "
+                          << map_faults << " faults; " << N << " allocations = " << (double)N * StopWatch<>::S / (elapsed > 0 ? elapsed : 1)
+                          << " allocations/s, " << allocate_faults << " faults." << std::endl;
+                CHECK_EQ(int, last->data, (int)N - 1, W("0"));
+                CHECK_EQ(uint64_t, last->id, N - 1, W("1"));
+                if (policy.anonymous && policy.mapping.huge_pages == HugePages::NONE)
+                    (policy.mapping.populate ? populated_faults : anonymous_faults) = allocate_faults;
+            }
+            remove_chain(first, 1);
+#if defined(__linux__)
+            CHECK(populated_faults < anonymous_faults, W("2. a populated anonymous block must fault less while allocating"));
+#endif
+        TEST_END(ThreadBlockAllocatorMappingBenchmark)
+    }
+}
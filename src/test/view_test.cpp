@@ -0,0 +1,76 @@
+// author : Mauricio Gomes
+// license: MIT (https://opensource.org/licenses/MIT)
+
+#include "../../../unit_test/src/test.hpp"
+
+#include "../view.hpp"
+#include "../object.hpp"
+#include "../generator.hpp"
+
+#include <array>
+#include <cstring>
+#include <span>
+
+namespace pensar_digital
+{
+    namespace test = pensar_digital::unit_test;
+    using namespace pensar_digital::unit_test;
+    namespace cpplib
+    {
+        TEST(View, true)
+            const Id N = 1000;
+            MemoryBuffer mb(N * Object::SIZE, IndexMode::NO_INDEX);
+            for (Id i = 0; i < N; ++i)
+                pd::Object::get(i)->write_to(mb);
+
+            View<Object> v(mb, 10 * Object::SIZE);
+            CHECK_EQ(Id, v->mid, 10, W("0"));
+            Object o;
+            v.copy_to(o);
+            CHECK_EQ(Id, o.id(), 10, W("1"));
+
+            ViewRange<Object> range(mb);
+            CHECK_EQ(size_t, range.size(), static_cast<size_t>(N), W("2"));
+            Id expected = 0;
+            for (const View<Object> view : range)
+                CHECK_EQ(Id, view->mid, expected++, W("3"));
+            CHECK_EQ(Id, range[N - 1]->mid, N - 1, W("4"));
+
+            Generator<Object> g(1, 0, 5);
+            MemoryBuffer gmb(Generator<Object>::SIZE, IndexMode::NO_INDEX);
+            g.write_to(gmb);
+            View<Generator<Object>> gv(gmb, 0);
+            CHECK_EQ(Id, gv->mstep, 5, W("5"));
+
+            bool thrown = false;
+            try
+            {
+                View<Generator<Object>> wrong(mb, 0);
+            }
+            catch (...)
+            {
+                thrown = true;
+            }
+            CHECK(thrown, W("6. fingerprint mismatch must throw"));
+
+            // A valid record copied one byte past an aligned address: only the alignment check can fail.
+            using DataType = View<Object>::DataType;
+            alignas(DataType) std::array<std::byte, Object::SIZE + alignof(DataType)> scratch = {};
+            std::memcpy(scratch.data(), mb.data() + 10 * Object::SIZE, Object::SIZE);
+            CHECK_EQ(Id, View<Object>(std::span<const std::byte>(scratch.data(), Object::SIZE))->mid, 10, W("7. the aligned copy must be a valid record"));
+            std::memmove(scratch.data() + 1, scratch.data(), Object::SIZE);
+            const std::span<const std::byte> misaligned_record(scratch.data() + 1, Object::SIZE);
+            CHECK(View<Object>::has_tag(misaligned_record), W("8. the misaligned copy must keep its fingerprint"));
+            thrown = false;
+            try
+            {
+                View<Object> misaligned(misaligned_record);
+            }
+            catch (...)
+            {
+                thrown = true;
+            }
+            CHECK(thrown, W("9. misaligned record must throw"));
+        TEST_END(View)
+    }
+}
@@ -1,3 +1,9 @@
+// author : Mauricio Gomes
+// license: MIT (https://opensource.org/licenses/MIT)
+
+#ifndef THREAD_BLOCK_ALLOCATOR_HPP
+#define THREAD_BLOCK_ALLOCATOR_HPP
+
 #include <cstddef>
 #include <thread>
 #include <mutex>
@@ -10,6 +16,24 @@
 #include <array>
 #include <cstring>
 #include <fstream>
+#include <limits>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <cstdint>
+#include <bit>
+#include <map>
+#include <algorithm>
+#include <numeric>
+#include <span>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #include <nmmintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+    #endif
+#endif
 
 #if defined(_WIN64)
     #include <windows.h>
@@ -25,31 +49,233 @@
     #error "Unsupported platform"
 #endif
 
+namespace pensar_digital::cpplib {
+
+namespace crc32c {
+    // CRC-32C (Castagnoli), reflected polynomial 0x82F63B78, as used by iSCSI, ext4 and SSE4.2's crc32 instruction.
+    inline constexpr uint32_t POLYNOMIAL = 0x82F63B78u;
+
+    inline constexpr std::array<uint32_t, 256> make_table() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ ((crc & 1) ? POLYNOMIAL : 0);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }
+
+    inline constexpr std::array<uint32_t, 256> TABLE = make_table();
+
+    inline uint32_t update_software(uint32_t crc, const uint8_t* p, size_t size) noexcept {
+        for (size_t i = 0; i < size; ++i) {
+            crc = TABLE[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    #if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+        #define TBA_CRC32C_HARDWARE 1
+
+        #if defined(__GNUC__) || defined(__clang__)
+            __attribute__((target("sse4.2")))
+        #endif
+        inline uint32_t update_hardware(uint32_t crc, const uint8_t* p, size_t size) noexcept {
+            uint64_t crc64 = crc;
+            for (; size >= 8; size -= 8, p += 8) {
+                uint64_t word;
+                std::memcpy(&word, p, sizeof(word));
+                crc64 = _mm_crc32_u64(crc64, word);
+            }
+            crc = static_cast<uint32_t>(crc64);
+            for (; size > 0; --size, ++p) {
+                crc = _mm_crc32_u8(crc, *p);
+            }
+            return crc;
+        }
+
+        inline bool has_hardware() noexcept {
+            #if defined(_MSC_VER) && !defined(__clang__)
+                static const bool supported = [] {
+                    int info[4];
+                    __cpuid(info, 1);
+                    return (info[2] & (1 << 20)) != 0; // SSE4.2
+                }();
+                return supported;
+            #else
+                static const bool supported = __builtin_cpu_supports("sse4.2");
+                return supported;
+            #endif
+        }
+    #endif
+
+    // CRC-32C of size bytes at data, continuing from crc (the result of a previous call, 0 to start).
+    inline uint32_t compute(const void* data, size_t size, uint32_t crc = 0) noexcept {
+        auto p = static_cast<const uint8_t*>(data);
+        crc = ~crc;
+        #if defined(TBA_CRC32C_HARDWARE)
+            if (has_hardware()) {
+                return ~update_hardware(crc, p, size);
+            }
+        #endif
+        return ~update_software(crc, p, size);
+    }
+}
+
+namespace durable_file {
+    // Replaces path with bytes so that a crash leaves either the old or the new file, never a torn one: the bytes go to
+    // a temporary file that is synced and renamed over path, then the directory is synced so the rename persists.
+    inline void replace(const std::filesystem::path& path, const std::string& bytes) {
+        auto tmp = path;
+        tmp += ".tmp";
+        #if defined(_WIN64)
+            HANDLE file = CreateFileW(tmp.wstring().c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file == INVALID_HANDLE_VALUE) {
+                throw std::runtime_error("Failed to create " + tmp.string());
+            }
+            DWORD written = 0;
+            bool ok = WriteFile(file, bytes.data(), static_cast<DWORD>(bytes.size()), &written, NULL) &&
+                      written == bytes.size() && FlushFileBuffers(file);
+            CloseHandle(file);
+            if (!ok || !MoveFileExW(tmp.wstring().c_str(), path.wstring().c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+                throw std::runtime_error("Failed to write " + path.string());
+            }
+        #else
+            int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1) {
+                throw std::runtime_error("Failed to create " + tmp.string());
+            }
+            size_t done = 0;
+            while (done < bytes.size()) {
+                ssize_t n = write(fd, bytes.data() + done, bytes.size() - done);
+                if (n <= 0) {
+                    break;
+                }
+                done += static_cast<size_t>(n);
+            }
+            bool ok = done == bytes.size() && fsync(fd) == 0;
+            ok = close(fd) == 0 && ok;
+            if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+                throw std::runtime_error("Failed to write " + path.string());
+            }
+            auto dir = path.parent_path();
+            int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+            if (dir_fd == -1 || fsync(dir_fd) != 0) {
+                if (dir_fd != -1) {
+                    close(dir_fd);
+                }
+                throw std::runtime_error("Failed to sync the directory of " + path.string());
+            }
+            close(dir_fd);
+        #endif
+    }
+
+    template<typename T>
+    inline void append(std::string& bytes, const T* data, size_t count) {
+        bytes.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+    }
+}
+
+} // namespace pensar_digital::cpplib
+
 namespace md5 {
     using MD5Digest = std::array<uint8_t, 16>;
 
-    MD5Digest compute(const void* data, size_t size) {
-        MD5Digest digest{};
-        for (size_t i = 0; i < 16; ++i) {
-            digest[i] = static_cast<uint8_t>(i);
+    // RFC 1321.
+    inline MD5Digest compute(const void* data, size_t size) {
+        static constexpr uint32_t K[64] = {
+            0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+            0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+            0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+            0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+            0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+            0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+            0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+            0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+        static constexpr uint32_t R[64] = {
+            7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+            5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+            4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+            6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+        uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+        auto process = [&h](const uint8_t* chunk) {
+            uint32_t m[16];
+            for (int i = 0; i < 16; ++i) {
+                m[i] = uint32_t(chunk[i * 4]) | (uint32_t(chunk[i * 4 + 1]) << 8) |
+                       (uint32_t(chunk[i * 4 + 2]) << 16) | (uint32_t(chunk[i * 4 + 3]) << 24);
+            }
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+            for (uint32_t i = 0; i < 64; ++i) {
+                uint32_t f, g;
+                if (i < 16) {
+                    f = (b & c) | (~b & d);
+                    g = i;
+                } else if (i < 32) {
+                    f = (d & b) | (~d & c);
+                    g = (5 * i + 1) % 16;
+                } else if (i < 48) {
+                    f = b ^ c ^ d;
+                    g = (3 * i + 5) % 16;
+                } else {
+                    f = c ^ (b | ~d);
+                    g = (7 * i) % 16;
+                }
+                f += a + K[i] + m[g];
+                a = d;
+                d = c;
+                c = b;
+                b += std::rotl(f, static_cast<int>(R[i]));
+            }
+            h[0] += a;
+            h[1] += b;
+            h[2] += c;
+            h[3] += d;
+        };
+
+        auto p = static_cast<const uint8_t*>(data);
+        size_t whole = size / 64 * 64;
+        for (size_t i = 0; i < whole; i += 64) {
+            process(p + i);
+        }
+        uint8_t tail[128] = {};
+        size_t rest = size - whole;
+        if (rest) {
+            std::memcpy(tail, p + whole, rest);
+        }
+        tail[rest] = 0x80;
+        size_t tail_size = (rest < 56) ? 64 : 128;
+        uint64_t bits = static_cast<uint64_t>(size) * 8;
+        for (int i = 0; i < 8; ++i) {
+            tail[tail_size - 8 + i] = static_cast<uint8_t>(bits >> (8 * i));
+        }
+        for (size_t i = 0; i < tail_size; i += 64) {
+            process(tail + i);
+        }
+
+        MD5Digest digest;
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                digest[i * 4 + j] = static_cast<uint8_t>(h[i] >> (8 * j));
+            }
         }
         return digest;
     }
 
-    bool verify(const void* data, size_t size, const MD5Digest& digest) {
+    inline bool verify(const void* data, size_t size, const MD5Digest& digest) {
         auto computed = compute(data, size);
         return std::equal(digest.begin(), digest.end(), computed.begin());
     }
 
-    void save_to_file(const std::filesystem::path& path, const MD5Digest& digest) {
-        std::ofstream out(path, std::ios::binary);
-        if (!out) {
-            throw std::runtime_error("Failed to write MD5 file");
-        }
-        out.write(reinterpret_cast<const char*>(digest.data()), digest.size());
+    inline void save_to_file(const std::filesystem::path& path, const MD5Digest& digest) {
+        std::string bytes;
+        pensar_digital::cpplib::durable_file::append(bytes, digest.data(), digest.size());
+        pensar_digital::cpplib::durable_file::replace(path, bytes);
     }
 
-    MD5Digest load_from_file(const std::filesystem::path& path) {
+    inline MD5Digest load_from_file(const std::filesystem::path& path) {
         std::ifstream in(path, std::ios::binary);
         if (!in) {
             throw std::runtime_error("Failed to read MD5 file");
@@ -63,29 +289,124 @@ namespace md5 {
     }
 }
 
+namespace pensar_digital::cpplib {
+
+// Checksum save() writes next to each block. CRC32C is kept per page, so with dirty tracking a save only recomputes the
+// pages written since the last one; MD5 covers the whole used range of the block on every save.
+enum class BlockChecksum {
+    CRC32C,
+    MD5
+};
+
+// Transparent huge pages are a hint (MADV_HUGEPAGE) the kernel only follows for anonymous blocks (and tmpfs files).
+// Explicit huge pages need reserved huge pages (MAP_HUGETLB) for an anonymous block, or a block path on a hugetlbfs
+// mount, which keeps the pages in memory only and does not take the checksum files save() writes. Both round the
+// block size up to whole huge pages and are Linux only, elsewhere they are ignored.
+enum class HugePages {
+    NONE,
+    TRANSPARENT,
+    EXPLICIT
+};
+
+// Expected access pattern of a block, passed to madvise.
+enum class PageAdvice {
+    NORMAL,
+    SEQUENTIAL,
+    RANDOM
+};
+
+// How a block is mapped. Blocks chained to it are mapped the same way.
+struct BlockMapping {
+    // Pre-faults the whole block when it is mapped. File blocks are read ahead (MAP_POPULATE) but keep their pages
+    // clean, so their first write still faults; anonymous blocks are fully faulted in.
+    bool populate = false;
+    HugePages huge_pages = HugePages::NONE;
+    PageAdvice advice = PageAdvice::NORMAL;
+};
+
+} // namespace pensar_digital::cpplib
+
 inline std::thread::id get_current_thread_id() {
     return std::this_thread::get_id();
 }
 
 template<typename T>
 class ThreadBlockAllocator {
+public:
+    using BlockChecksum = pensar_digital::cpplib::BlockChecksum;
+    using HugePages = pensar_digital::cpplib::HugePages;
+    using PageAdvice = pensar_digital::cpplib::PageAdvice;
+    using BlockMapping = pensar_digital::cpplib::BlockMapping;
+
 private:
+    struct ThreadHeap;
+
     struct MemoryBlock {
         void* memory;
         size_t size;
-        size_t used;
+        std::atomic<size_t> used; // Only the owning thread bumps it, other threads (save) just read it.
         std::thread::id thread_id;
         std::filesystem::path file_path;
+        std::filesystem::path chain_root; // Path of the first block of the chain this block belongs to.
+        size_t chain_index;               // Position in the chain, 0 for the first block.
+        ThreadHeap* heap = nullptr;       // Heap of thread_id, set when the block is registered.
         bool is_mapped;
+        BlockMapping mapping;
+        bool anonymous;                   // Not backed by a file (empty file_path): never flushed nor reloaded.
+        std::vector<uint32_t> page_crcs;  // CRC32C of each CHECKSUM_PAGE_SIZE page of [0, used) at the last save.
+        size_t dirty_words;
+        std::unique_ptr<std::atomic<uint64_t>[]> dirty; // One bit per page written since the last save.
+        #if defined(_WIN64)
+            HANDLE file_handle = INVALID_HANDLE_VALUE; // Kept open to flush the file buffers.
+        #else
+            int fd = -1;                               // Kept open for fdatasync.
+        #endif
 
-        MemoryBlock(size_t byte_size, std::thread::id tid, const std::filesystem::path& path)
+        MemoryBlock(size_t byte_size, std::thread::id tid, const std::filesystem::path& path,
+                    const std::filesystem::path& root, size_t index, const BlockMapping& block_mapping = {},
+                    bool open_existing = false)
             : memory(nullptr),
-              size(byte_size),
+              size(mapped_size(byte_size, block_mapping)),
               used(0),
               thread_id(tid),
               file_path(path),
-              is_mapped(false) {
-            map_memory(byte_size);
+              chain_root(root),
+              chain_index(index),
+              is_mapped(false),
+              mapping(block_mapping),
+              anonymous(path.empty()),
+              dirty_words((page_count(size) + 63) / 64),
+              dirty(std::make_unique<std::atomic<uint64_t>[]>(dirty_words)) {
+            map_memory(size, open_existing);
+        }
+
+        // Size of an explicit huge page: the default one in /proc/meminfo, or 2 MiB.
+        static size_t huge_page_size() {
+            static const size_t bytes = [] {
+                size_t kib = 2048;
+                #if defined(__linux__)
+                    std::ifstream meminfo("/proc/meminfo");
+                    std::string key;
+                    size_t value;
+                    while (meminfo >> key >> value) {
+                        if (key == "Hugepagesize:") {
+                            kib = value;
+                            break;
+                        }
+                        meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                    }
+                #endif
+                return kib * 1024;
+            }();
+            return bytes;
+        }
+
+        static size_t mapped_size(size_t byte_size, const BlockMapping& mapping) {
+            if (mapping.huge_pages != HugePages::EXPLICIT) {
+                return byte_size;
+            }
+            size_t huge = huge_page_size();
+            return (byte_size + huge - 1) / huge * huge;
         }
 
         ~MemoryBlock() {
@@ -94,16 +415,38 @@ private:
             } else if (memory) {
                 std::free(memory);
             }
+            #if defined(_WIN64)
+                if (file_handle != INVALID_HANDLE_VALUE) {
+                    CloseHandle(file_handle);
+                }
+            #else
+                if (fd != -1) {
+                    close(fd);
+                }
+            #endif
+        }
+
+        // Maps the file at file_path, or anonymous memory if there is none, then applies the mapping hints. A new file
+        // is created (or truncated) and sized to byte_size unless open_existing is set.
+        void map_memory(size_t byte_size, bool open_existing = false) {
+            if (anonymous) {
+                map_anonymous(byte_size);
+            } else {
+                map_file(byte_size, open_existing);
+            }
+            is_mapped = true;
+            size = byte_size;
+            advise();
         }
 
-        void map_memory(size_t byte_size) {
+        void map_file(size_t byte_size, bool open_existing) {
             #if defined(_WIN64)
                 HANDLE hFile = CreateFileA(
                     file_path.string().c_str(),
                     GENERIC_READ | GENERIC_WRITE,
                     0,
                     NULL,
-                    CREATE_ALWAYS,
+                    open_existing ? OPEN_EXISTING : CREATE_ALWAYS,
                     FILE_ATTRIBUTE_NORMAL,
                     NULL);
                 
@@ -119,36 +462,44 @@ private:
                     static_cast<DWORD>(byte_size),
                     NULL);
 
-                CloseHandle(hFile);
-
                 if (!hMap) {
+                    CloseHandle(hFile);
                     throw std::runtime_error("Failed to create file mapping");
                 }
+                file_handle = hFile;
 
                 memory = MapViewOfFile(hMap, FILE_MAP_ALL_ACCESS, 0, 0, byte_size);
                 CloseHandle(hMap);
 
             #elif defined(__linux__) || defined(__APPLE__)
-                int fd = open(file_path.string().c_str(), 
-                            O_RDWR | O_CREAT | O_TRUNC, 
+                fd = open(file_path.string().c_str(), 
+                            open_existing ? O_RDWR : (O_RDWR | O_CREAT | O_TRUNC), 
                             S_IRUSR | S_IWUSR);
                 
                 if (fd == -1) {
-                    throw std::runtime_error("Failed to create file");
+                    throw std::runtime_error(open_existing ? "Failed to open file" : "Failed to create file");
                 }
 
-                if (ftruncate(fd, byte_size) == -1) {
+                if (!open_existing && ftruncate(fd, byte_size) == -1) {
                     close(fd);
+                    fd = -1;
                     throw std::runtime_error("Failed to set file size");
                 }
 
+                int flags = MAP_SHARED;
+                #if defined(MAP_POPULATE)
+                    if (mapping.populate) {
+                        flags |= MAP_POPULATE;
+                    }
+                #endif
                 memory = mmap(NULL, byte_size, 
                             PROT_READ | PROT_WRITE, 
-                            MAP_SHARED, fd, 0);
+                            flags, fd, 0);
                 
-                close(fd);
-
                 if (memory == MAP_FAILED) {
+                    close(fd);
+                    fd = -1;
+                    memory = nullptr;
                     throw std::runtime_error("Failed to map memory");
                 }
             #endif
@@ -156,61 +507,700 @@ private:
             if (!memory) {
                 throw std::bad_alloc();
             }
-            is_mapped = true;
-            size = byte_size;
+        }
+
+        // Private zero-filled memory for scratch blocks.
+        void map_anonymous(size_t byte_size) {
+            #if defined(_WIN64)
+                memory = VirtualAlloc(NULL, byte_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+            #elif defined(__linux__) || defined(__APPLE__)
+                int flags = MAP_PRIVATE | MAP_ANON;
+                #if defined(MAP_HUGETLB)
+                    if (mapping.huge_pages == HugePages::EXPLICIT) {
+                        flags |= MAP_HUGETLB;
+                    }
+                #endif
+                memory = mmap(NULL, byte_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+                if (memory == MAP_FAILED) {
+                    memory = nullptr;
+                    throw std::runtime_error("Failed to map anonymous memory");
+                }
+            #endif
+
+            if (!memory) {
+                throw std::bad_alloc();
+            }
+        }
+
+        // Passes the access pattern and huge page hints, then pre-faults the block if asked to. The hints come first
+        // so an anonymous block is populated with huge pages.
+        void advise() noexcept {
+            #if defined(__linux__) || defined(__APPLE__)
+                if (mapping.advice == PageAdvice::SEQUENTIAL) {
+                    madvise(memory, size, MADV_SEQUENTIAL);
+                } else if (mapping.advice == PageAdvice::RANDOM) {
+                    madvise(memory, size, MADV_RANDOM);
+                }
+                #if defined(MADV_HUGEPAGE)
+                    if (mapping.huge_pages == HugePages::TRANSPARENT) {
+                        madvise(memory, size, MADV_HUGEPAGE);
+                    }
+                #endif
+            #endif
+            if (!mapping.populate) {
+                return;
+            }
+            if (anonymous) {
+                #if defined(MADV_POPULATE_WRITE)
+                    if (madvise(memory, size, MADV_POPULATE_WRITE) == 0) {
+                        return;
+                    }
+                #endif
+                // Zero is what the page already holds, so the write only faults it in.
+                for (size_t offset = 0; offset < size; offset += CHECKSUM_PAGE_SIZE) {
+                    static_cast<volatile char*>(memory)[offset] = 0;
+                }
+                return;
+            }
+            #if !defined(MAP_POPULATE)
+                // Reading keeps the file pages clean, writing them would make the next flush write the whole block.
+                char sink = 0;
+                for (size_t offset = 0; offset < size; offset += CHECKSUM_PAGE_SIZE) {
+                    sink ^= static_cast<volatile const char*>(memory)[offset];
+                }
+                (void)sink;
+            #endif
+        }
+
+        // Reserves bytes at the end of the used range. Called only by the owning thread, so no lock is needed.
+        void* try_bump(size_t bytes) noexcept {
+            size_t offset = used.load(std::memory_order_relaxed);
+            if (bytes > size - offset) {
+                return nullptr;
+            }
+            used.store(offset + bytes, std::memory_order_release);
+            return static_cast<char*>(memory) + offset;
+        }
+
+        bool contains(const void* p) const noexcept {
+            auto begin = static_cast<const char*>(memory);
+            auto q = static_cast<const char*>(p);
+            return q >= begin && q < begin + size;
         }
 
         void unmap_memory() {
             if (!is_mapped || !memory) return;
 
             #if defined(_WIN64)
-                UnmapViewOfFile(memory);
+                if (anonymous) {
+                    VirtualFree(memory, 0, MEM_RELEASE);
+                } else {
+                    UnmapViewOfFile(memory);
+                }
             #elif defined(__linux__) || defined(__APPLE__)
                 munmap(memory, size);
             #endif
         }
 
-        void save_checksum() {
-            auto checksum = md5::compute(memory, used);
-            auto md5_path = file_path;
-            md5_path.replace_extension(".md5");
-            md5::save_to_file(md5_path, checksum);
+        static size_t page_count(size_t bytes) noexcept {
+            return (bytes + CHECKSUM_PAGE_SIZE - 1) / CHECKSUM_PAGE_SIZE;
+        }
+
+        // Flags the pages of [p, p + bytes) for the next save's checksum.
+        void mark_dirty(const void* p, size_t bytes) noexcept {
+            if (bytes == 0) {
+                return;
+            }
+            size_t offset = static_cast<const char*>(p) - static_cast<const char*>(memory);
+            size_t page = offset / CHECKSUM_PAGE_SIZE;
+            size_t last = (offset + bytes - 1) / CHECKSUM_PAGE_SIZE;
+            while (page <= last) {
+                size_t word = page / 64;
+                size_t end = std::min(last + 1, (word + 1) * 64);
+                size_t width = end - page;
+                uint64_t bits = (width == 64 ? ~uint64_t(0) : ((uint64_t(1) << width) - 1)) << (page % 64);
+                if ((dirty[word].load(std::memory_order_relaxed) & bits) != bits) {
+                    dirty[word].fetch_or(bits, std::memory_order_relaxed);
+                }
+                page = end;
+            }
+        }
+
+        uint32_t page_crc(size_t page, size_t used_bytes) const noexcept {
+            size_t begin = page * CHECKSUM_PAGE_SIZE;
+            return pensar_digital::cpplib::crc32c::compute(static_cast<const char*>(memory) + begin, std::min(CHECKSUM_PAGE_SIZE, used_bytes - begin));
+        }
+
+        std::filesystem::path checksum_path(const char* extension) const {
+            auto path = file_path;
+            path.replace_extension(extension);
+            return path;
+        }
+
+        // Header of the .crc file, followed by one CRC32C per page.
+        struct CrcHeader {
+            uint64_t magic;
+            uint64_t page_size;
+            uint64_t used;
+            uint64_t page_count;
+        };
+
+        inline static constexpr uint64_t CRC_MAGIC = 0x3233435243414254ull; // "TBACRC32"
+
+        // Pages flagged since the last flush, or not covered by it, in ascending order. Clears their flags.
+        std::vector<size_t> take_dirty(size_t used_bytes) {
+            size_t pages = page_count(used_bytes);
+            size_t old_pages = std::min(page_crcs.size(), pages);
+            std::vector<size_t> changed;
+            for (size_t word = 0; word < dirty_words; ++word) {
+                if (dirty[word].load(std::memory_order_relaxed) == 0) {
+                    continue;
+                }
+                uint64_t bits = dirty[word].exchange(0, std::memory_order_acquire);
+                uint64_t later = 0;
+                for (; bits; bits &= bits - 1) {
+                    size_t page = word * 64 + std::countr_zero(bits);
+                    if (page >= pages) {
+                        later |= bits & (~bits + 1); // Bumped after used was read, keep it for the next flush.
+                    } else if (page < old_pages) {
+                        changed.push_back(page);
+                    }
+                }
+                if (later) {
+                    dirty[word].fetch_or(later, std::memory_order_relaxed);
+                }
+            }
+            for (size_t page = old_pages; page < pages; ++page) {
+                changed.push_back(page);
+            }
+            return changed;
+        }
+
+        // Schedules the write back of the given pages and waits until the file data is on disk.
+        void sync_pages(const std::vector<size_t>& pages, size_t used_bytes) {
+            #if defined(_WIN64)
+                for_each_run(pages, [&](size_t first, size_t last) {
+                    size_t begin = first * CHECKSUM_PAGE_SIZE;
+                    size_t end = std::min((last + 1) * CHECKSUM_PAGE_SIZE, used_bytes);
+                    if (!FlushViewOfFile(static_cast<char*>(memory) + begin, end - begin)) {
+                        throw std::runtime_error("Failed to sync memory to disk");
+                    }
+                });
+                if (!pages.empty() && !FlushFileBuffers(file_handle)) {
+                    throw std::runtime_error("Failed to sync memory to disk");
+                }
+            #elif defined(__linux__) || defined(__APPLE__)
+                static const size_t os_page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                for_each_run(pages, [&](size_t first, size_t last) {
+                    size_t begin = first * CHECKSUM_PAGE_SIZE / os_page * os_page;
+                    size_t end = std::min((last + 1) * CHECKSUM_PAGE_SIZE, used_bytes);
+                    if (msync(static_cast<char*>(memory) + begin, end - begin, MS_ASYNC) == -1) {
+                        throw std::runtime_error("Failed to sync memory to disk");
+                    }
+                });
+                #if defined(__linux__)
+                    int result = pages.empty() ? 0 : fdatasync(fd);
+                #else
+                    int result = pages.empty() ? 0 : fsync(fd);
+                #endif
+                if (result == -1) {
+                    throw std::runtime_error("Failed to sync memory to disk");
+                }
+            #endif
+        }
+
+        // Calls f(first, last) for each run of consecutive pages in the sorted pages.
+        template<typename F>
+        static void for_each_run(const std::vector<size_t>& pages, F&& f) {
+            for (size_t i = 0; i < pages.size();) {
+                size_t j = i + 1;
+                while (j < pages.size() && pages[j] == pages[j - 1] + 1) {
+                    ++j;
+                }
+                f(pages[i], pages[j - 1]);
+                i = j;
+            }
+        }
+
+        // Writes the pages changed since the last flush to disk, then their checksum. Without dirty tracking every page
+        // of [0, used) counts as changed. Only the flusher thread calls it. Returns the used bytes covered.
+        size_t flush(BlockChecksum kind, bool dirty_tracking) {
+            size_t used_bytes = used.load(std::memory_order_acquire);
+            std::vector<size_t> changed = take_dirty(used_bytes);
+            if (!dirty_tracking) {
+                changed.resize(page_count(used_bytes));
+                std::iota(changed.begin(), changed.end(), size_t(0));
+            }
+            sync_pages(changed, used_bytes);
+            if (kind == BlockChecksum::MD5) {
+                md5::save_to_file(checksum_path(".md5"), md5::compute(memory, used_bytes));
+                std::filesystem::remove(checksum_path(".crc"));
+                page_crcs.clear();
+                return used_bytes;
+            }
+            std::filesystem::remove(checksum_path(".md5"));
+            page_crcs.resize(page_count(used_bytes));
+            for (size_t page : changed) {
+                page_crcs[page] = page_crc(page, used_bytes);
+            }
+            write_crc_file(used_bytes);
+            return used_bytes;
+        }
+
+        // Replaces the .crc file with the current page checksums. Only the changed pages were hashed again, but the
+        // file is written whole (4 bytes per page) through a synced rename: entries patched in place could be torn by
+        // a crash and disagree with the synced data.
+        void write_crc_file(size_t used_bytes) {
+            CrcHeader header{CRC_MAGIC, CHECKSUM_PAGE_SIZE, used_bytes, page_crcs.size()};
+            std::string bytes;
+            pensar_digital::cpplib::durable_file::append(bytes, &header, 1);
+            pensar_digital::cpplib::durable_file::append(bytes, page_crcs.data(), page_crcs.size());
+            pensar_digital::cpplib::durable_file::replace(checksum_path(".crc"), bytes);
         }
 
-        bool verify_checksum() const {
-            auto md5_path = file_path;
-            md5_path.replace_extension(".md5");
+        // Checks the mapped bytes of [0, used) against the .crc (or .md5) file saved with them.
+        bool verify_checksum() {
+            size_t used_bytes = used.load();
+            auto crc_path = checksum_path(".crc");
+            if (std::filesystem::exists(crc_path)) {
+                std::ifstream in(crc_path, std::ios::binary);
+                CrcHeader header{};
+                in.read(reinterpret_cast<char*>(&header), sizeof(header));
+                if (!in.good() || header.magic != CRC_MAGIC || header.page_size != CHECKSUM_PAGE_SIZE ||
+                    header.used != used_bytes || header.page_count != page_count(used_bytes)) {
+                    return false;
+                }
+                std::vector<uint32_t> stored(header.page_count);
+                in.read(reinterpret_cast<char*>(stored.data()), stored.size() * sizeof(uint32_t));
+                if (!in.good()) {
+                    return false;
+                }
+                for (size_t page = 0; page < stored.size(); ++page) {
+                    if (page_crc(page, used_bytes) != stored[page]) {
+                        return false;
+                    }
+                }
+                page_crcs = std::move(stored);
+                return true;
+            }
+            auto md5_path = checksum_path(".md5");
             if (!std::filesystem::exists(md5_path)) {
                 return false;
             }
             auto stored_checksum = md5::load_from_file(md5_path);
-            return md5::verify(memory, used, stored_checksum);
+            return md5::verify(memory, used_bytes, stored_checksum);
         }
     };
 
+    // Range of count objects released by deallocate.
+    struct FreeRange {
+        T* p;
+        size_t count;
+        MemoryBlock* block;
+    };
+
+    // Range released by a thread that does not own it, waiting in the owner's return queue.
+    struct ReturnNode {
+        FreeRange range;
+        ReturnNode* next;
+    };
+
+    // Counters written by a single thread are updated with a relaxed load and store, which is cheaper than
+    // fetch_add, and read with relaxed loads by stats().
+    static void add(std::atomic<size_t>& counter, size_t value) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // Per thread allocation state: the block being bumped and the free lists. Only the owning thread touches the free
+    // lists; other threads hand ranges back through the lock-free returned stack, drained by the owner.
+    struct ThreadHeap {
+        // Ranges of fewer than EXACT_BINS objects have a bin per count; larger ones are binned by power of two, bin
+        // EXACT_BINS + k holding [2^(k+6), 2^(k+7)) objects. A bit mask per group marks the non empty bins, so the
+        // smallest bin that fits is found without scanning.
+        inline static constexpr size_t EXACT_BINS = 64;
+        inline static constexpr size_t BIN_COUNT = EXACT_BINS + std::numeric_limits<size_t>::digits - 6;
+
+        std::thread::id thread_id;
+        MemoryBlock* current = nullptr;
+        std::array<std::vector<FreeRange>, BIN_COUNT> bins;
+        uint64_t exact_mask = 0;
+        uint64_t power_mask = 0;
+        std::atomic<ReturnNode*> returned{nullptr};
+        std::atomic<size_t> free_bytes{0};     // In the bins and in returned.
+        std::atomic<size_t> allocations{0};
+        std::atomic<size_t> reused{0};
+        std::atomic<size_t> local_frees{0};
+        std::atomic<size_t> remote_frees{0};
+        std::atomic<size_t> dropped_frees{0};
+
+        explicit ThreadHeap(std::thread::id tid) : thread_id(tid) {}
+
+        ~ThreadHeap() {
+            ReturnNode* node = returned.exchange(nullptr);
+            while (node) {
+                ReturnNode* next = node->next;
+                delete node;
+                node = next;
+            }
+        }
+
+        static size_t bin(size_t count) noexcept {
+            return count < EXACT_BINS ? count : EXACT_BINS + std::bit_width(count) - 7;
+        }
+
+        bool has_free() const noexcept {
+            return (exact_mask | power_mask) != 0 || returned.load(std::memory_order_relaxed) != nullptr;
+        }
+
+        void mark(size_t b, bool non_empty) noexcept {
+            uint64_t& mask = b < EXACT_BINS ? exact_mask : power_mask;
+            uint64_t bit = uint64_t(1) << (b < EXACT_BINS ? b : b - EXACT_BINS);
+            mask = non_empty ? (mask | bit) : (mask & ~bit);
+        }
+
+        // Owner thread only.
+        void release(FreeRange range) {
+            size_t b = bin(range.count);
+            bins[b].push_back(range);
+            mark(b, true);
+        }
+
+        // Any thread. Lock-free push onto the owner's returned stack.
+        void push_returned(FreeRange range) {
+            auto node = new ReturnNode{range, returned.load(std::memory_order_relaxed)};
+            while (!returned.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+            }
+            free_bytes.fetch_add(range.count * sizeof(T), std::memory_order_relaxed);
+            remote_frees.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // First non empty bin of a group at or after bit first, or npos.
+        static size_t next_bin(uint64_t mask, size_t first) noexcept {
+            if (first >= 64) {
+                return npos;
+            }
+            mask &= ~uint64_t(0) << first;
+            return mask ? std::countr_zero(mask) : npos;
+        }
+
+        inline static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+        // Owner thread only. Takes count objects from the smallest range that fits, splitting it. Returns a null range
+        // if none fits.
+        FreeRange reuse(size_t count) {
+            drain_returned();
+            size_t b = bin(count);
+            size_t found = npos;
+            if (b < EXACT_BINS) {
+                found = next_bin(exact_mask, b);
+                if (found == npos && (found = next_bin(power_mask, 0)) != npos) {
+                    found += EXACT_BINS;
+                }
+            } else if (!bins[b].empty() && bins[b].back().count >= count) {
+                found = b;
+            } else if ((found = next_bin(power_mask, b - EXACT_BINS + 1)) != npos) {
+                found += EXACT_BINS;
+            }
+            if (found == npos) {
+                return {nullptr, 0, nullptr};
+            }
+            FreeRange range = bins[found].back();
+            bins[found].pop_back();
+            if (bins[found].empty()) {
+                mark(found, false);
+            }
+            if (range.count > count) {
+                release({range.p + count, range.count - count, range.block});
+            }
+            free_bytes.fetch_sub(count * sizeof(T), std::memory_order_relaxed);
+            add(reused, 1);
+            range.count = count;
+            return range;
+        }
+
+        void drain_returned() {
+            if (!returned.load(std::memory_order_relaxed)) {
+                return;
+            }
+            ReturnNode* node = returned.exchange(nullptr, std::memory_order_acquire);
+            while (node) {
+                ReturnNode* next = node->next;
+                release(node->range);
+                delete node;
+                node = next;
+            }
+        }
+    };
+
+    // Heap of the calling thread in the allocator identified by owner. Ids are never reused, so an entry left by a
+    // destroyed allocator is simply ignored.
+    struct ThreadCache {
+        uint64_t owner = 0;
+        ThreadHeap* heap = nullptr;
+    };
+
+    static ThreadCache& thread_cache() noexcept {
+        thread_local ThreadCache cache;
+        return cache;
+    }
+
+    inline static std::atomic<uint64_t> next_instance_id{1};
+
     std::vector<std::unique_ptr<MemoryBlock>> blocks;
-    std::mutex blocks_mutex;
+    std::vector<std::unique_ptr<ThreadHeap>> heaps;
+    std::map<const void*, MemoryBlock*> block_index; // By start address, to find the block of a freed pointer.
+    std::mutex blocks_mutex; // Taken only to register, replace, look up or save blocks.
+    std::atomic<bool> cross_thread_frees{true};
     std::atomic<uint64_t> id_counter{0};
+    const uint64_t instance_id = next_instance_id++;
+    size_t max_block_size = DEFAULT_MAX_BLOCK_SIZE;
+    size_t growth_factor = DEFAULT_GROWTH_FACTOR;
+    BlockChecksum checksum = BlockChecksum::CRC32C; // Guarded by blocks_mutex.
+    bool dirty_tracking = false;                    // Guarded by blocks_mutex.
+    std::atomic<size_t> flushes{0};
+    std::mutex flush_mutex; // Guards the flusher state below.
+    std::condition_variable flush_cv;
+    std::vector<std::promise<void>> flush_waiters;
+    std::chrono::milliseconds flush_interval{0};
+    bool stop_flusher = false;
+    std::thread flusher; // Started by the first save() or set_flush_interval().
+
+    // Slow path: finds a block of the calling thread with room for bytes_needed, chaining a new one to the
+    // thread's last block if none has room, and caches it.
+    MemoryBlock* replace_block(size_t bytes_needed) {
+        std::thread::id current_thread = get_current_thread_id();
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        MemoryBlock* last = nullptr;
+        MemoryBlock* found = nullptr;
+        for (auto& block : blocks) {
+            if (block->thread_id == current_thread) {
+                last = block.get();
+                if (bytes_needed <= block->size - block->used.load(std::memory_order_relaxed)) {
+                    found = block.get();
+                    break;
+                }
+            }
+        }
+        if (!found) {
+            if (!last) {
+                throw std::bad_alloc(); // Chains need a first block (and its path) registered by add_thread_block.
+            }
+            found = chain_block(*last, bytes_needed);
+        }
+        found->heap->current = found;
+        ThreadCache& cache = thread_cache();
+        cache.owner = instance_id;
+        cache.heap = found->heap;
+        return found;
+    }
+
+    // Takes ownership of block, attaching it to the heap of its thread. blocks_mutex must be held.
+    MemoryBlock* register_block(std::unique_ptr<MemoryBlock> block) {
+        ThreadHeap* heap = nullptr;
+        for (auto& h : heaps) {
+            if (h->thread_id == block->thread_id) {
+                heap = h.get();
+                break;
+            }
+        }
+        if (!heap) {
+            heaps.push_back(std::make_unique<ThreadHeap>(block->thread_id));
+            heap = heaps.back().get();
+        }
+        block->heap = heap;
+        blocks.push_back(std::move(block));
+        block_index[blocks.back()->memory] = blocks.back().get();
+        return blocks.back().get();
+    }
+
+    // Unregisters the blocks from index first on. blocks_mutex must be held.
+    void unregister_blocks(size_t first) {
+        for (size_t i = first; i < blocks.size(); ++i) {
+            block_index.erase(blocks[i]->memory);
+        }
+        blocks.resize(first);
+    }
+
+    // Block holding p, or nullptr. blocks_mutex must be held.
+    MemoryBlock* find_block(const void* p) const {
+        auto it = block_index.upper_bound(p);
+        if (it == block_index.begin()) {
+            return nullptr;
+        }
+        --it;
+        return it->second->contains(p) ? it->second : nullptr;
+    }
+
+    // Maps the block following last in its chain. blocks_mutex must be held.
+    MemoryBlock* chain_block(const MemoryBlock& last, size_t bytes_needed) {
+        size_t next_size = std::max(std::min(grown_size(last.size), max_block_size), bytes_needed);
+        if (next_size > max_block_size) {
+            throw std::bad_alloc();
+        }
+        size_t index = last.chain_index + 1;
+        auto path = last.anonymous ? std::filesystem::path() : chain_block_path(last.chain_root, index);
+        return register_block(std::make_unique<MemoryBlock>(next_size, last.thread_id, path, last.chain_root, index,
+            last.mapping));
+    }
+
+    size_t grown_size(size_t size) const noexcept {
+        return (size > std::numeric_limits<size_t>::max() / growth_factor) ? std::numeric_limits<size_t>::max() : size * growth_factor;
+    }
 
-    void save_win64(MemoryBlock& block) {
-        block.save_checksum();
-        FlushViewOfFile(block.memory, block.used);
+    // Per chain file written by save(): ChainHeader followed by one ChainEntry per block.
+    struct ChainHeader {
+        uint64_t magic;
+        uint64_t count;
+    };
+
+    struct ChainEntry {
+        uint64_t size;
+        uint64_t used;
+    };
+
+    inline static constexpr uint64_t CHAIN_MAGIC = 0x4E49414843425454ull; // "TTBCHAIN"
+
+    static std::filesystem::path chain_file_path(const std::filesystem::path& root) {
+        auto path = root;
+        path.replace_extension(".chain");
+        return path;
+    }
+
+    // Writes the chain file of every chain in flushed, the blocks of a flush with the used bytes it covered.
+    static void write_chains(const std::vector<std::pair<MemoryBlock*, size_t>>& flushed) {
+        for (auto& [root_block, root_used] : flushed) {
+            if (root_block->chain_index != 0) {
+                continue;
+            }
+            std::vector<ChainEntry> entries;
+            for (auto& [block, used_bytes] : flushed) {
+                if (block->chain_root == root_block->chain_root) {
+                    if (block->chain_index != entries.size()) {
+                        throw std::runtime_error("Block chain is not contiguous");
+                    }
+                    entries.push_back({block->size, used_bytes});
+                }
+            }
+            ChainHeader header{CHAIN_MAGIC, entries.size()};
+            std::string bytes;
+            pensar_digital::cpplib::durable_file::append(bytes, &header, 1);
+            pensar_digital::cpplib::durable_file::append(bytes, entries.data(), entries.size());
+            pensar_digital::cpplib::durable_file::replace(chain_file_path(root_block->chain_root), bytes);
+        }
+    }
+
+    static std::vector<ChainEntry> load_chain(const std::filesystem::path& root) {
+        std::ifstream in(chain_file_path(root), std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Failed to read block chain file");
+        }
+        ChainHeader header{};
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!in.good() || header.magic != CHAIN_MAGIC) {
+            throw std::runtime_error("Invalid block chain file");
+        }
+        std::vector<ChainEntry> entries(header.count);
+        in.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(ChainEntry));
+        if (!in.good()) {
+            throw std::runtime_error("Incomplete block chain file");
+        }
+        return entries;
+    }
+
+    // Maps an existing block file of a chain and checks it against its checksum. blocks_mutex must be held.
+    void open_block(const std::filesystem::path& root, size_t index, size_t byte_size, size_t used_bytes,
+                    const BlockMapping& mapping, std::thread::id thread_id) {
+        auto path = chain_block_path(root, index);
+        if (!std::filesystem::exists(path)) {
+            throw std::runtime_error("Block file does not exist");
+        }
+        if (std::filesystem::file_size(path) != byte_size || used_bytes > byte_size) {
+            throw std::runtime_error("Block file size does not match its chain");
+        }
+        auto block = std::make_unique<MemoryBlock>(byte_size, thread_id, path, root, index, mapping, true);
+        block->used = used_bytes;
+        if (!block->verify_checksum()) {
+            throw std::runtime_error("Checksum verification failed");
+        }
+        register_block(std::move(block));
+    }
+
+    // Flushes the file blocks registered when it starts. blocks_mutex is only held to list them, so allocation, and
+    // even registering new blocks, goes on while pages are written.
+    void flush_blocks() {
+        std::vector<MemoryBlock*> snapshot;
+        BlockChecksum kind;
+        bool tracking;
+        {
+            std::lock_guard<std::mutex> lock(blocks_mutex);
+            for (auto& block : blocks) {
+                if (!block->anonymous) {
+                    snapshot.push_back(block.get());
+                }
+            }
+            kind = checksum;
+            tracking = dirty_tracking;
+        }
+        std::vector<std::pair<MemoryBlock*, size_t>> flushed;
+        for (MemoryBlock* block : snapshot) {
+            flushed.emplace_back(block, block->flush(kind, tracking));
+        }
+        write_chains(flushed);
+        flushes.fetch_add(1, std::memory_order_relaxed);
     }
 
-    void save_linux(MemoryBlock& block) {
-        block.save_checksum();
-        if (msync(block.memory, block.used, MS_SYNC) == -1) {
-            throw std::runtime_error("Failed to sync memory to disk");
+    // Background flusher: flushes when save() asks for it and every flush_interval if it is not zero.
+    void flusher_loop() {
+        std::unique_lock<std::mutex> lock(flush_mutex);
+        while (true) {
+            if (flush_waiters.empty() && !stop_flusher) {
+                // Also woken by set_flush_interval, so a new interval takes effect at once.
+                if (flush_interval.count() > 0) {
+                    flush_cv.wait_for(lock, flush_interval);
+                } else {
+                    flush_cv.wait(lock);
+                    if (flush_waiters.empty() && !stop_flusher && flush_interval.count() == 0) {
+                        continue;
+                    }
+                }
+            }
+            if (stop_flusher && flush_waiters.empty()) {
+                return;
+            }
+            // Waiters registered before the flush starts are served by it, later ones by the next flush.
+            auto waiters = std::move(flush_waiters);
+            flush_waiters.clear();
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                flush_blocks();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            for (auto& waiter : waiters) {
+                if (error) {
+                    waiter.set_exception(error);
+                } else {
+                    waiter.set_value();
+                }
+            }
+            lock.lock();
         }
     }
 
-    void save_ios(MemoryBlock& block) {
-        block.save_checksum();
-        if (msync(block.memory, block.used, MS_SYNC) == -1) {
-            throw std::runtime_error("Failed to sync memory to disk");
+    // flush_mutex must be held.
+    void start_flusher() {
+        if (!flusher.joinable()) {
+            flusher = std::thread([this] { flusher_loop(); });
         }
     }
 
+    static void free_local(ThreadHeap& heap, FreeRange range) {
+        heap.release(range);
+        heap.free_bytes.fetch_add(range.count * sizeof(T), std::memory_order_relaxed);
+        add(heap.local_frees, 1);
+    }
+
 public:
     using value_type = T;
     using pointer = T*;
@@ -225,70 +1215,108 @@ public:
         using other = ThreadBlockAllocator<U>;
     };
 
+    inline static constexpr size_t CHECKSUM_PAGE_SIZE = 4096;
+    inline static constexpr size_t DEFAULT_MAX_BLOCK_SIZE = size_t(1) << 30;
+    inline static constexpr size_t DEFAULT_GROWTH_FACTOR = 2;
+
     ThreadBlockAllocator() noexcept = default;
+
+    // When a thread's blocks are full a new block, growth_factor times larger than the thread's last one and at most
+    // max_block_size bytes, is mapped and chained to it.
+    explicit ThreadBlockAllocator(size_t max_block_size, size_t growth_factor = DEFAULT_GROWTH_FACTOR) noexcept
+        : max_block_size(max_block_size),
+          growth_factor(std::max<size_t>(growth_factor, 1)) {}
     
     template<typename U>
-    ThreadBlockAllocator(const ThreadBlockAllocator<U>&) noexcept {}
+    ThreadBlockAllocator(const ThreadBlockAllocator<U>& other) noexcept
+        : max_block_size(other.get_max_block_size()),
+          growth_factor(other.get_growth_factor()) {}
+
+    size_t get_max_block_size() const noexcept { return max_block_size; }
+    size_t get_growth_factor() const noexcept { return growth_factor; }
+
+    // File of the block at index in the chain started by first: "heap.dat", "heap.1.dat", "heap.2.dat", ...
+    static std::filesystem::path chain_block_path(const std::filesystem::path& first, size_t index) {
+        if (index == 0) {
+            return first;
+        }
+        auto path = first;
+        path.replace_filename(first.stem().string() + "." + std::to_string(index) + first.extension().string());
+        return path;
+    }
 
+    // Starts a new chain for thread_id with a first block of byte_size bytes mapped at path.
     void add_thread_block(size_t byte_size, 
                          const std::filesystem::path& path,
                          std::thread::id thread_id = get_current_thread_id()) {
+        add_thread_block(byte_size, path, BlockMapping{}, thread_id);
+    }
+
+    void add_thread_block(size_t byte_size,
+                         const std::filesystem::path& path,
+                         const BlockMapping& mapping,
+                         std::thread::id thread_id = get_current_thread_id()) {
+        if (path.empty()) {
+            throw std::invalid_argument("A file block needs a path, use add_anonymous_block for scratch memory");
+        }
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        register_block(std::make_unique<MemoryBlock>(byte_size, thread_id, path, path, 0, mapping));
+    }
+
+    // Starts a new chain for thread_id in anonymous memory, for scratch data that never touches the disk: save()
+    // skips it and it is gone when the allocator is destroyed.
+    void add_anonymous_block(size_t byte_size,
+                            const BlockMapping& mapping = {},
+                            std::thread::id thread_id = get_current_thread_id()) {
         std::lock_guard<std::mutex> lock(blocks_mutex);
-        blocks.push_back(std::make_unique<MemoryBlock>(byte_size, thread_id, path));
+        register_block(std::make_unique<MemoryBlock>(byte_size, thread_id, std::filesystem::path(),
+            std::filesystem::path(), 0, mapping));
     }
 
+    // Reopens the chain whose first block is path, as saved by save(), for thread_id. A block saved without a chain
+    // file is loaded alone and considered full.
     void load_block(const std::filesystem::path& path, 
                    std::thread::id thread_id = get_current_thread_id()) {
+        load_block(path, BlockMapping{}, thread_id);
+    }
+
+    void load_block(const std::filesystem::path& path,
+                   const BlockMapping& mapping,
+                   std::thread::id thread_id = get_current_thread_id()) {
         std::lock_guard<std::mutex> lock(blocks_mutex);
         
         if (!std::filesystem::exists(path)) {
             throw std::runtime_error("Block file does not exist");
         }
-        
-        size_t file_size = std::filesystem::file_size(path);
-        auto block = std::make_unique<MemoryBlock>(file_size, thread_id, path);
-        
-        block->unmap_memory(); // Unmap fresh mapping
-        
-        #if defined(_WIN64)
-            HANDLE hFile = CreateFileA(
-                path.string().c_str(),
-                GENERIC_READ,
-                FILE_SHARE_READ,
-                NULL,
-                OPEN_EXISTING,
-                FILE_ATTRIBUTE_NORMAL,
-                NULL);
-            
-            HANDLE hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
-            void* temp = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, file_size);
-            CloseHandle(hMap);
-            CloseHandle(hFile);
-            
-            if (!block->verify_checksum()) {
-                UnmapViewOfFile(temp);
-                throw std::runtime_error("Checksum verification failed");
-            }
-            UnmapViewOfFile(temp);
-            
-            block->map_memory(file_size);
-            
-        #elif defined(__linux__) || defined(__APPLE__)
-            int fd = open(path.string().c_str(), O_RDONLY);
-            void* temp = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
-            close(fd);
-            
-            if (!block->verify_checksum()) {
-                munmap(temp, file_size);
-                throw std::runtime_error("Checksum verification failed");
-            }
-            munmap(temp, file_size);
-            
-            block->map_memory(file_size);
-        #endif
-        
-        block->used = file_size;
-        blocks.push_back(std::move(block));
+
+        if (!std::filesystem::exists(chain_file_path(path))) {
+            size_t file_size = std::filesystem::file_size(path);
+            open_block(path, 0, file_size, file_size, mapping, thread_id);
+            return;
+        }
+
+        auto entries = load_chain(path);
+        size_t first = blocks.size();
+        try {
+            for (size_t i = 0; i < entries.size(); ++i) {
+                open_block(path, i, entries[i].size, entries[i].used, mapping, thread_id);
+            }
+        } catch (...) {
+            unregister_blocks(first);
+            throw;
+        }
+    }
+
+    size_t block_count() {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        return blocks.size();
+    }
+
+    // Objects allocated in the block at index, in registration order (chains are contiguous).
+    std::span<T> block_objects(size_t index) {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        MemoryBlock& block = *blocks.at(index);
+        return std::span<T>(static_cast<T*>(block.memory), block.used.load() / sizeof(T));
     }
 
     T* allocate(size_type n) {
@@ -296,44 +1324,191 @@ public:
                      "ThreadBlockAllocator only supports trivially copyable types");
 
         size_type bytes_needed = n * sizeof(T);
-        std::thread::id current_thread = get_current_thread_id();
-        
-        std::lock_guard<std::mutex> lock(blocks_mutex);
-        
-        for (auto& block : blocks) {
-            if (block->thread_id == current_thread && 
-                block->used + bytes_needed <= block->size) {
-                
-                T* ptr = reinterpret_cast<T*>(
-                    static_cast<char*>(block->memory) + block->used);
-                
-                for (size_type i = 0; i < n; ++i) {
-                    new(&ptr[i]) T();
-                    if constexpr (requires { ptr[i].id; }) {
-                        ptr[i].id = id_counter++;
-                    }
+
+        // Fast path: reuse a freed range or bump the block cached for this thread, no lock.
+        ThreadCache& cache = thread_cache();
+        ThreadHeap* heap = (cache.owner == instance_id) ? cache.heap : nullptr;
+        void* memory = nullptr;
+        MemoryBlock* block = nullptr;
+        if (heap) {
+            if (heap->has_free()) {
+                FreeRange range = heap->reuse(n);
+                memory = range.p;
+                block = range.block;
+            }
+            if (!memory) {
+                block = heap->current;
+                memory = block->try_bump(bytes_needed);
+            }
+        }
+        if (!memory) {
+            block = replace_block(bytes_needed);
+            heap = block->heap;
+            memory = block->try_bump(bytes_needed);
+        }
+        add(heap->allocations, 1);
+
+        T* ptr = static_cast<T*>(memory);
+        uint64_t id = 0;
+        if constexpr (requires { ptr->id; }) {
+            id = id_counter.fetch_add(n, std::memory_order_relaxed);
+        }
+        for (size_type i = 0; i < n; ++i) {
+            new(&ptr[i]) T();
+            if constexpr (requires { ptr[i].id; }) {
+                ptr[i].id = id++;
+            }
+        }
+        if (!block->anonymous) {
+            block->mark_dirty(ptr, bytes_needed);
+        }
+        return ptr;
+    }
+
+    // Makes the range available to later allocate calls of the thread owning its block. A range freed by another
+    // thread goes through the owner's lock-free return queue, or is dropped if cross thread frees are disabled.
+    void deallocate(T* p, size_type n) noexcept {
+        if (!p || n == 0) {
+            return;
+        }
+        ThreadCache& cache = thread_cache();
+        ThreadHeap* heap = (cache.owner == instance_id) ? cache.heap : nullptr;
+        ThreadHeap* owner = nullptr;
+        try {
+            if (heap && heap->current->contains(p)) {
+                free_local(*heap, {p, n, heap->current});
+                return;
+            }
+            MemoryBlock* block = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(blocks_mutex);
+                block = find_block(p);
+                if (!block) {
+                    return;
                 }
-                
-                block->used += bytes_needed;
-                return ptr;
+                owner = block->heap;
+            }
+            if (owner->thread_id == get_current_thread_id()) {
+                free_local(*owner, {p, n, block});
+                return;
+            }
+            if (cross_thread_frees.load(std::memory_order_relaxed)) {
+                owner->push_returned({p, n, block});
+                return;
             }
+        } catch (...) {
+            // Out of memory for the free list: the range is leaked, as if it was never freed.
+        }
+        if (owner) {
+            owner->dropped_frees.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Flags n objects at p as written, so the next flush hashes their pages again. Only needed with dirty tracking:
+    // allocate flags the objects it constructs, later writes must be flagged here once done, or a flush that read the
+    // pages before the write leaves a CRC32C that no longer matches and load_block fails. Writes made while no flush
+    // can run (no pending save() and no flush interval) before the next save() are covered by allocate's flag.
+    void mark_dirty(const T* p, size_type n = 1) {
+        ThreadCache& cache = thread_cache();
+        ThreadHeap* heap = (cache.owner == instance_id) ? cache.heap : nullptr;
+        if (heap && heap->current->contains(p)) {
+            heap->current->mark_dirty(p, n * sizeof(T));
+            return;
+        }
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        if (MemoryBlock* block = find_block(p)) {
+            block->mark_dirty(p, n * sizeof(T));
         }
-        
-        throw std::bad_alloc();
     }
 
-    void deallocate(T*, size_type) noexcept {}
+    void set_checksum(BlockChecksum kind) {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        checksum = kind;
+    }
 
-    void save() {
+    // Off by default: every flush hashes and syncs all of [0, used) again, so any write is covered. On, a flush only
+    // handles the pages flagged by allocate and mark_dirty since the previous one, which is much cheaper for large
+    // blocks, but one unflagged write makes the saved chain fail verification on load.
+    void set_dirty_tracking(bool enabled) {
         std::lock_guard<std::mutex> lock(blocks_mutex);
+        dirty_tracking = enabled;
+    }
+
+    // When disabled, ranges freed by a thread other than their owner are never reused.
+    void set_cross_thread_frees(bool enabled) noexcept {
+        cross_thread_frees.store(enabled, std::memory_order_relaxed);
+    }
+
+    struct Stats {
+        size_t mapped_bytes = 0;  // Size of all blocks.
+        size_t used_bytes = 0;    // Bytes ever bumped in the blocks.
+        size_t free_bytes = 0;    // Freed bytes waiting for reuse.
+        size_t allocations = 0;
+        size_t reused = 0;        // Allocations served from a free list.
+        size_t local_frees = 0;
+        size_t remote_frees = 0;  // Frees passed to the owning thread.
+        size_t dropped_frees = 0; // Cross thread frees ignored because they are disabled (or out of memory).
+        size_t flushes = 0;       // Background flushes completed.
+
+        // Share of the used bytes that is free, i.e. holes in the blocks.
+        double fragmentation() const noexcept {
+            return used_bytes ? static_cast<double>(free_bytes) / used_bytes : 0.0;
+        }
+
+        double reuse_ratio() const noexcept {
+            return allocations ? static_cast<double>(reused) / allocations : 0.0;
+        }
+    };
+
+    Stats stats() {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        Stats s;
         for (auto& block : blocks) {
-            #if defined(_WIN64)
-                save_win64(*block);
-            #elif defined(__linux__)
-                save_linux(*block);
-            #elif defined(__APPLE__)
-                save_ios(*block);
-            #endif
+            s.mapped_bytes += block->size;
+            s.used_bytes += block->used.load(std::memory_order_relaxed);
+        }
+        for (auto& heap : heaps) {
+            s.free_bytes += heap->free_bytes.load(std::memory_order_relaxed);
+            s.allocations += heap->allocations.load(std::memory_order_relaxed);
+            s.reused += heap->reused.load(std::memory_order_relaxed);
+            s.local_frees += heap->local_frees.load(std::memory_order_relaxed);
+            s.remote_frees += heap->remote_frees.load(std::memory_order_relaxed);
+            s.dropped_frees += heap->dropped_frees.load(std::memory_order_relaxed);
+        }
+        s.flushes = flushes.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    // Asks the background flusher to write the pages changed since the last flush, their checksums and the chain
+    // files, so each chain reopens with a single load_block. The future is ready once they are on disk; allocation
+    // keeps running in the meantime.
+    std::future<void> save() {
+        std::lock_guard<std::mutex> lock(flush_mutex);
+        flush_waiters.emplace_back();
+        std::future<void> done = flush_waiters.back().get_future();
+        start_flusher();
+        flush_cv.notify_one();
+        return done;
+    }
+
+    // Flushes every interval in the background, without waiting for save(). Zero (the default) only flushes on save().
+    void set_flush_interval(std::chrono::milliseconds interval) {
+        std::lock_guard<std::mutex> lock(flush_mutex);
+        flush_interval = interval;
+        if (interval.count() > 0) {
+            start_flusher();
+        }
+        flush_cv.notify_one();
+    }
+
+    ~ThreadBlockAllocator() {
+        {
+            std::lock_guard<std::mutex> lock(flush_mutex);
+            stop_flusher = true;
+            flush_cv.notify_one();
+        }
+        if (flusher.joinable()) {
+            flusher.join();
         }
     }
 
@@ -364,32 +1539,4 @@ bool operator!=(const ThreadBlockAllocator<T>& a, const ThreadBlockAllocator<U>&
     return !(a == b);
 }
 
-struct MyObject {
-    uint64_t id;
-    int data;
-};
-
-int main() {
-    ThreadBlockAllocator<MyObject> alloc;
-    
-    std::filesystem::path path = "block1.dat";
-    alloc.add_thread_block(1024 * sizeof(MyObject), path);
-    
-    MyObject* objects = alloc.allocate(2);
-    objects[0].data = 42;
-    objects[1].data = 84;
-    
-    std::cout << "Object 1 ID: " << objects[0].id << "\n";
-    std::cout << "Object 2 ID: " << objects[1].id << "\n";
-    
-    alloc.save();
-    
-    ThreadBlockAllocator<MyObject> alloc2;
-    alloc2.load_block(path);
-    
-    MyObject* loaded = reinterpret_cast<MyObject*>(alloc2.allocate(0));
-    std::cout << "Loaded Object 1 data: " << loaded[0].data << "\n";
-    std::cout << "Loaded Object 2 data: " << loaded[1].data << "\n";
-    
-    return 0;
-}
\ No newline at end of file
+#endif // THREAD_BLOCK_ALLOCATOR_HPP
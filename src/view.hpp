@@ -0,0 +1,166 @@
+// author : Mauricio Gomes
+// license: MIT (https://opensource.org/licenses/MIT)
+
+#ifndef VIEW_HPP
+#define VIEW_HPP
+
+#include "constant.hpp"
+#include "concept.hpp"
+#include "memory_buffer.hpp"
+#include "object.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <span>
+
+namespace pensar_digital
+{
+    namespace cpplib
+    {
+        /// \brief Offset of the T::Data bytes inside a record written by T::write_to.
+        ///
+        /// Classes whose Data is not the last part of their record (e.g. Command) declare DATA_OFFSET.
+        template <HasStdLayoutTriviallyCopyableData T>
+        constexpr size_t view_data_offset () noexcept
+        {
+            if constexpr (requires { T::DATA_OFFSET; })
+                return T::DATA_OFFSET;
+            else
+                return T::SIZE - T::DATA_SIZE;
+        }
+
+        /// \brief Read only, zero copy access to the T::Data of a record written by T::write_to.
+        ///
+        /// The record must use compact class tags (see ClassInfo). The class fingerprint in front of T::Data and the
+        /// alignment of T::Data are checked once, at construction. The viewed bytes (a MemoryBuffer or a memory
+        /// mapped file) must outlive the view.
+        template <HasStdLayoutTriviallyCopyableData T>
+        class View
+        {
+            public:
+                using DataType = typename T::DataType;
+                inline static constexpr size_t DATA_OFFSET = view_data_offset<T>();
+                inline static constexpr size_t TAG_OFFSET  = DATA_OFFSET - ClassInfo::SIZE;
+
+                /// \brief record must start at the first byte of a T record and hold at least T::SIZE bytes.
+                explicit View (const std::span<const std::byte> record) : mdata(checked(record))
+                {
+                }
+
+                /// \brief Views the T record at offset in mb.
+                View (const MemoryBuffer& mb, const size_t offset)
+                    : View(std::span<const std::byte>(mb.data(), mb.data_size()).subspan(std::min(offset, mb.data_size())))
+                {
+                }
+
+                const DataType& operator*  () const noexcept { return *mdata; }
+                const DataType* operator-> () const noexcept { return  mdata; }
+                const DataType* data       () const noexcept { return  mdata; }
+
+                /// \brief Copies the viewed data into t.
+                T& copy_to (T& t) const noexcept
+                {
+                    std::memcpy(t.data_bytes(), mdata, T::DATA_SIZE);
+                    return t;
+                }
+
+                /// \brief True if p satisfies the alignment of DataType.
+                static bool is_aligned (const void* p) noexcept
+                {
+                    return (reinterpret_cast<std::uintptr_t>(p) % alignof(DataType)) == 0;
+                }
+
+                /// \brief True if record holds a T with the current class fingerprint at the expected place.
+                static bool has_tag (const std::span<const std::byte> record) noexcept
+                {
+                    if (record.size() < T::SIZE)
+                        return false;
+                    Fingerprint fingerprint;
+                    std::memcpy(&fingerprint, record.data() + TAG_OFFSET, sizeof(fingerprint));
+                    return fingerprint == T::INFO.mfingerprint;
+                }
+
+            private:
+                template <HasStdLayoutTriviallyCopyableData> friend class ViewRange;
+
+                struct Unchecked {};
+                View (const std::byte* record, Unchecked) noexcept : mdata(reinterpret_cast<const DataType*>(record + DATA_OFFSET)) {}
+
+                static const DataType* checked (const std::span<const std::byte> record)
+                {
+                    if (record.size() < T::SIZE)
+                        log_throw(W("View: record is smaller than the class size."));
+                    if (!has_tag(record))
+                        log_throw(W("View: class fingerprint mismatch."));
+                    const std::byte* p = record.data() + DATA_OFFSET;
+                    if (!is_aligned(p))
+                        log_throw(W("View: misaligned data."));
+                    // DataType is trivially copyable, an implicit lifetime type, so it may be accessed in place.
+                    return reinterpret_cast<const DataType*>(p);
+                }
+
+                const DataType* mdata; //!< Points into the viewed bytes.
+        };
+
+        /// \brief Range of View<T> over count T records of T::SIZE bytes stored back to back.
+        ///
+        /// Alignment and fingerprints are all checked at construction, so iterating is just pointer arithmetic.
+        template <HasStdLayoutTriviallyCopyableData T>
+        class ViewRange
+        {
+            public:
+                class Iterator
+                {
+                    public:
+                        using iterator_category = std::random_access_iterator_tag;
+                        using value_type        = View<T>;
+                        using difference_type   = std::ptrdiff_t;
+
+                        Iterator (const std::byte* p = nullptr) noexcept : mp(p) {}
+
+                        View<T>   operator*  () const noexcept { return View<T>(mp, typename View<T>::Unchecked{}); }
+                        Iterator& operator++ () noexcept { mp += T::SIZE; return *this; }
+                        Iterator  operator++ (int) noexcept { Iterator it = *this; mp += T::SIZE; return it; }
+                        Iterator& operator+= (const difference_type n) noexcept { mp += n * T::SIZE; return *this; }
+                        View<T>   operator[] (const difference_type n) const noexcept { return *Iterator(mp + n * T::SIZE); }
+                        difference_type operator- (const Iterator& other) const noexcept { return (mp - other.mp) / static_cast<difference_type>(T::SIZE); }
+                        bool operator== (const Iterator& other) const noexcept { return mp == other.mp; }
+
+                    private:
+                        const std::byte* mp;
+                };
+
+                /// \brief bytes must start at the first record. Trailing bytes that do not form a whole record are ignored.
+                explicit ViewRange (const std::span<const std::byte> bytes) : mbegin(bytes.data()), mcount(bytes.size() / T::SIZE)
+                {
+                    if (mcount == 0)
+                        return;
+                    // Every record has the same layout, so checking the first one is enough when T::SIZE keeps the alignment.
+                    if ((T::SIZE % alignof(typename View<T>::DataType) != 0) || !View<T>::is_aligned(mbegin + View<T>::DATA_OFFSET))
+                        log_throw(W("ViewRange: misaligned data."));
+                    for (size_t i = 0; i < mcount; ++i)
+                        if (!View<T>::has_tag(bytes.subspan(i * T::SIZE, T::SIZE)))
+                            log_throw(W("ViewRange: class fingerprint mismatch."));
+                }
+
+                /// \brief Views the unread records in mb.
+                explicit ViewRange (const MemoryBuffer& mb)
+                    : ViewRange(std::span<const std::byte>(mb.data() + mb.roffset(), mb.ravailable()))
+                {
+                }
+
+                Iterator begin () const noexcept { return Iterator(mbegin); }
+                Iterator end   () const noexcept { return Iterator(mbegin + mcount * T::SIZE); }
+                size_t   size  () const noexcept { return mcount; }
+                View<T>  operator[] (const size_t i) const noexcept { return begin()[i]; }
+
+            private:
+                const std::byte* mbegin;
+                size_t mcount;
+        };
+    } // namespace cpplib
+} // namespace pensar_digital
+#endif // VIEW_HPP